@@ -5,10 +5,15 @@
 #include <stdint.h>
 #include <errno.h>
 #include <limits.h>
+#include <ctype.h>
 #include <sys/stat.h>
 
 #ifndef _WIN32 // UNIX
     #include <dirent.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <pthread.h>
+    #include <sys/mman.h>
 #else // WINDOWS
     #include <windows.h>
 #endif
@@ -22,7 +27,10 @@ int print_help(FILE *f){
     return fprintf(f,
 "findglob will find matching files and directories and write them to stdout.\n"
 "\n"
-"usage: findglob PATTERN... [ANTIPATERN...]\n"
+"usage: findglob [OPTIONS] PATTERN... [ANTIPATERN...]\n"
+"       findglob --compile FILE -o OUTPUT\n"
+"       findglob [OPTIONS] --set FILE\n"
+"       findglob --emit-c FILE PATTERN... [ANTIPATERN...]\n"
 "\n"
 "examples:\n"
 "\n"
@@ -86,11 +94,84 @@ int print_help(FILE *f){
 "      - ! -> an ANTIPATTERN\n"
 "      - f -> match against files\n"
 "      - d -> match against directories\n"
+"      - r -> each section is a POSIX extended regular expression\n"
 "      - if no type flag is supplied, it matches all types\n"
 "\n"
 "   Example:\n"
 "       # find files (not dirs) named 'build' except those in build dirs:\n"
 "       findglob ':f:**/build' ':!d:**/build'\n"
+"\n"
+"  - In a regex pattern (the 'r' flag), each section between separators\n"
+"    must match an entire file or directory name, ** still matches any\n"
+"    number of directories, and sections without regex operators are\n"
+"    plain names.  Regexes are compiled to DFAs before searching.\n"
+"\n"
+"  - In a regex, '\\' escapes the next character as usual.  This holds on\n"
+"    Windows too, since only '/' separates sections.  A bracket like [.]\n"
+"    needs no escape, which is easier in shells like cmd.exe that do not\n"
+"    treat '...' as quotes.\n"
+"\n"
+"   Example:\n"
+"       # find versioned shared objects like libfoo.so.1.2:\n"
+"       findglob ':rf:**/lib.*\\.so\\.[0-9]+\\.[0-9]+'\n"
+"       # the same, without backslashes or single quotes (e.g. in cmd.exe):\n"
+"       findglob \":rf:**/lib.*[.]so[.][0-9]+[.][0-9]+\"\n"
+"\n"
+"Options:\n"
+"\n"
+"  - OPTIONs must come before the first PATTERN; use -- to end OPTIONs early\n"
+"\n"
+"  --inode-order\n"
+"      Read directories and descend into subdirectories in inode order\n"
+"      instead of name order, while a helper thread reads the next few\n"
+"      directories ahead of the walk.  This is much faster on cold caches\n"
+"      (fresh CI runners, NFS) where name order scatters reads across the\n"
+"      disk.  Output is buffered and re-sorted, so it is identical to the\n"
+"      default order.  This option has no effect on Windows.\n"
+"\n"
+"  --sorted\n"
+"      Print matches in bytewise-sorted order, as with `LC_ALL=C sort`, even\n"
+"      across several search roots like 'a/**' and '/tmp/**'.  That means\n"
+"      \"a-b\" comes before \"a/x\", unlike the default order.  A single root\n"
+"      is still streamed; several roots are buffered and merged.  Consumers\n"
+"      like `manifest --sorted` may rely on this order and skip sorting.\n"
+"\n"
+"  --front-coded\n"
+"      Print each match as the number of leading bytes it shares with the\n"
+"      match printed before it, a space, and the rest of the match.  Deep\n"
+"      trees print several times fewer bytes this way, especially with\n"
+"      --sorted.  `manifest --front-coded` reads this format, and\n"
+"      `manifest --decode -` turns it back into plain lines.\n"
+"\n"
+"  --dirs FILE\n"
+"      Also write every directory that was read during the search to FILE,\n"
+"      one per line.  A directory's modification time changes when entries\n"
+"      are added to or removed from it, so a build tool which tracks these\n"
+"      directories (like mkninja's add_glob(), through `manifest --depfile`)\n"
+"      knows when the search must be run again.\n"
+"\n"
+"  --compile FILE -o OUTPUT\n"
+"      Read PATTERNs from FILE, one per line, and write them to OUTPUT as a\n"
+"      compiled pattern set instead of searching.  A compiled set holds the\n"
+"      parsed patterns, their resolved start points, and how they group into\n"
+"      searches, so large generated pattern lists need not be re-parsed and\n"
+"      re-resolved on every run.\n"
+"\n"
+"  --emit-c FILE\n"
+"      Instead of searching, write FILE, a C program which searches for the\n"
+"      given PATTERNs with matching code specialized to them: constant names\n"
+"      and the fixed parts of globs become unrolled byte compares, and\n"
+"      regexes become constant tables.  Build it with findglob.c on the\n"
+"      include path (cc -O2 -pthread -I path/to/findglob -o walker FILE).\n"
+"      The walker takes the same OPTIONs as findglob, except --compile,\n"
+"      --set and --emit-c, and rejects any PATTERN.  Sections it cannot\n"
+"      specialize, like globs with several '*', are interpreted as usual.\n"
+"\n"
+"  --set FILE\n"
+"      Search using a compiled pattern set instead of PATTERN arguments.\n"
+"      Start points are revalidated cheaply by device and inode number; if\n"
+"      any moved (or on Windows, where there are no inode numbers), the\n"
+"      original PATTERNs stored in FILE are parsed again as usual.\n"
     );
 }
 
@@ -490,15 +571,31 @@ typedef enum {
     OPT_BOOKENDS,  // e.g. test_*.c
     OPT_CONTAINS,  // e.g. *1999*
     OPT_NONE,      // run the full match engine
+    OPT_REGEX,     // e.g. :r:lib.*\.so\.[0-9]+
 } opt_e;
 
+// a compiled regex section; state 0 is the dead state
+typedef struct {
+    // bytes which the regex never distinguishes share a class
+    uint8_t classmap[256];
+    size_t nclasses;
+    size_t nstates;
+    uint16_t start;
+    // transitions, indexed by state * nclasses + class
+    uint16_t *trans;
+    bool *accept;
+} dfa_t;
+
 typedef struct {
     opt_e opt;
+    // for OPT_REGEX, this is the original regex text
     string_t text;
     // only for OPT_BOOKENDS
     string_t text2;
     // flag each character as literal or not, only for OPT_NONE
     bool *lit;
+    // only for OPT_REGEX
+    dfa_t *dfa;
 } glob_t;
 
 typedef enum {
@@ -516,6 +613,10 @@ typedef union {
 typedef struct {
     section_e type;
     section_u val;
+#ifdef FINDGLOB_SPECIALIZED
+    // set by a generated matcher (findglob --emit-c), or NULL to interpret
+    bool (*spec)(string_t text);
+#endif
 } section_t;
 
 typedef enum {
@@ -538,6 +639,8 @@ typedef struct {
     string_t printstart;
     // for our guaranteed-stable qsort
     size_t order;
+    // text, starts, and tables live in a compiled pattern set's mapping
+    bool mapped;
 } pattern_t;
 
 static const string_t STAR = { .text = "*", .len = 1 };
@@ -724,6 +827,640 @@ int section_parse(section_t *sect, string_t s){
     return 0;
 }
 
+// regex sections
+
+/* With the :r: flag, each section is a POSIX extended regular expression
+   which must match an entire file or directory name.  We compile each one
+   up front: parse it into a tree, build a Thompson NFA from the tree, then
+   run the subset construction to get a table-driven DFA.  Matching a name is
+   then one table lookup per byte, with no backtracking and no allocations. */
+
+// the most DFA states we allow; state ids must fit in a uint16_t
+#define DFA_MAX_STATES 4096
+// the most NFA states we allow, which bounds things like (a{255}){255}
+#define NFA_MAX_STATES 65536
+// the largest allowed bound in a {m,n} repetition
+#define REGEX_DUP_MAX 255
+
+typedef enum {
+    RE_SET,     // one byte out of a set
+    RE_EMPTY,   // matches the empty string
+    RE_CAT,     // a then b
+    RE_ALT,     // a or b
+    RE_REPEAT,  // a, min to max times
+} re_e;
+
+struct re_t;
+typedef struct re_t re_t;
+
+struct re_t {
+    re_e type;
+    // only for RE_SET
+    uint32_t set[8];
+    re_t *a;
+    re_t *b;
+    // only for RE_REPEAT, a max of -1 means unbounded
+    int min;
+    int max;
+};
+
+typedef struct {
+    string_t s;
+    size_t i;
+    pool_t *p;
+    // the first error we hit
+    const char *err;
+} re_parser_t;
+
+void byteset_add(uint32_t *set, unsigned char c){
+    set[c / 32] |= (uint32_t)1 << (c % 32);
+}
+
+bool byteset_has(const uint32_t *set, unsigned char c){
+    return set[c / 32] & ((uint32_t)1 << (c % 32));
+}
+
+re_t *re_node(re_parser_t *rp, re_e type, re_t *a, re_t *b){
+    re_t *node = xmalloc(&rp->p, sizeof(*node));
+    *node = (re_t){ .type = type, .a = a, .b = b };
+    return node;
+}
+
+re_t *re_literal(re_parser_t *rp, unsigned char c){
+    re_t *node = re_node(rp, RE_SET, NULL, NULL);
+    byteset_add(node->set, c);
+    return node;
+}
+
+re_t *re_fail(re_parser_t *rp, const char *err){
+    if(!rp->err) rp->err = err;
+    return NULL;
+}
+
+int re_peek(re_parser_t *rp){
+    if(rp->i >= rp->s.len) return -1;
+    return (unsigned char)rp->s.text[rp->i];
+}
+
+typedef struct {
+    const char *name;
+    int (*fn)(int);
+} re_charclass_t;
+
+static const re_charclass_t re_charclasses[] = {
+    {"alnum", isalnum},
+    {"alpha", isalpha},
+    {"blank", isblank},
+    {"cntrl", iscntrl},
+    {"digit", isdigit},
+    {"graph", isgraph},
+    {"lower", islower},
+    {"print", isprint},
+    {"punct", ispunct},
+    {"space", isspace},
+    {"upper", isupper},
+    {"xdigit", isxdigit},
+};
+
+// parse a bracket expression, like [a-z_] or [^[:digit:]]
+re_t *re_bracket(re_parser_t *rp){
+    string_t s = rp->s;
+    re_t *node = re_node(rp, RE_SET, NULL, NULL);
+    // skip the '['
+    rp->i++;
+    bool negate = (re_peek(rp) == '^');
+    if(negate) rp->i++;
+    // a ']' right after the '[' or '[^' is a literal
+    bool first = true;
+    while(true){
+        int c = re_peek(rp);
+        if(c < 0) return re_fail(rp, "unmatched '['");
+        if(c == ']' && !first){
+            rp->i++;
+            break;
+        }
+        first = false;
+        if(c == '[' && rp->i + 1 < s.len && s.text[rp->i + 1] == ':'){
+            // a character class, like [:alpha:]
+            size_t start = rp->i + 2;
+            size_t end = start;
+            while(end + 1 < s.len){
+                if(s.text[end] == ':' && s.text[end+1] == ']') break;
+                end++;
+            }
+            if(end + 1 >= s.len) return re_fail(rp, "unmatched '[:'");
+            string_t name = string_sub(s, start, end);
+            const re_charclass_t *cc = NULL;
+            size_t ncc = sizeof(re_charclasses) / sizeof(*re_charclasses);
+            for(size_t i = 0; i < ncc; i++){
+                string_t ccname = {
+                    .text = (char*)re_charclasses[i].name,
+                    .len = strlen(re_charclasses[i].name),
+                };
+                if(string_eq(name, ccname)) cc = &re_charclasses[i];
+            }
+            if(!cc) return re_fail(rp, "unknown character class");
+            for(int b = 0; b < 256; b++){
+                if(cc->fn(b)) byteset_add(node->set, (unsigned char)b);
+            }
+            rp->i = end + 2;
+            continue;
+        }
+        rp->i++;
+        if(
+            rp->i + 1 < s.len
+            && s.text[rp->i] == '-'
+            && s.text[rp->i + 1] != ']'
+        ){
+            // a range, like a-z
+            int hi = (unsigned char)s.text[rp->i + 1];
+            if(hi < c) return re_fail(rp, "invalid range in '[]'");
+            for(int b = c; b <= hi; b++){
+                byteset_add(node->set, (unsigned char)b);
+            }
+            rp->i += 2;
+            continue;
+        }
+        byteset_add(node->set, (unsigned char)c);
+    }
+    if(negate){
+        for(size_t i = 0; i < 8; i++) node->set[i] = ~node->set[i];
+    }
+    return node;
+}
+
+re_t *re_alt(re_parser_t *rp);
+
+re_t *re_atom(re_parser_t *rp){
+    int c = re_peek(rp);
+    re_t *node;
+    switch(c){
+        case '(':
+            rp->i++;
+            node = re_alt(rp);
+            if(!node) return NULL;
+            if(re_peek(rp) != ')') return re_fail(rp, "unmatched '('");
+            rp->i++;
+            return node;
+
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            return re_fail(rp, "repetition operator without an operand");
+
+        case '[':
+            return re_bracket(rp);
+
+        case '.':
+            rp->i++;
+            node = re_node(rp, RE_SET, NULL, NULL);
+            memset(node->set, 0xff, sizeof(node->set));
+            return node;
+
+        case '\\':
+            if(rp->i + 1 >= rp->s.len) return re_fail(rp, "trailing '\\'");
+            rp->i += 2;
+            return re_literal(rp, (unsigned char)rp->s.text[rp->i - 1]);
+
+        case '^':
+            // sections are always matched in full, so anchors are no-ops
+            if(rp->i != 0){
+                return re_fail(rp, "'^' is only allowed at the start");
+            }
+            rp->i++;
+            return re_node(rp, RE_EMPTY, NULL, NULL);
+
+        case '$':
+            if(rp->i + 1 != rp->s.len){
+                return re_fail(rp, "'$' is only allowed at the end");
+            }
+            rp->i++;
+            return re_node(rp, RE_EMPTY, NULL, NULL);
+
+        default:
+            rp->i++;
+            return re_literal(rp, (unsigned char)c);
+    }
+}
+
+// parse the digits of a {m,n} bound, returns -1 if there are none
+int re_bound(re_parser_t *rp){
+    int out = -1;
+    for(int c = re_peek(rp); c >= '0' && c <= '9'; c = re_peek(rp)){
+        out = (out < 0 ? 0 : out * 10) + (c - '0');
+        // avoid overflow, we will reject it anyway
+        if(out > REGEX_DUP_MAX) out = REGEX_DUP_MAX + 1;
+        rp->i++;
+    }
+    return out;
+}
+
+re_t *re_repeat(re_parser_t *rp){
+    re_t *node = re_atom(rp);
+    if(!node) return NULL;
+    while(true){
+        int min, max;
+        switch(re_peek(rp)){
+            case '*': min = 0; max = -1; rp->i++; break;
+            case '+': min = 1; max = -1; rp->i++; break;
+            case '?': min = 0; max = 1; rp->i++; break;
+            case '{':
+                rp->i++;
+                min = re_bound(rp);
+                if(min < 0) return re_fail(rp, "invalid '{}' bounds");
+                max = min;
+                if(re_peek(rp) == ','){
+                    rp->i++;
+                    max = re_bound(rp);
+                }
+                if(re_peek(rp) != '}') return re_fail(rp, "unmatched '{'");
+                rp->i++;
+                if(min > REGEX_DUP_MAX || max > REGEX_DUP_MAX){
+                    return re_fail(rp, "'{}' bound is too large");
+                }
+                if(max >= 0 && max < min){
+                    return re_fail(rp, "invalid '{}' bounds");
+                }
+                break;
+            default:
+                return node;
+        }
+        node = re_node(rp, RE_REPEAT, node, NULL);
+        node->min = min;
+        node->max = max;
+    }
+}
+
+re_t *re_cat(re_parser_t *rp){
+    re_t *node = re_node(rp, RE_EMPTY, NULL, NULL);
+    for(int c = re_peek(rp); c >= 0 && c != '|' && c != ')'; c = re_peek(rp)){
+        re_t *next = re_repeat(rp);
+        if(!next) return NULL;
+        if(node->type == RE_EMPTY){
+            node = next;
+        }else{
+            node = re_node(rp, RE_CAT, node, next);
+        }
+    }
+    return node;
+}
+
+re_t *re_alt(re_parser_t *rp){
+    re_t *node = re_cat(rp);
+    if(!node) return NULL;
+    while(re_peek(rp) == '|'){
+        rp->i++;
+        re_t *next = re_cat(rp);
+        if(!next) return NULL;
+        node = re_node(rp, RE_ALT, node, next);
+    }
+    return node;
+}
+
+// an NFA edge; an edge with an empty set is an epsilon edge
+typedef struct {
+    int from;
+    int to;
+    bool eps;
+    uint32_t set[8];
+} nfa_edge_t;
+
+typedef struct {
+    nfa_edge_t *edges;
+    size_t nedges;
+    size_t cap;
+    int nstates;
+    bool toobig;
+} nfa_t;
+
+int nfa_state(nfa_t *nfa){
+    if(nfa->nstates == NFA_MAX_STATES) nfa->toobig = true;
+    if(nfa->toobig) return 0;
+    return nfa->nstates++;
+}
+
+void nfa_edge(nfa_t *nfa, int from, int to, const uint32_t *set){
+    if(nfa->toobig) return;
+    if(nfa->nedges == nfa->cap){
+        nfa->cap = nfa->cap ? nfa->cap * 2 : 64;
+        nfa->edges = realloc(nfa->edges, nfa->cap * sizeof(*nfa->edges));
+        if(!nfa->edges){
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    nfa_edge_t edge = { .from = from, .to = to, .eps = !set };
+    if(set) memcpy(edge.set, set, sizeof(edge.set));
+    nfa->edges[nfa->nedges++] = edge;
+}
+
+// add states and edges so that matching node gets from in to out
+void nfa_build(nfa_t *nfa, const re_t *node, int in, int out){
+    int mid;
+    switch(node->type){
+        case RE_SET:
+            nfa_edge(nfa, in, out, node->set);
+            break;
+
+        case RE_EMPTY:
+            nfa_edge(nfa, in, out, NULL);
+            break;
+
+        case RE_CAT:
+            mid = nfa_state(nfa);
+            nfa_build(nfa, node->a, in, mid);
+            nfa_build(nfa, node->b, mid, out);
+            break;
+
+        case RE_ALT:
+            nfa_build(nfa, node->a, in, out);
+            nfa_build(nfa, node->b, in, out);
+            break;
+
+        case RE_REPEAT:
+            // required copies in series
+            for(int i = 0; i < node->min && !nfa->toobig; i++){
+                mid = nfa_state(nfa);
+                nfa_build(nfa, node->a, in, mid);
+                in = mid;
+            }
+            if(node->max < 0){
+                // a loop on a fresh state, so nothing else can reach it
+                mid = nfa_state(nfa);
+                nfa_edge(nfa, in, mid, NULL);
+                nfa_build(nfa, node->a, mid, mid);
+                nfa_edge(nfa, mid, out, NULL);
+                break;
+            }
+            // optional copies in series, each of which may exit early
+            for(int i = node->min; i < node->max && !nfa->toobig; i++){
+                mid = nfa_state(nfa);
+                nfa_edge(nfa, in, out, NULL);
+                nfa_build(nfa, node->a, in, mid);
+                in = mid;
+            }
+            nfa_edge(nfa, in, out, NULL);
+            break;
+    }
+}
+
+// the subset construction works on sets of NFA states, stored as bitmaps
+typedef struct {
+    const nfa_t *nfa;
+    // edges sorted by their from state; first[s] is s's first edge
+    nfa_edge_t *edges;
+    size_t *first;
+    size_t words;
+    int *stack;
+} subset_t;
+
+void subset_close(subset_t *ss, uint64_t *set){
+    // push every member, then follow epsilon edges until nothing is new
+    size_t n = 0;
+    for(int s = 0; s < ss->nfa->nstates; s++){
+        if(set[s / 64] & ((uint64_t)1 << (s % 64))) ss->stack[n++] = s;
+    }
+    while(n){
+        int s = ss->stack[--n];
+        for(size_t e = ss->first[s]; e < ss->first[s+1]; e++){
+            if(!ss->edges[e].eps) continue;
+            int to = ss->edges[e].to;
+            uint64_t bit = (uint64_t)1 << (to % 64);
+            if(set[to / 64] & bit) continue;
+            set[to / 64] |= bit;
+            ss->stack[n++] = to;
+        }
+    }
+}
+
+int dfa_compile(string_t s, dfa_t **out){
+    int retval = 0;
+    *out = NULL;
+
+    nfa_t nfa = {0};
+    subset_t ss = { .nfa = &nfa };
+    uint64_t *sets = NULL;
+    uint16_t *trans = NULL;
+
+    // parse
+    re_parser_t rp = { .s = s };
+    re_t *tree = re_alt(&rp);
+    if(tree && rp.i < s.len) re_fail(&rp, "unmatched ')'");
+    if(rp.err){
+        fprintf(stderr, "invalid regex '%.*s': %s\n", F(s), rp.err);
+        retval = 1;
+        goto cu;
+    }
+
+    // build the NFA: state 0 is the start and state 1 accepts
+    nfa.nstates = 2;
+    nfa_build(&nfa, tree, 0, 1);
+    if(nfa.toobig){
+        fprintf(stderr, "regex '%.*s' is too large\n", F(s));
+        retval = 1;
+        goto cu;
+    }
+
+    // find classes of bytes which no edge tells apart
+    uint8_t classmap[256] = {0};
+    size_t nclasses = 1;
+    for(size_t e = 0; e < nfa.nedges; e++){
+        if(nfa.edges[e].eps) continue;
+        int remap[512];
+        for(size_t i = 0; i < 2 * nclasses; i++) remap[i] = -1;
+        size_t n = 0;
+        for(int c = 0; c < 256; c++){
+            bool has = byteset_has(nfa.edges[e].set, (unsigned char)c);
+            size_t key = 2 * (size_t)classmap[c] + has;
+            if(remap[key] < 0) remap[key] = (int)n++;
+            classmap[c] = (uint8_t)remap[key];
+        }
+        nclasses = n;
+    }
+    uint8_t reps[256];
+    for(int c = 255; c >= 0; c--) reps[classmap[c]] = (uint8_t)c;
+
+    // index edges by their from state, with a counting sort
+    ss.words = ((size_t)nfa.nstates + 63) / 64;
+    ss.first = calloc((size_t)nfa.nstates + 1, sizeof(*ss.first));
+    ss.edges = malloc((nfa.nedges + 1) * sizeof(*ss.edges));
+    ss.stack = malloc((size_t)nfa.nstates * sizeof(*ss.stack));
+    if(!ss.first || !ss.edges || !ss.stack){
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for(size_t e = 0; e < nfa.nedges; e++) ss.first[nfa.edges[e].from + 1]++;
+    for(int i = 0; i < nfa.nstates; i++) ss.first[i + 1] += ss.first[i];
+    for(size_t e = 0; e < nfa.nedges; e++){
+        // first[from] counts up to its final value as we place edges
+        ss.edges[ss.first[nfa.edges[e].from]++] = nfa.edges[e];
+    }
+    for(int i = nfa.nstates; i > 0; i--) ss.first[i] = ss.first[i - 1];
+    ss.first[0] = 0;
+
+    // the subset construction; DFA state 0 is the empty (dead) set
+    size_t words = ss.words;
+    size_t cap = 16;
+    size_t nstates = 2;
+    sets = calloc(cap * words, sizeof(*sets));
+    trans = calloc(cap * nclasses, sizeof(*trans));
+    if(!sets || !trans){
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    sets[words] = 1;
+    subset_close(&ss, &sets[words]);
+    for(size_t d = 1; d < nstates; d++){
+        for(size_t k = 0; k < nclasses; k++){
+            // make room for one more set, in case this move is new
+            if(nstates == cap){
+                cap *= 2;
+                sets = realloc(sets, cap * words * sizeof(*sets));
+                trans = realloc(trans, cap * nclasses * sizeof(*trans));
+                if(!sets || !trans){
+                    fprintf(stderr, "out of memory\n");
+                    exit(1);
+                }
+            }
+            uint64_t *next = &sets[nstates * words];
+            memset(next, 0, words * sizeof(*next));
+            const uint64_t *cur = &sets[d * words];
+            for(int st = 0; st < nfa.nstates; st++){
+                if(!(cur[st / 64] & ((uint64_t)1 << (st % 64)))) continue;
+                for(size_t e = ss.first[st]; e < ss.first[st+1]; e++){
+                    const nfa_edge_t *edge = &ss.edges[e];
+                    if(edge->eps || !byteset_has(edge->set, reps[k])) continue;
+                    next[edge->to / 64] |= (uint64_t)1 << (edge->to % 64);
+                }
+            }
+            subset_close(&ss, next);
+            // have we seen this set before?
+            size_t found = 0;
+            for(; found < nstates; found++){
+                const uint64_t *old = &sets[found * words];
+                if(memcmp(old, next, words * sizeof(*next)) == 0) break;
+            }
+            if(found == nstates){
+                if(nstates == DFA_MAX_STATES){
+                    fprintf(stderr, "regex '%.*s' is too complex\n", F(s));
+                    retval = 1;
+                    goto cu;
+                }
+                uint16_t *row = &trans[nstates * nclasses];
+                memset(row, 0, nclasses * sizeof(*row));
+                nstates++;
+            }
+            trans[d * nclasses + k] = (uint16_t)found;
+        }
+    }
+
+    // pack the result into a single allocation
+    size_t transbytes = nstates * nclasses * sizeof(*trans);
+    dfa_t *dfa = malloc(sizeof(*dfa) + transbytes + nstates);
+    if(!dfa){
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    *dfa = (dfa_t){
+        .nclasses = nclasses,
+        .nstates = nstates,
+        .start = 1,
+        .trans = (uint16_t*)&dfa[1],
+        .accept = (bool*)((char*)&dfa[1] + transbytes),
+    };
+    memcpy(dfa->classmap, classmap, sizeof(classmap));
+    memcpy(dfa->trans, trans, transbytes);
+    for(size_t d = 0; d < nstates; d++){
+        dfa->accept[d] = sets[d * words] & 2;
+    }
+    *out = dfa;
+
+cu:
+    free(trans);
+    free(sets);
+    free(ss.stack);
+    free(ss.edges);
+    free(ss.first);
+    free(nfa.edges);
+    pool_free(&rp.p);
+    return retval;
+}
+
+bool dfa_match(const dfa_t *dfa, string_t text){
+    size_t state = dfa->start;
+    for(size_t i = 0; i < text.len; i++){
+        uint8_t class = dfa->classmap[(unsigned char)text.text[i]];
+        state = dfa->trans[state * dfa->nclasses + class];
+        // nothing leaves the dead state
+        if(!state) return false;
+    }
+    return dfa->accept[state];
+}
+
+int section_parse_regex(section_t *sect, string_t s){
+    *sect = (section_t){0};
+    if(s.len == 0){
+        // these should be filtered out by path_iter_t
+        fprintf(stderr, "illegal empty section\n");
+        return 1;
+    }
+
+    // ** still means any number of directories
+    if(string_eq(s, DOUBLESTAR)){
+        *sect = (section_t){ .type = SECTION_ANY };
+        return 0;
+    }
+
+    char *out = malloc(s.len + 1);
+    if(!out){
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    // a regex without any operators is a constant, and may be part of a start
+    size_t len = 0;
+    bool literal = true;
+    for(size_t i = 0; literal && i < s.len; i++){
+        char c = s.text[i];
+        if(c == '\\' && i + 1 < s.len){
+            out[len++] = s.text[++i];
+        }else if(strchr("\\.[]()|*+?{}^$", c)){
+            literal = false;
+        }else{
+            out[len++] = c;
+        }
+    }
+    if(literal){
+        out[len] = '\0';
+        *sect = (section_t){
+            .type = SECTION_CONSTANT,
+            .val = { .constant = { .text = out, .len = len } },
+        };
+        return 0;
+    }
+
+    dfa_t *dfa;
+    if(dfa_compile(s, &dfa)){
+        free(out);
+        return 1;
+    }
+    // keep the original text, so identical regexes can be recognized
+    memcpy(out, s.text, s.len);
+    out[s.len] = '\0';
+    *sect = (section_t){
+        .type = SECTION_GLOB,
+        .val = {
+            .glob = {
+                .opt = OPT_REGEX,
+                .text = { .text = out, .len = s.len },
+                .dfa = dfa,
+            },
+        },
+    };
+    return 0;
+}
+
 void section_free(section_t *sect){
     switch(sect->type){
         case SECTION_ANY:
@@ -735,6 +1472,10 @@ void section_free(section_t *sect){
             switch(sect->val.glob.opt){
                 case OPT_ANY:
                     break;
+                case OPT_REGEX:
+                    free(sect->val.glob.dfa);
+                    free(sect->val.glob.text.text);
+                    break;
                 case OPT_NONE:
                     free(sect->val.glob.lit);
                     // fallthru
@@ -768,9 +1509,12 @@ void pattern_add_section(pattern_t *pattern, section_t sect){
 }
 
 // returns length of consumed bytes, or 0 on error
-size_t extended_syntax_parse(string_t path, bool *anti, class_e *class){
+size_t extended_syntax_parse(
+    string_t path, bool *anti, class_e *class, bool *regex
+){
     *anti = false;
     *class = 0;
+    *regex = false;
     for(size_t i = 1; i < path.len; i++){
         switch(path.text[i]){
             case ':':
@@ -808,6 +1552,16 @@ size_t extended_syntax_parse(string_t path, bool *anti, class_e *class){
                 *class |= CLASS_FILE;
                 break;
 
+            case 'r':
+                if(*regex){
+                    fprintf(
+                        stderr, "duplicate 'r' in extended syntax pattern\n"
+                    );
+                    return 0;
+                }
+                *regex = true;
+                break;
+
             default:
                 fprintf(
                     stderr,
@@ -836,9 +1590,10 @@ int pattern_parse(pattern_t *pattern, char *text){
     bool isextended = (path.text[0] == ':');
     bool anti = false;
     class_e class = CLASS_ANY;
+    bool regex = false;
     if(isextended){
         // handle extended syntax patterns
-        size_t ext = extended_syntax_parse(path, &anti, &class);
+        size_t ext = extended_syntax_parse(path, &anti, &class, &regex);
         if(!ext) return 1;
         path = string_sub(path, ext, path.len);
     }else{
@@ -876,7 +1631,8 @@ int pattern_parse(pattern_t *pattern, char *text){
         }
         // normal case
         section_t sect;
-        int ret = section_parse(&sect, sub);
+        int ret = regex ? section_parse_regex(&sect, sub)
+                        : section_parse(&sect, sub);
         if(ret) return ret;
         pattern_add_section(pattern, sect);
     }
@@ -998,11 +1754,21 @@ int pattern_rewrite_start(pattern_t *pattern, string_t new){
 
 void pattern_free(pattern_t *pattern){
     for(size_t i = 0; i < pattern->len; i++){
-        section_free(&pattern->sects[i]);
+        section_t *sect = &pattern->sects[i];
+        if(!pattern->mapped){
+            section_free(sect);
+            continue;
+        }
+        // mapped sections own only their dfa_t, the tables are mapped
+        if(sect->type == SECTION_GLOB && sect->val.glob.opt == OPT_REGEX){
+            free(sect->val.glob.dfa);
+        }
     }
     free(pattern->sects);
-    free(pattern->start.text);
-    free(pattern->printstart.text);
+    if(!pattern->mapped){
+        free(pattern->start.text);
+        free(pattern->printstart.text);
+    }
     *pattern = (pattern_t){0};
 }
 
@@ -1136,6 +1902,9 @@ bool glob_match(string_t glob, bool *lit, string_t text){
 }
 
 bool section_matches(section_t sect, string_t text){
+#ifdef FINDGLOB_SPECIALIZED
+    if(sect.spec) return sect.spec(text);
+#endif
     switch(sect.type){
         case SECTION_CONSTANT: return string_eq(sect.val.constant, text);
         case SECTION_ANY: return true;
@@ -1168,12 +1937,62 @@ bool section_matches(section_t sect, string_t text){
         case OPT_NONE:
             return glob_match(sect.val.glob.text, sect.val.glob.lit, text);
 
+        case OPT_REGEX:
+            return dfa_match(sect.val.glob.dfa, text);
+
         default:
             fprintf(stderr, "unrecognized opt_e: %d\n", sect.val.glob.opt);
             exit(1);
     }
 }
 
+// whether two sections always match the same text
+bool section_eq(const section_t *a, const section_t *b){
+    if(a->type != b->type) return false;
+    if(a->type == SECTION_ANY) return true;
+    if(a->type == SECTION_CONSTANT){
+        return string_eq(a->val.constant, b->val.constant);
+    }
+    const glob_t *x = &a->val.glob;
+    const glob_t *y = &b->val.glob;
+    // a regex is compared by its text, which determines its dfa
+    if(x->opt != y->opt || !string_eq(x->text, y->text)) return false;
+    if(x->opt == OPT_BOOKENDS) return string_eq(x->text2, y->text2);
+    if(x->opt == OPT_NONE){
+        for(size_t i = 0; i < x->text.len; i++){
+            if(x->lit[i] != y->lit[i]) return false;
+        }
+    }
+    return true;
+}
+
+#ifdef FINDGLOB_SPECIALIZED
+/* A generated matcher (see emit_c()) includes this file and defines the
+   table of sections it was generated for, each with a function which
+   matches exactly what section_matches() would match. */
+typedef struct {
+    section_t sect;
+    bool (*fn)(string_t text);
+} spec_t;
+extern const spec_t spec_table[];
+extern const size_t spec_count;
+
+/* sections are bound by content, after starts were resolved and patterns
+   were simplified; anything the table lacks is still interpreted */
+void spec_bind(pattern_t *patterns, size_t npatterns){
+    for(size_t i = 0; i < npatterns; i++){
+        for(size_t j = 0; j < patterns[i].len; j++){
+            section_t *sect = &patterns[i].sects[j];
+            for(size_t k = 0; k < spec_count; k++){
+                if(!section_eq(sect, &spec_table[k].sect)) continue;
+                sect->spec = spec_table[k].fn;
+                break;
+            }
+        }
+    }
+}
+#endif
+
 // match_text() by example:
 //
 // pattern | text | flags | next pattern(s)
@@ -1279,6 +2098,12 @@ match_t match_minus(match_t match, size_t n){
 typedef struct {
     string_t name;
     bool isdir;
+    // only used in --inode-order mode
+    uint64_t ino;
+    // already handed to the read-ahead thread
+    bool queued;
+    // --sorted: matches kept between printing a directory and descending
+    match_array_t *matches;
 } file_t;
 
 // we'll need an array of files at every directory level.
@@ -1294,6 +2119,69 @@ void qsort_files(file_array_t *a){
     qsort(a->items, a->len, sizeof(*a->items), _qsort_files_cmp);
 }
 
+int _qsort_files_ino_cmp(const void *aptr, const void *bptr){
+    const file_t *a = aptr;
+    const file_t *b = bptr;
+    if(a->ino != b->ino) return a->ino < b->ino ? -1 : 1;
+    // hard links share an inode; keep the order deterministic anyway
+    return string_cmp(a->name, b->name);
+}
+
+void qsort_files_ino(file_array_t *a){
+    qsort(a->items, a->len, sizeof(*a->items), _qsort_files_ino_cmp);
+}
+
+/* In --sorted mode, each directory entry becomes one or two events: printing
+   the entry itself, keyed by its name, and (for directories) descending into
+   it, keyed by its name plus a trailing separator.  Visiting events in
+   bytewise key order makes the output bytewise sorted. */
+typedef struct {
+    string_t name;
+    bool descend;
+    size_t idx;
+} event_t;
+
+DEFINE_REUSABLE_ARRAY(event, event_t);
+
+int _qsort_events_cmp(const void *aptr, const void *bptr){
+    const event_t *a = aptr;
+    const event_t *b = bptr;
+    size_t n = MIN(a->name.len, b->name.len);
+    int cmp = memcmp(a->name.text, b->name.text, n);
+    if(cmp) return cmp;
+    // past the end of a name is either the end of the key or a separator
+    int ca = n < a->name.len ? (unsigned char)a->name.text[n]
+           : a->descend ? '/' : -1;
+    int cb = n < b->name.len ? (unsigned char)b->name.text[n]
+           : b->descend ? '/' : -1;
+    if(ca != cb) return ca < cb ? -1 : 1;
+    // names never contain a separator, so the only tie is the same event
+    return 0;
+}
+
+void qsort_events(event_array_t *a){
+    qsort(a->items, a->len, sizeof(*a->items), _qsort_events_cmp);
+}
+
+/* path_cmp orders full paths the same way that a walk which visits each
+   directory's entries in sorted order would print them: a directory is
+   followed immediately by its contents, so "a/x" comes before "a-b" even
+   though '-' < '/'.  We get that by treating the separator as the lowest
+   possible character. */
+int path_cmp(const string_t a, const string_t b){
+    size_t n = MIN(a.len, b.len);
+    for(size_t i = 0; i < n; i++){
+        unsigned char ca = (unsigned char)a.text[i];
+        unsigned char cb = (unsigned char)b.text[i];
+        if(ca == cb) continue;
+        if(_is_sep((char)ca)) return -1;
+        if(_is_sep((char)cb)) return 1;
+        return ca < cb ? -1 : 1;
+    }
+    if(a.len < b.len) return -1;
+    return (int)(b.len < a.len);
+}
+
 // path_startswith is aware that "a/b/c" starts with "a/b" but "a/bb" does not
 bool path_startswith(const string_t a, const string_t b){
     if(!string_startswith(a, b)) return false;
@@ -1304,17 +2192,156 @@ bool path_startswith(const string_t a, const string_t b){
         || _is_sep(a.text[b.len]);           // b is parent of a
 }
 
-#define MAX_PATTERNS 256
-typedef struct {
-    const pattern_t *patterns;
-    size_t npatterns;
-    size_t members[MAX_PATTERNS];
-    size_t nmembers;
+// is every name which b matches also matched by a?  False means "not sure".
+bool section_covers(section_t a, section_t b){
+    if(a.type == SECTION_ANY || b.type == SECTION_ANY){
+        // SECTION_ANY spans directories; the callers handle it
+        return false;
+    }
+    if(b.type == SECTION_CONSTANT){
+        return section_matches(a, b.val.constant);
+    }
+    if(a.type == SECTION_CONSTANT){
+        // b is a glob, which is never a single name
+        return false;
+    }
+    glob_t ga = a.val.glob;
+    glob_t gb = b.val.glob;
+    if(ga.opt == OPT_ANY) return true;
+    bool bprefix = (gb.opt == OPT_PREFIX || gb.opt == OPT_BOOKENDS);
+    if(ga.opt == OPT_PREFIX && bprefix){
+        return string_startswith(gb.text, ga.text);
+    }
+    if(ga.opt == OPT_SUFFIX && gb.opt == OPT_SUFFIX){
+        return string_endswith(gb.text, ga.text);
+    }
+    if(ga.opt == OPT_SUFFIX && gb.opt == OPT_BOOKENDS){
+        return string_endswith(gb.text2, ga.text);
+    }
+    if(ga.opt == OPT_CONTAINS && gb.opt != OPT_NONE && gb.opt != OPT_REGEX){
+        // every other kind of glob contains its literal text
+        return string_contains(gb.text, ga.text)
+            || (gb.opt == OPT_BOOKENDS && string_contains(gb.text2, ga.text));
+    }
+    // otherwise, only identical globs
+    if(ga.opt != gb.opt) return false;
+    if(!string_eq(ga.text, gb.text)) return false;
+    if(ga.opt == OPT_BOOKENDS) return string_eq(ga.text2, gb.text2);
+    if(ga.opt == OPT_NONE){
+        return memcmp(ga.lit, gb.lit, ga.text.len * sizeof(*ga.lit)) == 0;
+    }
+    return true;
+}
+
+// is every path which b matches also matched by a?  False means "not sure".
+// An inner ** matches zero or more names, but a trailing ** must absorb at
+// least one section of b, since a/** only matches a itself when a is a
+// directory.
+bool sections_cover(
+    const section_t *a, size_t na, const section_t *b, size_t nb
+){
+    if(na == 0) return nb == 0;
+    if(a[0].type == SECTION_ANY){
+        if(na == 1) return nb > 0;
+        for(size_t k = 0; k <= nb; k++){
+            if(sections_cover(a + 1, na - 1, b + k, nb - k)) return true;
+        }
+        return false;
+    }
+    if(nb == 0) return false;
+    if(!section_covers(a[0], b[0])) return false;
+    return sections_cover(a + 1, na - 1, b + 1, nb - 1);
+}
+
+/* does pattern a make pattern b redundant?  Beyond matching everything b
+   matches, a must also print it the same way: either a starts strictly
+   above b, so b could never be a root, or they share a start and printstart,
+   so either root prints identically. */
+bool pattern_covers(const pattern_t *a, const pattern_t *b){
+    if(a->anti != b->anti) return false;
+    if((a->class & b->class) != b->class) return false;
+    if(!path_startswith(b->start, a->start)) return false;
+    if(
+        a->start.len == b->start.len
+        && !string_eq(a->printstart, b->printstart)
+    ){
+        return false;
+    }
+    return sections_cover(a->sects, a->len, b->sects, b->len);
+}
+
+// Drop redundant patterns before the walk: duplicates, patterns subsumed by
+// another (src/**/*.c by **/*.c), and antipatterns whose start is neither
+// above nor below any pattern's start, since they could never match.  Every
+// kept match_t costs us something in every directory we visit.  This must
+// run after starts have been rewritten to their realpath.
+void patterns_simplify(pattern_t *patterns, size_t *npatterns){
+    size_t n = *npatterns;
+    bool *dropped = calloc(n ? n : 1, sizeof(*dropped));
+    if(!dropped){
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for(size_t i = 0; i < n; i++){
+        for(size_t j = 0; j < n; j++){
+            if(i == j || dropped[j]) continue;
+            if(!pattern_covers(&patterns[j], &patterns[i])) continue;
+            // of two equal patterns, keep the first
+            if(j > i && pattern_covers(&patterns[i], &patterns[j])) continue;
+            dropped[i] = true;
+            break;
+        }
+    }
+    for(size_t i = 0; i < n; i++){
+        if(dropped[i] || !patterns[i].anti) continue;
+        bool reachable = false;
+        for(size_t j = 0; j < n && !reachable; j++){
+            if(dropped[j] || patterns[j].anti) continue;
+            reachable = path_startswith(patterns[i].start, patterns[j].start)
+                     || path_startswith(patterns[j].start, patterns[i].start);
+        }
+        dropped[i] = !reachable;
+    }
+    // compact what is left, preserving order
+    size_t kept = 0;
+    for(size_t i = 0; i < n; i++){
+        if(dropped[i]){
+            pattern_free(&patterns[i]);
+            continue;
+        }
+        patterns[kept++] = patterns[i];
+    }
+    *npatterns = kept;
+    free(dropped);
+}
+
+#define MAX_PATTERNS 256
+typedef struct {
+    const pattern_t *patterns;
+    size_t npatterns;
+    size_t members[MAX_PATTERNS];
+    size_t nmembers;
     size_t i;
+    // precomputed groups from a compiled pattern set, or NULL
+    const uint32_t *groups;
+    size_t ngroups;
 } roots_iter_t;
 
+/* compiled pattern sets store each group as its member count followed by
+   the members, root first, exactly as roots_next() would have found them */
+bool roots_next_group(roots_iter_t *it){
+    if(it->i >= it->ngroups) return false;
+    it->nmembers = it->groups[it->i];
+    for(size_t j = 0; j < it->nmembers; j++){
+        it->members[j] = it->groups[it->i + 1 + j];
+    }
+    it->i += 1 + it->nmembers;
+    return true;
+}
+
 // returns false when it finishes
 bool roots_next(roots_iter_t *it){
+    if(it->groups) return roots_next_group(it);
     for(size_t i = it->i; i < it->npatterns; i++){
         // antipatterns are never roots
         if(it->patterns[i].anti) continue;
@@ -1328,9 +2355,12 @@ bool roots_next(roots_iter_t *it){
             // skip self-comparisons
             if(i == j) continue;
             const string_t b = it->patterns[j].start;
-            // all antipatterns are always included in each search
+            // antipatterns are included in searches they might affect: those
+            // which start inside them (like !**/.git) or which contain them
             if(it->patterns[j].anti){
-                it->members[it->nmembers++] = j;
+                if(path_startswith(a, b) || path_startswith(b, a)){
+                    it->members[it->nmembers++] = j;
+                }
                 continue;
             }
             /* first check if a is still possibly a root.
@@ -1368,24 +2398,226 @@ bool roots_iter(
     return roots_next(it);
 }
 
+// like roots_iter, but use precomputed groups if there are any
+bool roots_iter_groups(
+    roots_iter_t *it,
+    const pattern_t *patterns,
+    size_t npatterns,
+    const uint32_t *groups,
+    size_t ngroups
+){
+    *it = (roots_iter_t){
+        .patterns = patterns,
+        .npatterns = npatterns,
+        .i = 0,
+        .groups = groups,
+        .ngroups = ngroups,
+    };
+
+    return roots_next(it);
+}
+
+// command-line options which alter how we search
+typedef struct {
+    bool inode_order;
+    bool sorted;
+    bool front_coded;
+    // --dirs: where to record each directory we read, or NULL
+    FILE *dirs;
+} opts_t;
+
+#ifndef _WIN32 // UNIX
+// how many upcoming sibling directories --inode-order reads ahead
+#define PREFETCH_WINDOW 8
+// how many directories may wait for the read-ahead thread at once
+#define PREFETCH_QUEUE 64
+
+/* --inode-order reads upcoming directories on a helper thread, so the kernel
+   fetches them from disk while the walk is busy with the current one.  The
+   walk still opens and reads every directory itself, from a warm cache. */
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool stop;
+    // a ring of paths waiting to be read
+    char *queue[PREFETCH_QUEUE];
+    size_t head;
+    size_t len;
+} prefetcher_t;
+#endif
+
 // shared memory across findglob recursion
 typedef struct {
     const pattern_t *patterns;
     const size_t npatterns;
+    opts_t opts;
     pool_t *p;
     file_array_t *fa;
     match_array_t *ma;
+    event_array_t *ea;
     char *path;
     size_t len;
     size_t cap;
+    // when buffered, emit() collects paths here rather than printing them
+    bool buffered;
+    string_t *out;
+    size_t nout;
+    size_t outcap;
+    // --sorted: an empty start's "." is printed among its top-level entries
+    bool pending_dot;
+#ifndef _WIN32 // UNIX
+    // --inode-order: the read-ahead thread, or NULL
+    prefetcher_t *pf;
+#endif
+    // --front-coded: the last path printed
+    char *prev;
+    size_t prevlen;
+    size_t prevcap;
 } mem_t;
 
 void mem_free(mem_t *m){
     file_array_free(&m->fa);
     match_array_free(&m->ma);
+    event_array_free(&m->ea);
     pool_free(&m->p);
     free(m->path);
     m->path = NULL;
+    free(m->out);
+    m->out = NULL;
+    free(m->prev);
+    m->prev = NULL;
+}
+
+/* print a path, or with --front-coded, the number of leading bytes it shares
+   with the path printed before it, a space, and the rest of it */
+void print_path(mem_t *m, const string_t path){
+    if(!m->opts.front_coded){
+        fprintf(stdout, "%.*s\n", F(path));
+        return;
+    }
+    size_t shared = 0;
+    while(
+        shared < m->prevlen && shared < path.len
+        && m->prev[shared] == path.text[shared]
+    ){
+        shared++;
+    }
+    fprintf(
+        stdout, "%zu %.*s\n",
+        shared, (int)(path.len - shared), path.text + shared
+    );
+    if(path.len > m->prevcap){
+        m->prevcap = path.len * 2;
+        m->prev = realloc(m->prev, m->prevcap);
+        if(!m->prev){
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    memcpy(m->prev + shared, path.text + shared, path.len - shared);
+    m->prevlen = path.len;
+}
+
+// print a matching path, or save it for later if our output is buffered
+void emit(mem_t *m, const string_t path){
+    if(!m->buffered){
+        print_path(m, path);
+        return;
+    }
+    if(m->nout == m->outcap){
+        m->outcap = m->outcap ? m->outcap * 2 : 4096;
+        m->out = realloc(m->out, m->outcap * sizeof(*m->out));
+        if(!m->out){
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    string_t copy = { .text = xmalloc(&m->p, path.len), .len = path.len };
+    memcpy(copy.text, path.text, path.len);
+    m->out[m->nout++] = copy;
+}
+
+int _qsort_output_cmp(const void *aptr, const void *bptr){
+    return path_cmp(*(const string_t*)aptr, *(const string_t*)bptr);
+}
+
+int _qsort_output_bytes_cmp(const void *aptr, const void *bptr){
+    return string_cmp(*(const string_t*)aptr, *(const string_t*)bptr);
+}
+
+// sort the paths buffered since index start, in the order we print them
+void emit_sort(mem_t *m, size_t start){
+    qsort(
+        m->out + start,
+        m->nout - start,
+        sizeof(*m->out),
+        m->opts.sorted ? _qsort_output_bytes_cmp : _qsort_output_cmp
+    );
+}
+
+// print everything we buffered, in the same order an unbuffered walk would
+void emit_flush(mem_t *m){
+    emit_sort(m, 0);
+    for(size_t i = 0; i < m->nout; i++){
+        print_path(m, m->out[i]);
+    }
+    m->nout = 0;
+}
+
+/* --sorted with several roots: each root's output is a sorted run, and
+   bounds[i] is the end of run i.  Do a k-way merge of the runs with a
+   binary min-heap of run indices, keyed by each run's next path. */
+void emit_merge(mem_t *m, const size_t *bounds, size_t nruns){
+    size_t *next = malloc(nruns * sizeof(*next));
+    size_t *heap = malloc(nruns * sizeof(*heap));
+    if(!next || !heap){
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    #define HEAD(r) m->out[next[r]]
+    #define LESS(a, b) (string_cmp(HEAD(heap[a]), HEAD(heap[b])) < 0)
+    size_t nheap = 0;
+    for(size_t r = 0; r < nruns; r++){
+        next[r] = r ? bounds[r-1] : 0;
+        // skip empty runs
+        if(next[r] == bounds[r]) continue;
+        // sift up
+        size_t i = nheap++;
+        heap[i] = r;
+        while(i && LESS(i, (i-1)/2)){
+            size_t tmp = heap[i];
+            heap[i] = heap[(i-1)/2];
+            heap[(i-1)/2] = tmp;
+            i = (i-1)/2;
+        }
+    }
+    while(nheap){
+        size_t r = heap[0];
+        print_path(m, HEAD(r));
+        if(++next[r] == bounds[r]){
+            // this run is exhausted
+            heap[0] = heap[--nheap];
+        }
+        // sift down
+        size_t i = 0;
+        while(true){
+            size_t l = 2*i + 1;
+            size_t min = i;
+            if(l < nheap && LESS(l, min)) min = l;
+            if(l + 1 < nheap && LESS(l + 1, min)) min = l + 1;
+            if(min == i) break;
+            size_t tmp = heap[i];
+            heap[i] = heap[min];
+            heap[min] = tmp;
+            i = min;
+        }
+    }
+    #undef LESS
+    #undef HEAD
+    free(heap);
+    free(next);
+    m->nout = 0;
 }
 
 bool keep_dir(const match_array_t *matches, string_t name){
@@ -1454,7 +2686,6 @@ match_array_t *matches_init(
     const pattern_t *patterns,
     size_t npatterns,
     string_t start,
-    string_t printstart,
     bool *isterminal
 ){
     *isterminal = false;
@@ -1478,12 +2709,8 @@ match_array_t *matches_init(
         );
         // non-intermediate means we don't continue
         if(!isintermediate){
-            // if this was a perfect match, print before exiting
-            if(_isterminal && (path_next(&it), !it.ok)){
-                fprintf(
-                    stdout, "%.*s\n", (int)printstart.len, printstart.text
-                );
-            }
+            // if this was a perfect match, let the caller print it
+            *isterminal = _isterminal && (path_next(&it), !it.ok);
             match_array_put(mem, matches);
             match_array_put(mem, newmatches);
             return match_array_get(p, mem, 32);;
@@ -1547,6 +2774,161 @@ bool matches_initial_file(
     exit(1);
 }
 
+#ifndef _WIN32 // UNIX
+
+// resolve a DT_UNKNOWN entry (some filesystems, notably NFS, don't set d_type)
+bool unknown_isdir(DIR *d, const char *name){
+    struct stat st;
+    if(fstatat(dirfd(d), name, &st, AT_SYMLINK_NOFOLLOW)) return false;
+    return S_ISDIR(st.st_mode);
+}
+
+void *prefetch_thread(void *arg){
+    prefetcher_t *pf = arg;
+    pthread_mutex_lock(&pf->lock);
+    while(true){
+        while(!pf->len && !pf->stop) pthread_cond_wait(&pf->cond, &pf->lock);
+        if(pf->stop) break;
+        char *path = pf->queue[pf->head];
+        pf->head = (pf->head + 1) % PREFETCH_QUEUE;
+        pf->len--;
+        pthread_mutex_unlock(&pf->lock);
+        // errors are ignored; the walk reports them when it gets there
+        DIR *d = opendir(path);
+        if(d){
+            while(readdir(d)){}
+            closedir(d);
+        }
+        free(path);
+        pthread_mutex_lock(&pf->lock);
+    }
+    pthread_mutex_unlock(&pf->lock);
+    return NULL;
+}
+
+// returns false if there will be no read-ahead, which is harmless
+bool prefetch_start(prefetcher_t *pf){
+    *pf = (prefetcher_t){ .stop = false };
+    if(pthread_mutex_init(&pf->lock, NULL)) return false;
+    if(pthread_cond_init(&pf->cond, NULL)){
+        pthread_mutex_destroy(&pf->lock);
+        return false;
+    }
+    if(pthread_create(&pf->thread, NULL, prefetch_thread, pf)){
+        pthread_cond_destroy(&pf->cond);
+        pthread_mutex_destroy(&pf->lock);
+        return false;
+    }
+    return true;
+}
+
+void prefetch_stop(prefetcher_t *pf){
+    pthread_mutex_lock(&pf->lock);
+    pf->stop = true;
+    pthread_cond_signal(&pf->cond);
+    pthread_mutex_unlock(&pf->lock);
+    pthread_join(pf->thread, NULL);
+    for(; pf->len; pf->len--){
+        free(pf->queue[pf->head]);
+        pf->head = (pf->head + 1) % PREFETCH_QUEUE;
+    }
+    pthread_cond_destroy(&pf->cond);
+    pthread_mutex_destroy(&pf->lock);
+}
+
+void prefetch_push(prefetcher_t *pf, const char *path){
+    char *copy = strdup(path);
+    // no memory for read-ahead just means no read-ahead
+    if(!copy) return;
+    pthread_mutex_lock(&pf->lock);
+    if(pf->len == PREFETCH_QUEUE){
+        // the walk has most likely reached the oldest entry by now
+        free(pf->queue[pf->head]);
+        pf->head = (pf->head + 1) % PREFETCH_QUEUE;
+        pf->len--;
+    }
+    pf->queue[(pf->head + pf->len) % PREFETCH_QUEUE] = copy;
+    pf->len++;
+    pthread_cond_signal(&pf->cond);
+    pthread_mutex_unlock(&pf->lock);
+}
+
+/* queue the next few directories we will descend into for read-ahead.
+   Since files are in inode order, they are also read in inode order.  path
+   holds the parent directory and a joining separator, and has room for any
+   name in files. */
+void prefetch_dirs(
+    mem_t *m, char *path, size_t pathlen, file_array_t *files, size_t start
+){
+    size_t end = MIN(files->len, start + PREFETCH_WINDOW);
+    for(size_t i = start; i < end; i++){
+        file_t *file = &files->items[i];
+        if(!file->isdir || file->queued) continue;
+        memcpy(path + pathlen, file->name.text, file->name.len + 1);
+        prefetch_push(m->pf, path);
+        file->queued = true;
+    }
+}
+
+#endif
+
+int _findglob(
+    mem_t *m,
+    char **path,
+    size_t *pathcap,
+    size_t pathlen,
+    const match_array_t *parent_matches
+);
+
+typedef enum {
+    VISIT_PRINT = 1,
+    VISIT_DESCEND = 2,
+    VISIT_ALL = 3,
+} visit_e;
+
+/* print and/or descend into one kept entry of a directory.  path holds the
+   parent directory and a joining separator, and has room for the name. */
+int visit(
+    mem_t *m,
+    char **path,
+    size_t *pathcap,
+    size_t pathlen,
+    const match_array_t *parent_matches,
+    file_t *file,
+    visit_e what
+){
+    memcpy(*path + pathlen, file->name.text, file->name.len);
+    size_t sublen = pathlen + file->name.len;
+    (*path)[sublen] = '\0';
+    string_t subpath = { .text = *path, .len = sublen };
+    if(!file->isdir){
+        // regular files: already known to be TERMINAL, just print
+        if(what & VISIT_PRINT) emit(m, subpath);
+        return 0;
+    }
+    if(what & VISIT_PRINT){
+        // directories: print when terminal, recurse when intermediate
+        bool isintermediate, isterminal;
+        match_array_t *newmatches = match_array_get(&m->p, &m->ma, 32);
+        process_dir(
+            file->name, parent_matches, newmatches, &isintermediate, &isterminal
+        );
+        if(isterminal){
+            emit(m, subpath);
+        }
+        if(isintermediate){
+            file->matches = newmatches;
+        }else{
+            match_array_put(&m->ma, newmatches);
+        }
+    }
+    if(!(what & VISIT_DESCEND) || !file->matches) return 0;
+    int ret = _findglob(m, path, pathcap, sublen, file->matches);
+    match_array_put(&m->ma, file->matches);
+    file->matches = NULL;
+    return ret;
+}
+
 // recursive layer beneath findglob
 int _findglob(
     mem_t *m,
@@ -1573,11 +2955,27 @@ int _findglob(
         retval = 1;
         goto cleanup;
     }
+    if(m->opts.dirs) fprintf(m->opts.dirs, "%s\n", openpath);
+
+    // in --inode-order mode, DT_UNKNOWN entries are stat'ed after sorting
+    file_array_t *unknown = NULL;
+    if(m->opts.inode_order) unknown = file_array_get(&m->p, &m->fa, 32);
 
     struct dirent *entry;
     while((entry = readdir(d))){
         bool isdir = (entry->d_type == DT_DIR);
         string_t name = string_dup(&m->p, entry->d_name);
+        if(entry->d_type == DT_UNKNOWN){
+            if(unknown){
+                file_t file = {
+                    .name = name, .ino = (uint64_t)entry->d_ino,
+                };
+                file_array_add(unknown, file);
+                continue;
+            }
+            isdir = unknown_isdir(d, name.text);
+        }
+        uint64_t ino = (uint64_t)entry->d_ino;
 
 #else // WINDOWS
 
@@ -1618,10 +3016,19 @@ int _findglob(
         retval = 1;
         goto cleanup;
     }
+    if(m->opts.dirs){
+        // empty-start case: we searched '.'
+        if(old_pathlen){
+            fprintf(m->opts.dirs, "%.*s\n", (int)old_pathlen, *path);
+        }else{
+            fprintf(m->opts.dirs, ".\n");
+        }
+    }
 
     do{
         bool isdir = (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
         string_t name = string_dup(&m->p, ffd.cFileName);
+        uint64_t ino = 0;
 #endif
         if(isdir){
             if(!keep_dir(parent_matches, name)) continue;
@@ -1631,11 +3038,30 @@ int _findglob(
         file_t file = {
             .name = name,
             .isdir = isdir,
+            .ino = ino,
         };
         file_array_add(files, file);
         if(name.len > maxlen) maxlen = name.len;
 #ifndef _WIN32 // UNIX
     }
+
+    if(unknown){
+        // stat the DT_UNKNOWN entries in inode order too
+        qsort_files_ino(unknown);
+        for(size_t i = 0; i < unknown->len; i++){
+            file_t file = unknown->items[i];
+            file.isdir = unknown_isdir(d, file.name.text);
+            if(file.isdir){
+                if(!keep_dir(parent_matches, file.name)) continue;
+            }else{
+                if(!keep_file(parent_matches, file.name)) continue;
+            }
+            file_array_add(files, file);
+            if(file.name.len > maxlen) maxlen = file.name.len;
+        }
+        file_array_put(&m->fa, unknown);
+    }
+
     closedir(d);
 #else // WINDOWS
     } while(FindNextFile(h, &ffd) != 0);
@@ -1643,8 +3069,20 @@ int _findglob(
     pathlen = old_pathlen;
 #endif
 
-    // sort for deterministic output
-    qsort_files(files);
+    if(m->pending_dot){
+        // --sorted: the empty start's "." sorts among its own entries
+        file_array_add(files, (file_t){ .name = DOT });
+        maxlen = MAX(maxlen, DOT.len);
+        m->pending_dot = false;
+    }
+
+    if(m->opts.inode_order){
+        // descend in inode order; emit_flush() restores deterministic output
+        qsort_files_ino(files);
+    }else{
+        // sort for deterministic output
+        qsort_files(files);
+    }
 
     // ensure that our path buffer is long enough for all files we kept
     // (existing len) + (max name len) + (1 for /) + (1 for \0)
@@ -1663,31 +3101,45 @@ int _findglob(
         (*path)[pathlen++] = '/';
     }
 
-    for(size_t i = 0; i < files->len; i++){
-        file_t file = files->items[i];
-        memcpy(*path + pathlen, file.name.text, file.name.len);
-        size_t sublen = pathlen + file.name.len;
-        (*path)[sublen] = '\0';
-        if(!file.isdir){
-            // regular files: already known to be TERMINAL, just print
-            fprintf(stdout, "%s\n", *path);
-            continue;
-        }
-        // directories: print when terminal, recurse when intermediate
-        bool isintermediate, isterminal;
-        match_array_t *newmatches = match_array_get(&m->p, &m->ma, 32);
-        process_dir(
-            file.name, parent_matches, newmatches, &isintermediate, &isterminal
-        );
-        if(isterminal){
-            fprintf(stdout, "%s\n", *path);
+    if(m->opts.sorted && !m->opts.inode_order){
+        // visit print and descend events in bytewise order
+        event_array_t *events = event_array_get(&m->p, &m->ea, 1024);
+        for(size_t i = 0; i < files->len; i++){
+            string_t name = files->items[i].name;
+            event_array_add(events, (event_t){ .name = name, .idx = i });
+            if(!files->items[i].isdir) continue;
+            event_t e = { .name = name, .descend = true, .idx = i };
+            event_array_add(events, e);
         }
-        if(isintermediate){
-            int ret = _findglob(m, path, pathcap, sublen, newmatches);
+        qsort_events(events);
+        for(size_t i = 0; i < events->len; i++){
+            event_t e = events->items[i];
+            int ret = visit(
+                m,
+                path,
+                pathcap,
+                pathlen,
+                parent_matches,
+                &files->items[e.idx],
+                e.descend ? VISIT_DESCEND : VISIT_PRINT
+            );
             // finish the loop but remember the error
             if(ret) retval = ret;
         }
-        match_array_put(&m->ma, newmatches);
+        event_array_put(&m->ea, events);
+        goto cleanup;
+    }
+
+    for(size_t i = 0; i < files->len; i++){
+#ifndef _WIN32 // UNIX
+        if(m->pf) prefetch_dirs(m, *path, pathlen, files, i);
+#endif
+        int ret = visit(
+            m, path, pathcap, pathlen, parent_matches, &files->items[i],
+            VISIT_ALL
+        );
+        // finish the loop but remember the error
+        if(ret) retval = ret;
     }
 
 cleanup:
@@ -1717,15 +3169,54 @@ void qsort_patterns(pattern_t *patterns, size_t npatterns){
 
 int findglob(
     pattern_t *patterns,
-    size_t npatterns
+    size_t npatterns,
+    const uint32_t *groups,
+    size_t ngroups,
+    opts_t opts
 ){
     mem_t m = {
         .patterns = patterns,
         .npatterns = npatterns,
+        .opts = opts,
         .p = NULL,
         .fa = NULL,
         .ma = NULL,
+        .ea = NULL,
+        // inode-ordered walks must be re-sorted before printing
+        .buffered = opts.inode_order,
     };
+#ifdef FINDGLOB_SPECIALIZED
+    spec_bind(patterns, npatterns);
+#endif
+
+    // --sorted: every root is a sorted run, and several runs need a merge
+    size_t nroots = 0;
+    size_t *bounds = NULL;
+    roots_iter_t it;
+    if(opts.sorted){
+        for(
+            bool ok = roots_iter_groups(
+                &it, patterns, npatterns, groups, ngroups
+            );
+            ok;
+            ok = roots_next(&it)
+        ){
+            nroots++;
+        }
+        if(nroots > 1){
+            m.buffered = true;
+            bounds = malloc(nroots * sizeof(*bounds));
+            if(!bounds){
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+        }
+    }
+    size_t nruns = 0;
+#ifndef _WIN32 // UNIX
+    prefetcher_t pf;
+    if(opts.inode_order && prefetch_start(&pf)) m.pf = &pf;
+#endif
     // we reuse one path buffer for the entire recursion
     size_t pathcap = PATH_MAX;
     char *path = malloc(pathcap);
@@ -1743,9 +3234,8 @@ int findglob(
 
     // do a separate search for every root path we see
     int retval = 0;
-    roots_iter_t it;
     for(
-        bool ok = roots_iter(&it, patterns, npatterns);
+        bool ok = roots_iter_groups(&it, patterns, npatterns, groups, ngroups);
         ok;
         ok = roots_next(&it)
     ){
@@ -1788,10 +3278,11 @@ int findglob(
                     &m.p, &m.ma, temp_patterns, it.nmembers, start
                 )
             ){
-                fprintf(
-                    stdout, "%.*s\n", (int)printstart.len, printstart.text
-                );
+                emit(&m, printstart);
             }
+            // one match is already a sorted run
+            if(bounds) bounds[nruns++] = m.nout;
+            else if(m.buffered) emit_flush(&m);
             continue;
         }
 
@@ -1804,47 +3295,271 @@ int findglob(
             temp_patterns,
             it.nmembers,
             start,
-            printstart,
             &isterminal
         );
-        if(isterminal){
+        size_t runstart = m.nout;
+        if(isterminal && !printstart.len && opts.sorted && matches->len){
+            // empty-start case, sorted: print '.' wherever it sorts
+            m.pending_dot = true;
+        }else if(isterminal){
             // empty-start case: print '.' instead
-            fprintf(stdout, "%s\n", printstart.len ? path : ".");
+            emit(&m, printstart.len ? printstart : DOT);
         }
         if(matches->len){
             ret = _findglob(&m, &path, &pathcap, printstart.len, matches);
             // finish the loop but remember the error
             if(ret) retval = ret;
         }
+        if(m.pending_dot){
+            // we failed to read '.'
+            emit(&m, DOT);
+            m.pending_dot = false;
+        }
         match_array_put(&m.ma, matches);
+        if(!bounds){
+            if(m.buffered) emit_flush(&m);
+            continue;
+        }
+        // inode-ordered runs need sorting, other sorted walks are in order
+        if(opts.inode_order) emit_sort(&m, runstart);
+        bounds[nruns++] = m.nout;
     }
 
+    if(bounds){
+        emit_merge(&m, bounds, nruns);
+        free(bounds);
+    }
+
+#ifndef _WIN32 // UNIX
+    if(m.pf) prefetch_stop(m.pf);
+#endif
     free(temp_patterns);
     free(path);
     mem_free(&m);
     return retval;
 }
 
-int findglob_main(int argc, char **argv){
-    if(argc < 2){
-        fprintf(stderr, "usage:   findglob PATTERN... [ANTIPATERN...]\n");
-        fprintf(
-            stderr, "example: findglob '**/*.c' '**/*.h' '!.git' '!tests'\n"
-        );
-        fprintf(stderr, "also try findglob --help\n");
+// compiled pattern sets (--compile and --set)
+
+/* A compiled pattern set holds everything we derive from PATTERN arguments
+   before walking: parsed sections (including regex DFAs), realpath'd starts,
+   and root groups.  It is one file of host-endian structs and nul-terminated
+   strings, which --set maps into memory and uses in place.
+
+   Realpath results depend on the working directory and on the filesystem,
+   so for every distinct start we also store the (dev, ino) it resolved to.
+   Loading a set re-stats each original start and each realpath, which is
+   far cheaper than realpath(); if anything moved, we fall back to parsing
+   the original pattern texts, which are stored as well.  Windows has no
+   inode numbers to check, so there we always take the fallback. */
+
+#define FGC_MAGIC "findglob-set"
+#define FGC_VERSION 1
+
+typedef struct {
+    uint64_t off;
+    uint64_t len;
+} fgc_str_t;
+
+typedef struct {
+    char magic[16];
+    uint32_t version;
+    uint32_t nsources;
+    uint32_t nchecks;
+    uint32_t npatterns;
+    uint64_t ngroups;
+    // offsets of the source, check, pattern, and group arrays
+    uint64_t sources;
+    uint64_t checks;
+    uint64_t patterns;
+    uint64_t groups;
+    // total file size
+    uint64_t size;
+} fgc_header_t;
+
+typedef struct {
+    // a start as written and what it resolved to; real is empty if missing
+    fgc_str_t path;
+    fgc_str_t real;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t exists;
+} fgc_check_t;
+
+typedef struct {
+    uint32_t anti;
+    uint32_t class;
+    uint64_t nsects;
+    uint64_t sects;
+    fgc_str_t start;
+    fgc_str_t printstart;
+} fgc_pattern_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t opt;
+    fgc_str_t text;
+    fgc_str_t text2;
+    // offsets of the OPT_NONE lit array or the OPT_REGEX fgc_dfa_t
+    uint64_t lit;
+    uint64_t dfa;
+} fgc_section_t;
+
+typedef struct {
+    uint64_t nclasses;
+    uint64_t nstates;
+    uint64_t start;
+    // offsets of the trans and accept tables
+    uint64_t trans;
+    uint64_t accept;
+    uint8_t classmap[256];
+} fgc_dfa_t;
+
+typedef struct {
+    char *data;
+    size_t len;
+} mapping_t;
+
+int map_file(const char *path, mapping_t *m){
+    *m = (mapping_t){0};
+#ifndef _WIN32 // UNIX
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        perror(path);
         return 1;
     }
-    if(strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0){
-        print_help(stdout);
-        return 0;
+    struct stat st;
+    if(fstat(fd, &st)){
+        perror(path);
+        close(fd);
+        return 1;
     }
-    if(strcmp(argv[1], "--version") == 0){
-        fprintf(stdout, "%s\n", VERSION);
-        return 0;
+    m->len = (size_t)st.st_size;
+    if(m->len){
+        void *data = mmap(NULL, m->len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED){
+            perror(path);
+            close(fd);
+            return 1;
+        }
+        m->data = data;
     }
-    int retval = 0;
-
-    pattern_t *patterns = malloc((argc-1)*sizeof(*patterns));
+    close(fd);
+#else // WINDOWS
+    // just read the whole file
+    FILE *f = fopen(path, "rb");
+    if(!f){
+        perror(path);
+        return 1;
+    }
+    size_t cap = 4096;
+    m->data = malloc(cap);
+    if(!m->data){
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    size_t n;
+    while((n = fread(m->data + m->len, 1, cap - m->len, f)) > 0){
+        m->len += n;
+        if(m->len < cap) continue;
+        cap *= 2;
+        m->data = realloc(m->data, cap);
+        if(!m->data){
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    if(ferror(f)){
+        perror(path);
+        fclose(f);
+        free(m->data);
+        *m = (mapping_t){0};
+        return 1;
+    }
+    fclose(f);
+#endif
+    return 0;
+}
+
+void unmap_file(mapping_t *m){
+#ifndef _WIN32 // UNIX
+    if(m->len) munmap(m->data, m->len);
+#else // WINDOWS
+    free(m->data);
+#endif
+    *m = (mapping_t){0};
+}
+
+// a distinct pattern start, recorded while compiling
+typedef struct {
+    char *path;
+    // NULL if the start did not exist
+    char *real;
+    uint64_t dev;
+    uint64_t ino;
+} start_check_t;
+
+typedef struct {
+    start_check_t *items;
+    size_t len;
+    size_t cap;
+} start_checks_t;
+
+void start_checks_add(start_checks_t *checks, const char *path, char *real){
+    for(size_t i = 0; i < checks->len; i++){
+        if(strcmp(checks->items[i].path, path) == 0) return;
+    }
+    if(checks->len == checks->cap){
+        checks->cap = checks->cap ? checks->cap * 2 : 16;
+        checks->items = realloc(
+            checks->items, checks->cap * sizeof(*checks->items)
+        );
+        if(!checks->items){
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    start_check_t check = { .path = strdup(path) };
+    if(!check.path){
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    struct stat st;
+    if(real && stat(real, &st) == 0){
+        check.real = strdup(real);
+        if(!check.real){
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        check.dev = (uint64_t)st.st_dev;
+        check.ino = (uint64_t)st.st_ino;
+    }
+    checks->items[checks->len++] = check;
+}
+
+void start_checks_free(start_checks_t *checks){
+    for(size_t i = 0; i < checks->len; i++){
+        free(checks->items[i].path);
+        free(checks->items[i].real);
+    }
+    free(checks->items);
+    *checks = (start_checks_t){0};
+}
+
+// parse patterns and rewrite their starts as absolute paths
+int patterns_prepare(
+    char **texts,
+    size_t ntexts,
+    pattern_t **out,
+    size_t *nout,
+    // when compiling, collect what each start resolved to
+    start_checks_t *checks
+){
+    int retval = 0;
+    *out = NULL;
+    *nout = 0;
+
+    pattern_t *patterns = malloc(MAX(ntexts, 1) * sizeof(*patterns));
     if(!patterns){
         fprintf(stderr, "out of memory\n");
         exit(1);
@@ -1852,9 +3567,9 @@ int findglob_main(int argc, char **argv){
     size_t npatterns = 0;
     size_t nantipatterns = 0;
 
-    for(int i = 1; i < argc; i++){
-        retval = pattern_parse(&patterns[npatterns++], argv[i]);
-        if(retval) goto cleanup;
+    for(size_t i = 0; i < ntexts; i++){
+        retval = pattern_parse(&patterns[npatterns++], texts[i]);
+        if(retval) goto fail;
         if(patterns[npatterns-1].anti) nantipatterns++;
     }
     if(npatterns == nantipatterns){
@@ -1864,7 +3579,7 @@ int findglob_main(int argc, char **argv){
             nantipatterns
         );
         retval = 1;
-        goto cleanup;
+        goto fail;
     }
 
     // rewrite all startpoints as absolute paths
@@ -1877,6 +3592,7 @@ int findglob_main(int argc, char **argv){
         if(!cret){
             // a negative pattern that doesn't exist is ok, but pointless
             if(patterns[i].anti && (errno == ENOENT || errno == ENOTDIR)){
+                if(checks) start_checks_add(checks, oldname, NULL);
                 // free the pointless negative pattern
                 pattern_free(&patterns[i]);
                 // replace the hole, decrementing both i and npatterns
@@ -1885,7 +3601,7 @@ int findglob_main(int argc, char **argv){
             }
             perror(oldname);
             retval = 1;
-            goto cleanup;
+            goto fail;
         }
         // it's not 100% clear to me that realpath() guarnatees nul-termination
         string_t real = { .text = buf, .len = strnlen(buf, sizeof(buf)) };
@@ -1894,13 +3610,13 @@ int findglob_main(int argc, char **argv){
         if(dret > sizeof(buf)){
             fprintf(stderr, "full path name is too long: %s\n", oldname);
             retval = 1;
-            goto cleanup;
+            goto fail;
         }else if(dret == 0){
             /* note: GetFullPathNameA() doesn't check for file existence, so
                there's no need to handle the ENOENT equivalent */
             win_perror(oldname);
             retval = 1;
-            goto cleanup;
+            goto fail;
         }
         // use forwardslashes in path
         for(DWORD j = 0; j < dret; j++){
@@ -1908,17 +3624,1000 @@ int findglob_main(int argc, char **argv){
         }
         string_t real = { .text = buf, .len = dret };
 #endif
+        if(checks) start_checks_add(checks, oldname, buf);
         retval = pattern_rewrite_start(&patterns[i], real);
-        if(retval) goto cleanup;
+        if(retval) goto fail;
     }
 
-    retval = findglob(patterns, npatterns);
+    patterns_simplify(patterns, &npatterns);
 
-cleanup:
+    *out = patterns;
+    *nout = npatterns;
+    return 0;
+
+fail:
     for(size_t i = 0; i < npatterns; i++){
         pattern_free(&patterns[i]);
     }
     free(patterns);
+    return retval;
+}
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} buf_t;
+
+// append n bytes at the next 8-byte aligned offset, and return that offset
+uint64_t buf_put(buf_t *b, const void *data, size_t n){
+    size_t off = (b->len + 7) & ~(size_t)7;
+    // always leave room for a nul terminator
+    while(off + n + 1 > b->cap){
+        b->cap = b->cap ? b->cap * 2 : 4096;
+        b->data = realloc(b->data, b->cap);
+        if(!b->data){
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    memset(b->data + b->len, 0, off - b->len);
+    if(n) memcpy(b->data + off, data, n);
+    b->len = off + n;
+    return off;
+}
+
+// strings are nul-terminated, so mapped starts can go straight to stat()
+fgc_str_t buf_put_str(buf_t *b, const string_t s){
+    uint64_t off = buf_put(b, s.text, s.len);
+    b->data[b->len++] = '\0';
+    return (fgc_str_t){ .off = off, .len = s.len };
+}
+
+fgc_str_t buf_put_cstr(buf_t *b, const char *s){
+    string_t str = { .text = (char*)s, .len = s ? strlen(s) : 0 };
+    return buf_put_str(b, str);
+}
+
+uint64_t fgc_put_section(buf_t *b, const section_t *sect){
+    fgc_section_t fs = { .type = sect->type };
+    if(sect->type == SECTION_CONSTANT){
+        fs.text = buf_put_str(b, sect->val.constant);
+    }else if(sect->type == SECTION_GLOB){
+        const glob_t *glob = &sect->val.glob;
+        fs.opt = glob->opt;
+        fs.text = buf_put_str(b, glob->text);
+        fs.text2 = buf_put_str(b, glob->text2);
+        if(glob->opt == OPT_NONE){
+            fs.lit = buf_put(b, glob->lit, glob->text.len * sizeof(bool));
+        }
+        if(glob->opt == OPT_REGEX){
+            const dfa_t *dfa = glob->dfa;
+            fgc_dfa_t fd = {
+                .nclasses = dfa->nclasses,
+                .nstates = dfa->nstates,
+                .start = dfa->start,
+            };
+            memcpy(fd.classmap, dfa->classmap, sizeof(fd.classmap));
+            size_t ntrans = dfa->nstates * dfa->nclasses;
+            fd.trans = buf_put(b, dfa->trans, ntrans * sizeof(*dfa->trans));
+            fd.accept = buf_put(b, dfa->accept, dfa->nstates * sizeof(bool));
+            fs.dfa = buf_put(b, &fd, sizeof(fd));
+        }
+    }
+    return buf_put(b, &fs, sizeof(fs));
+}
+
+// atomically replace dst with src
+int compat_rename(const char *src, const char *dst){
+#ifndef _WIN32 // UNIX
+    if(rename(src, dst)){
+        perror(dst);
+        return 1;
+    }
+#else // WINDOWS
+    if(!MoveFileExA(src, dst, MOVEFILE_REPLACE_EXISTING)){
+        win_perror(dst);
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+int compat_getpid(void){
+#ifndef _WIN32 // UNIX
+    return (int)getpid();
+#else // WINDOWS
+    return (int)GetCurrentProcessId();
+#endif
+}
+
+int fgc_write(
+    const char *output,
+    char **sources,
+    size_t nsources,
+    const start_checks_t *checks,
+    const pattern_t *patterns,
+    size_t npatterns
+){
+    buf_t b = {0};
+    fgc_header_t h = {
+        .version = FGC_VERSION,
+        .nsources = (uint32_t)nsources,
+        .nchecks = (uint32_t)checks->len,
+        .npatterns = (uint32_t)npatterns,
+    };
+    memcpy(h.magic, FGC_MAGIC, sizeof(FGC_MAGIC));
+    // reserve space for the header, we'll fill it in at the end
+    buf_put(&b, &h, sizeof(h));
+
+    fgc_str_t *strs = malloc(MAX(nsources, 1) * sizeof(*strs));
+    fgc_check_t *fcs = malloc(MAX(checks->len, 1) * sizeof(*fcs));
+    fgc_pattern_t *fps = malloc(MAX(npatterns, 1) * sizeof(*fps));
+    if(!strs || !fcs || !fps){
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
 
+    for(size_t i = 0; i < nsources; i++){
+        strs[i] = buf_put_cstr(&b, sources[i]);
+    }
+    h.sources = buf_put(&b, strs, nsources * sizeof(*strs));
+
+    for(size_t i = 0; i < checks->len; i++){
+        const start_check_t *c = &checks->items[i];
+        fcs[i] = (fgc_check_t){
+            .path = buf_put_cstr(&b, c->path),
+            .real = buf_put_cstr(&b, c->real),
+            .dev = c->dev,
+            .ino = c->ino,
+            .exists = c->real != NULL,
+        };
+    }
+    h.checks = buf_put(&b, fcs, checks->len * sizeof(*fcs));
+
+    for(size_t i = 0; i < npatterns; i++){
+        const pattern_t *p = &patterns[i];
+        uint64_t *offs = malloc(MAX(p->len, 1) * sizeof(*offs));
+        if(!offs){
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        for(size_t j = 0; j < p->len; j++){
+            offs[j] = fgc_put_section(&b, &p->sects[j]);
+        }
+        fps[i] = (fgc_pattern_t){
+            .anti = p->anti,
+            .class = p->class,
+            .nsects = p->len,
+            .sects = buf_put(&b, offs, p->len * sizeof(*offs)),
+            .start = buf_put_str(&b, p->start),
+            .printstart = buf_put_str(&b, p->printstart),
+        };
+        free(offs);
+    }
+    h.patterns = buf_put(&b, fps, npatterns * sizeof(*fps));
+
+    // store root groups exactly as roots_next() finds them
+    uint32_t *groups = NULL;
+    size_t ngroups = 0;
+    size_t gcap = 0;
+    roots_iter_t it;
+    for(
+        bool ok = roots_iter(&it, patterns, npatterns);
+        ok;
+        ok = roots_next(&it)
+    ){
+        while(ngroups + 1 + it.nmembers > gcap){
+            gcap = gcap ? gcap * 2 : 64;
+            groups = realloc(groups, gcap * sizeof(*groups));
+            if(!groups){
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+        }
+        groups[ngroups++] = (uint32_t)it.nmembers;
+        for(size_t j = 0; j < it.nmembers; j++){
+            groups[ngroups++] = (uint32_t)it.members[j];
+        }
+    }
+    h.groups = buf_put(&b, groups, ngroups * sizeof(*groups));
+    h.ngroups = ngroups;
+    free(groups);
+
+    h.size = b.len;
+    memcpy(b.data, &h, sizeof(h));
+
+    /* write beside output and rename it into place, so a --set running
+       concurrently (say, from another ninja edge) never maps a partial set */
+    int retval = 0;
+    size_t tmpcap = strlen(output) + 32;
+    char *tmp = malloc(tmpcap);
+    if(!tmp){
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    snprintf(tmp, tmpcap, "%s.tmp%d", output, compat_getpid());
+    FILE *f = fopen(tmp, "wb");
+    if(!f){
+        perror(tmp);
+        retval = 1;
+        goto cu;
+    }
+    if(fwrite(b.data, 1, b.len, f) != b.len){
+        perror(tmp);
+        retval = 1;
+    }
+    if(fclose(f)){
+        perror(tmp);
+        retval = 1;
+    }
+    if(!retval) retval = compat_rename(tmp, output);
+    if(retval) remove(tmp);
+
+cu:
+    free(tmp);
+    free(fps);
+    free(fcs);
+    free(strs);
+    free(b.data);
     return retval;
 }
+
+// get n items of a given size at off in a mapping, or NULL if out of bounds
+const char *fgc_at(const mapping_t *m, uint64_t off, uint64_t n, size_t size){
+    if(off % 8 || off > m->len) return NULL;
+    if(n > (m->len - off) / (size ? size : 1)) return NULL;
+    return m->data + off;
+}
+
+bool fgc_str(const mapping_t *m, fgc_str_t s, string_t *out){
+    if(s.len >= m->len) return false;
+    const char *text = fgc_at(m, s.off, s.len + 1, 1);
+    if(!text || text[s.len] != '\0') return false;
+    *out = (string_t){ .text = (char*)text, .len = s.len };
+    return true;
+}
+
+// is a start still where it was when we compiled?
+bool fgc_check_ok(const mapping_t *m, const fgc_check_t *c){
+#ifndef _WIN32 // UNIX
+    string_t path, real;
+    if(!fgc_str(m, c->path, &path) || !fgc_str(m, c->real, &real)){
+        return false;
+    }
+    struct stat st;
+    if(!c->exists){
+        // antipatterns with missing starts must still be missing
+        return stat(path.text, &st) && (errno == ENOENT || errno == ENOTDIR);
+    }
+    if(stat(path.text, &st)) return false;
+    if((uint64_t)st.st_dev != c->dev || (uint64_t)st.st_ino != c->ino){
+        return false;
+    }
+    // the realpath must still name the same thing, too
+    if(stat(real.text, &st)) return false;
+    return (uint64_t)st.st_dev == c->dev && (uint64_t)st.st_ino == c->ino;
+#else // WINDOWS
+    (void)m;
+    (void)c;
+    return false;
+#endif
+}
+
+bool fgc_load_section(const mapping_t *m, uint64_t off, section_t *sect){
+    const fgc_section_t *fs = (const void*)fgc_at(m, off, 1, sizeof(*fs));
+    if(!fs) return false;
+    *sect = (section_t){ .type = fs->type };
+    switch(fs->type){
+        case SECTION_ANY:
+            return true;
+        case SECTION_CONSTANT:
+            return fgc_str(m, fs->text, &sect->val.constant);
+        case SECTION_GLOB:
+            break;
+        default:
+            return false;
+    }
+    glob_t *glob = &sect->val.glob;
+    if(fs->opt > OPT_REGEX) return false;
+    glob->opt = fs->opt;
+    if(!fgc_str(m, fs->text, &glob->text)) return false;
+    if(!fgc_str(m, fs->text2, &glob->text2)) return false;
+    if(glob->opt == OPT_NONE){
+        glob->lit = (bool*)fgc_at(m, fs->lit, glob->text.len, sizeof(bool));
+        if(!glob->lit) return false;
+    }
+    if(glob->opt != OPT_REGEX) return true;
+    const fgc_dfa_t *fd = (const void*)fgc_at(m, fs->dfa, 1, sizeof(*fd));
+    if(!fd || !fd->nclasses || fd->nclasses > 256) return false;
+    if(fd->start >= fd->nstates || fd->nstates > DFA_MAX_STATES) return false;
+    dfa_t *dfa = malloc(sizeof(*dfa));
+    if(!dfa){
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    *dfa = (dfa_t){
+        .nclasses = fd->nclasses,
+        .nstates = fd->nstates,
+        .start = (uint16_t)fd->start,
+        .trans = (uint16_t*)fgc_at(
+            m, fd->trans, fd->nstates * fd->nclasses, sizeof(uint16_t)
+        ),
+        .accept = (bool*)fgc_at(m, fd->accept, fd->nstates, sizeof(bool)),
+    };
+    memcpy(dfa->classmap, fd->classmap, sizeof(dfa->classmap));
+    glob->dfa = dfa;
+    if(!dfa->trans || !dfa->accept) return false;
+    // a corrupt table must not send us out of bounds
+    for(size_t i = 0; i < 256; i++){
+        if(dfa->classmap[i] >= dfa->nclasses) return false;
+    }
+    for(size_t i = 0; i < dfa->nstates * dfa->nclasses; i++){
+        if(dfa->trans[i] >= dfa->nstates) return false;
+    }
+    return true;
+}
+
+/* load a compiled pattern set.  The returned patterns may point into m,
+   which must stay mapped until they are freed.  groups is NULL if we had to
+   fall back to parsing the original patterns. */
+int fgc_load(
+    const char *path,
+    mapping_t *m,
+    pattern_t **out,
+    size_t *nout,
+    const uint32_t **groups,
+    size_t *ngroups
+){
+    *out = NULL;
+    *nout = 0;
+    *groups = NULL;
+    *ngroups = 0;
+
+    int retval = map_file(path, m);
+    if(retval) return retval;
+
+    pattern_t *patterns = NULL;
+    size_t npatterns = 0;
+
+    const fgc_header_t *h = (const void*)fgc_at(m, 0, 1, sizeof(*h));
+    if(!h || memcmp(h->magic, FGC_MAGIC, sizeof(FGC_MAGIC))){
+        fprintf(stderr, "%s: not a compiled pattern set\n", path);
+        return 1;
+    }
+    if(h->version != FGC_VERSION){
+        fprintf(
+            stderr,
+            "%s: compiled pattern set version %u is not supported, "
+            "please recompile it\n",
+            path,
+            (unsigned)h->version
+        );
+        return 1;
+    }
+    if(h->size != m->len) goto corrupt;
+
+    const fgc_check_t *checks = (const void*)fgc_at(
+        m, h->checks, h->nchecks, sizeof(*checks)
+    );
+    if(!checks) goto corrupt;
+    bool valid = true;
+    for(size_t i = 0; valid && i < h->nchecks; i++){
+        valid = fgc_check_ok(m, &checks[i]);
+    }
+
+    if(!valid){
+        // something moved; start over from the original patterns
+        const fgc_str_t *sources = (const void*)fgc_at(
+            m, h->sources, h->nsources, sizeof(*sources)
+        );
+        if(!sources) goto corrupt;
+        char **texts = malloc(MAX(h->nsources, 1) * sizeof(*texts));
+        if(!texts){
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        for(size_t i = 0; i < h->nsources; i++){
+            string_t text;
+            if(!fgc_str(m, sources[i], &text)){
+                free(texts);
+                goto corrupt;
+            }
+            texts[i] = text.text;
+        }
+        retval = patterns_prepare(texts, h->nsources, out, nout, NULL);
+        free(texts);
+        return retval;
+    }
+
+    const fgc_pattern_t *fps = (const void*)fgc_at(
+        m, h->patterns, h->npatterns, sizeof(*fps)
+    );
+    if(!fps || !h->npatterns) goto corrupt;
+    patterns = calloc(h->npatterns, sizeof(*patterns));
+    if(!patterns){
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for(; npatterns < h->npatterns; npatterns++){
+        const fgc_pattern_t *fp = &fps[npatterns];
+        pattern_t *p = &patterns[npatterns];
+        p->mapped = true;
+        const uint64_t *offs = (const void*)fgc_at(
+            m, fp->sects, fp->nsects, sizeof(*offs)
+        );
+        if(!offs) goto corrupt;
+        p->sects = calloc(MAX(fp->nsects, 1), sizeof(*p->sects));
+        if(!p->sects){
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        for(; p->len < fp->nsects; p->len++){
+            // count the section first, so pattern_free() sees any dfa_t
+            if(!fgc_load_section(m, offs[p->len], &p->sects[p->len])){
+                p->len++;
+                goto corrupt;
+            }
+        }
+        p->cap = p->len;
+        p->anti = fp->anti;
+        p->class = fp->class;
+        if(p->class < CLASS_FILE || p->class > CLASS_ANY) goto corrupt;
+        if(!fgc_str(m, fp->start, &p->start)) goto corrupt;
+        if(!fgc_str(m, fp->printstart, &p->printstart)) goto corrupt;
+    }
+
+    const uint32_t *g = (const void*)fgc_at(
+        m, h->groups, h->ngroups, sizeof(*g)
+    );
+    if(!g) goto corrupt;
+    for(size_t i = 0; i < h->ngroups; i += 1 + g[i]){
+        if(!g[i] || g[i] > MAX_PATTERNS || g[i] >= h->ngroups - i){
+            goto corrupt;
+        }
+        for(size_t j = 0; j < g[i]; j++){
+            if(g[i + 1 + j] >= npatterns) goto corrupt;
+        }
+    }
+
+    *out = patterns;
+    *nout = npatterns;
+    *groups = g;
+    *ngroups = h->ngroups;
+    return 0;
+
+corrupt:
+    fprintf(stderr, "%s: corrupt compiled pattern set\n", path);
+    for(size_t i = 0; patterns && i <= npatterns && i < h->npatterns; i++){
+        pattern_free(&patterns[i]);
+    }
+    free(patterns);
+    return 1;
+}
+
+// read PATTERNs from a file, one per line, and write a compiled set
+int fgc_compile(const char *path, const char *output){
+    mapping_t m;
+    int retval = map_file(path, &m);
+    if(retval) return retval;
+
+    // copy each non-empty line into its own nul-terminated string
+    char **lines = NULL;
+    size_t nlines = 0;
+    size_t cap = 0;
+    for(size_t i = 0; i < m.len;){
+        size_t end = i;
+        while(end < m.len && m.data[end] != '\n') end++;
+        size_t len = end - i;
+        if(len && m.data[i + len - 1] == '\r') len--;
+        if(len){
+            if(nlines == cap){
+                cap = cap ? cap * 2 : 64;
+                lines = realloc(lines, cap * sizeof(*lines));
+                if(!lines){
+                    fprintf(stderr, "out of memory\n");
+                    exit(1);
+                }
+            }
+            char *line = malloc(len + 1);
+            if(!line){
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+            memcpy(line, m.data + i, len);
+            line[len] = '\0';
+            lines[nlines++] = line;
+        }
+        i = end + 1;
+    }
+    unmap_file(&m);
+
+    pattern_t *patterns = NULL;
+    size_t npatterns = 0;
+    start_checks_t checks = {0};
+    if(!nlines){
+        fprintf(stderr, "error: no patterns provided in %s\n", path);
+        retval = 1;
+        goto cu;
+    }
+    retval = patterns_prepare(lines, nlines, &patterns, &npatterns, &checks);
+    if(retval) goto cu;
+
+    retval = fgc_write(output, lines, nlines, &checks, patterns, npatterns);
+
+cu:
+    for(size_t i = 0; i < npatterns; i++){
+        pattern_free(&patterns[i]);
+    }
+    free(patterns);
+    start_checks_free(&checks);
+    for(size_t i = 0; i < nlines; i++){
+        free(lines[i]);
+    }
+    free(lines);
+    return retval;
+}
+
+/* --emit-c: write a C file which specializes matching to one pattern set.
+   The file includes findglob.c with FINDGLOB_SPECIALIZED defined, and
+   compiles into a walker which takes findglob's OPTIONs but has its
+   PATTERNs built in.  Every section gets its own function: constants and
+   the fixed parts of prefix, suffix, and contains globs become unrolled
+   byte compares, and regexes become constant dfa tables.  Globs with
+   several '*' are left to the interpreter, which stays the reference. */
+
+// fixed strings up to this long are unrolled, and longer ones use memcmp
+#define EMIT_UNROLL 16
+
+// write a C string literal, with octal escapes for anything unusual
+static void emit_cstr(FILE *f, string_t s){
+    fputc('"', f);
+    for(size_t i = 0; i < s.len; i++){
+        unsigned char c = (unsigned char)s.text[i];
+        // escaping '?' avoids accidental trigraphs
+        if(c < 0x20 || c > 0x7e || c == '"' || c == '\\' || c == '?'){
+            fprintf(f, "\\%03o", c);
+        }else{
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+static void emit_char(FILE *f, unsigned char c){
+    if(isalnum(c) || (c && strchr("._-+~,=@%^#!$&;:", c))){
+        fprintf(f, "'%c'", c);
+    }else{
+        fprintf(f, "(char)0x%02x", c);
+    }
+}
+
+/* compare s to the start of t, or to the end of t if at_end is set; the
+   caller already checked the length */
+static void emit_compare(FILE *f, string_t s, bool at_end){
+    if(s.len > EMIT_UNROLL){
+        if(at_end){
+            fprintf(f, "\n        && memcmp(&t.text[t.len - %zu], ", s.len);
+        }else{
+            fprintf(f, "\n        && memcmp(t.text, ");
+        }
+        emit_cstr(f, s);
+        fprintf(f, ", %zu) == 0", s.len);
+        return;
+    }
+    for(size_t i = 0; i < s.len; i++){
+        if(at_end){
+            fprintf(f, "\n        && t.text[t.len - %zu] == ", s.len - i);
+        }else{
+            fprintf(f, "\n        && t.text[%zu] == ", i);
+        }
+        emit_char(f, (unsigned char)s.text[i]);
+    }
+}
+
+// whether emit_section() can specialize a section
+static bool emit_supported(const section_t *sect){
+    if(sect->type == SECTION_ANY) return false;
+    if(sect->type == SECTION_CONSTANT) return true;
+    const glob_t *g = &sect->val.glob;
+    if(g->opt == OPT_ANY) return false;
+    if(g->opt != OPT_NONE) return true;
+    // only globs of literals and '?' have a fixed length
+    for(size_t i = 0; i < g->text.len; i++){
+        if(!g->lit[i] && g->text.text[i] == '*') return false;
+    }
+    return true;
+}
+
+// write spec_N(), and anything it needs, for one section
+static void emit_section(FILE *f, size_t n, const section_t *sect){
+    const glob_t *g = &sect->val.glob;
+    if(sect->type == SECTION_GLOB && g->opt == OPT_REGEX){
+        const dfa_t *dfa = g->dfa;
+        fprintf(f, "static const uint8_t spec_%zu_class[256] = {", n);
+        for(size_t i = 0; i < 256; i++){
+            fprintf(f, "%s%u,", i % 16 ? " " : "\n    ", dfa->classmap[i]);
+        }
+        fprintf(f, "\n};\n");
+        size_t ntrans = dfa->nstates * dfa->nclasses;
+        fprintf(f, "static const uint16_t spec_%zu_trans[%zu] = {", n, ntrans);
+        for(size_t i = 0; i < ntrans; i++){
+            fprintf(f, "%s%u,", i % 12 ? " " : "\n    ", dfa->trans[i]);
+        }
+        fprintf(f, "\n};\n");
+        fprintf(
+            f, "static const bool spec_%zu_accept[%zu] = {", n, dfa->nstates
+        );
+        for(size_t i = 0; i < dfa->nstates; i++){
+            fprintf(f, "%s%d,", i % 24 ? " " : "\n    ", dfa->accept[i]);
+        }
+        fprintf(f, "\n};\n");
+        fprintf(f, "static bool spec_%zu(string_t t){\n", n);
+        fprintf(f, "    unsigned state = %u;\n", dfa->start);
+        fprintf(f, "    for(size_t i = 0; i < t.len; i++){\n");
+        fprintf(f, "        uint8_t c = spec_%zu_class[(unsigned char)"
+                   "t.text[i]];\n", n);
+        fprintf(f, "        state = spec_%zu_trans[state * %zu + c];\n",
+                n, dfa->nclasses);
+        fprintf(f, "        if(!state) return false;\n");
+        fprintf(f, "    }\n");
+        fprintf(f, "    return spec_%zu_accept[state];\n", n);
+        fprintf(f, "}\n\n");
+        return;
+    }
+
+    if(sect->type == SECTION_GLOB && g->opt == OPT_CONTAINS){
+        fprintf(f, "static bool spec_%zu(string_t t){\n", n);
+        fprintf(f, "    for(size_t i = 0; i + %zu <= t.len; i++){\n",
+                g->text.len);
+        // a memcmp() of constant length is inlined
+        fprintf(f, "        if(memcmp(&t.text[i], ");
+        emit_cstr(f, g->text);
+        fprintf(f, ", %zu) == 0) return true;\n", g->text.len);
+        fprintf(f, "    }\n");
+        fprintf(f, "    return false;\n");
+        fprintf(f, "}\n\n");
+        return;
+    }
+
+    fprintf(f, "static bool spec_%zu(string_t t){\n", n);
+    if(sect->type == SECTION_CONSTANT){
+        fprintf(f, "    return t.len == %zu", sect->val.constant.len);
+        emit_compare(f, sect->val.constant, false);
+    }else if(g->opt == OPT_PREFIX){
+        fprintf(f, "    return t.len >= %zu", g->text.len);
+        emit_compare(f, g->text, false);
+    }else if(g->opt == OPT_SUFFIX){
+        fprintf(f, "    return t.len >= %zu", g->text.len);
+        emit_compare(f, g->text, true);
+    }else if(g->opt == OPT_BOOKENDS){
+        fprintf(f, "    return t.len >= %zu", g->text.len + g->text2.len);
+        emit_compare(f, g->text, false);
+        emit_compare(f, g->text2, true);
+    }else{
+        // OPT_NONE with only literals and '?', which match any one byte
+        fprintf(f, "    return t.len == %zu", g->text.len);
+        for(size_t i = 0; i < g->text.len; i++){
+            if(!g->lit[i]) continue;
+            fprintf(f, "\n        && t.text[%zu] == ", i);
+            emit_char(f, (unsigned char)g->text.text[i]);
+        }
+    }
+    fprintf(f, ";\n}\n\n");
+}
+
+// write the spec_table entry for a section
+static void emit_entry(FILE *f, size_t n, const section_t *sect){
+    fprintf(f, "    {\n");
+    if(sect->type == SECTION_CONSTANT){
+        fprintf(f, "        .sect = {\n");
+        fprintf(f, "            .type = SECTION_CONSTANT,\n");
+        fprintf(f, "            .val = { .constant = { .len = %zu, .text = ",
+                sect->val.constant.len);
+        emit_cstr(f, sect->val.constant);
+        fprintf(f, " } },\n");
+        fprintf(f, "        },\n");
+    }else{
+        const glob_t *g = &sect->val.glob;
+        const char *opts[] = {
+            [OPT_ANY] = "OPT_ANY",
+            [OPT_PREFIX] = "OPT_PREFIX",
+            [OPT_SUFFIX] = "OPT_SUFFIX",
+            [OPT_CONTAINS] = "OPT_CONTAINS",
+            [OPT_BOOKENDS] = "OPT_BOOKENDS",
+            [OPT_NONE] = "OPT_NONE",
+            [OPT_REGEX] = "OPT_REGEX",
+        };
+        fprintf(f, "        .sect = {\n");
+        fprintf(f, "            .type = SECTION_GLOB,\n");
+        fprintf(f, "            .val = { .glob = {\n");
+        fprintf(f, "                .opt = %s,\n", opts[g->opt]);
+        fprintf(f, "                .text = { .len = %zu, .text = ",
+                g->text.len);
+        emit_cstr(f, g->text);
+        fprintf(f, " },\n");
+        if(g->opt == OPT_BOOKENDS){
+            fprintf(f, "                .text2 = { .len = %zu, .text = ",
+                    g->text2.len);
+            emit_cstr(f, g->text2);
+            fprintf(f, " },\n");
+        }
+        if(g->opt == OPT_NONE){
+            fprintf(f, "                .lit = spec_%zu_lit,\n", n);
+        }
+        fprintf(f, "            } },\n");
+        fprintf(f, "        },\n");
+    }
+    fprintf(f, "        .fn = spec_%zu,\n", n);
+    fprintf(f, "    },\n");
+}
+
+int emit_c(const char *output, char **texts, size_t ntexts){
+    int retval = 0;
+    pattern_t *patterns = malloc(MAX(ntexts, 1) * sizeof(*patterns));
+    // distinct sections, which may repeat across patterns
+    const section_t **sects = NULL;
+    size_t nsects = 0;
+    size_t nparsed = 0;
+    FILE *f = NULL;
+    if(!patterns){
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for(size_t i = 0; i < ntexts; i++){
+        retval = pattern_parse(&patterns[nparsed++], texts[i]);
+        if(retval) goto cu;
+    }
+    for(size_t i = 0; i < ntexts; i++){
+        for(size_t j = 0; j < patterns[i].len; j++){
+            const section_t *sect = &patterns[i].sects[j];
+            if(!emit_supported(sect)) continue;
+            bool seen = false;
+            for(size_t k = 0; k < nsects && !seen; k++){
+                seen = section_eq(sect, sects[k]);
+            }
+            if(seen) continue;
+            sects = realloc(sects, (nsects + 1) * sizeof(*sects));
+            if(!sects){
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+            sects[nsects++] = sect;
+        }
+    }
+
+    f = fopen(output, "w");
+    if(!f){
+        perror(output);
+        retval = 1;
+        goto cu;
+    }
+    fprintf(f, "// generated by findglob --emit-c; do not edit\n");
+    fprintf(f, "// build it with findglob.c on the include path\n");
+    fprintf(f, "#define FINDGLOB_SPECIALIZED\n");
+    fprintf(f, "#include \"findglob.c\"\n\n");
+    for(size_t i = 0; i < nsects; i++){
+        const section_t *sect = sects[i];
+        if(sect->type == SECTION_GLOB && sect->val.glob.opt == OPT_NONE){
+            const glob_t *g = &sect->val.glob;
+            fprintf(f, "static bool spec_%zu_lit[%zu] = {", i, g->text.len);
+            for(size_t j = 0; j < g->text.len; j++){
+                fprintf(f, "%s%d", j ? ", " : "", g->lit[j]);
+            }
+            fprintf(f, "};\n");
+        }
+        emit_section(f, i, sect);
+    }
+    // an empty array is not allowed, so the table always has a spare entry
+    fprintf(f, "const spec_t spec_table[] = {\n");
+    for(size_t i = 0; i < nsects; i++){
+        emit_entry(f, i, sects[i]);
+    }
+    fprintf(f, "    { .fn = NULL },\n");
+    fprintf(f, "};\n");
+    fprintf(f, "const size_t spec_count = %zu;\n\n", nsects);
+
+    for(size_t i = 0; i < ntexts; i++){
+        fprintf(f, "static char spec_pattern_%zu[] = ", i);
+        emit_cstr(f, (string_t){ .text = texts[i], .len = strlen(texts[i]) });
+        fprintf(f, ";\n");
+    }
+    fprintf(f, "static char *spec_patterns[] = {\n");
+    for(size_t i = 0; i < ntexts; i++){
+        fprintf(f, "    spec_pattern_%zu,\n", i);
+    }
+    fprintf(f, "};\n\n");
+    fprintf(f, "int main(int argc, char **argv){\n");
+    fprintf(f, "    return findglob_spec_main(\n");
+    fprintf(f, "        argc, argv, spec_patterns, %zu\n", ntexts);
+    fprintf(f, "    );\n");
+    fprintf(f, "}\n");
+
+    if(ferror(f)){
+        perror(output);
+        retval = 1;
+    }
+    if(fclose(f)){
+        perror(output);
+        retval = 1;
+    }
+    if(retval) remove(output);
+
+cu:
+    for(size_t i = 0; i < nparsed; i++){
+        pattern_free(&patterns[i]);
+    }
+    free(patterns);
+    free(sects);
+    return retval;
+}
+
+/* fixed is NULL for findglob itself, or the PATTERNs a generated walker was
+   built for, in which case argv may only hold OPTIONs */
+static int _findglob_main(
+    int argc, char **argv, char **fixed, size_t nfixed
+){
+    if(argc < 2 && !fixed){
+        fprintf(stderr, "usage:   findglob PATTERN... [ANTIPATERN...]\n");
+        fprintf(
+            stderr, "example: findglob '**/*.c' '**/*.h' '!.git' '!tests'\n"
+        );
+        fprintf(stderr, "also try findglob --help\n");
+        return 1;
+    }
+    // a generated walker may be run with no arguments at all
+    const char *arg1 = argc < 2 ? "" : argv[1];
+    if(strcmp(arg1, "--help") == 0 || strcmp(arg1, "-h") == 0){
+        print_help(stdout);
+        return 0;
+    }
+    if(strcmp(arg1, "--version") == 0){
+        fprintf(stdout, "%s\n", VERSION);
+        return 0;
+    }
+    int retval = 0;
+
+    // options come before any patterns
+    opts_t opts = {0};
+    char *compile = NULL;
+    char *output = NULL;
+    char *set = NULL;
+    char *dirs = NULL;
+    char *emit = NULL;
+    int first = 1;
+    for(; first < argc; first++){
+        char **dest = NULL;
+        if(strcmp(argv[first], "--") == 0){
+            first++;
+            break;
+        }else if(strcmp(argv[first], "--inode-order") == 0){
+            opts.inode_order = true;
+        }else if(strcmp(argv[first], "--sorted") == 0){
+            opts.sorted = true;
+        }else if(strcmp(argv[first], "--front-coded") == 0){
+            opts.front_coded = true;
+        }else if(strcmp(argv[first], "--compile") == 0){
+            dest = &compile;
+        }else if(strcmp(argv[first], "-o") == 0){
+            dest = &output;
+        }else if(strcmp(argv[first], "--set") == 0){
+            dest = &set;
+        }else if(strcmp(argv[first], "--dirs") == 0){
+            dest = &dirs;
+        }else if(strcmp(argv[first], "--emit-c") == 0){
+            dest = &emit;
+        }else{
+            break;
+        }
+        if(!dest) continue;
+        if(first + 1 == argc){
+            fprintf(stderr, "error: %s requires an argument\n", argv[first]);
+            return 1;
+        }
+        *dest = argv[++first];
+    }
+    if(compile && set){
+        fprintf(stderr, "error: --compile and --set are incompatible\n");
+        return 1;
+    }
+    if(emit && (compile || set)){
+        fprintf(
+            stderr, "error: --emit-c is incompatible with --compile and --set\n"
+        );
+        return 1;
+    }
+    if(!compile && output){
+        fprintf(stderr, "error: -o is only valid with --compile\n");
+        return 1;
+    }
+    if(compile && !output){
+        fprintf(stderr, "error: --compile requires -o OUTPUT\n");
+        return 1;
+    }
+    if((compile || set) && first != argc){
+        fprintf(
+            stderr,
+            "error: PATTERNs are not allowed with %s\n",
+            compile ? "--compile" : "--set"
+        );
+        return 1;
+    }
+    char **texts = argv + first;
+    size_t ntexts = (size_t)(argc - first);
+    if(fixed){
+        if(first != argc){
+            fprintf(stderr, "error: this walker was generated with its ");
+            fprintf(stderr, "PATTERNs and takes only OPTIONs\n");
+            fprintf(stderr, "unexpected argument: %s\n", argv[first]);
+            return 1;
+        }
+        if(compile || set || emit){
+            fprintf(stderr, "error: a generated walker does not support ");
+            fprintf(stderr, "--compile, --set or --emit-c\n");
+            return 1;
+        }
+        texts = fixed;
+        ntexts = nfixed;
+    }
+    if(!compile && !set && !ntexts){
+        fprintf(stderr, "error: no patterns provided\n");
+        return 1;
+    }
+
+    if(compile) return fgc_compile(compile, output);
+    if(emit) return emit_c(emit, texts, ntexts);
+
+    pattern_t *patterns;
+    size_t npatterns;
+    const uint32_t *groups = NULL;
+    size_t ngroups = 0;
+    mapping_t m = {0};
+    if(set){
+        retval = fgc_load(set, &m, &patterns, &npatterns, &groups, &ngroups);
+    }else{
+        retval = patterns_prepare(texts, ntexts, &patterns, &npatterns, NULL);
+    }
+    if(retval) goto cleanup;
+
+    if(dirs){
+        opts.dirs = fopen(dirs, "w");
+        if(!opts.dirs){
+            perror(dirs);
+            retval = 1;
+            goto free_patterns;
+        }
+    }
+
+    retval = findglob(patterns, npatterns, groups, ngroups, opts);
+
+    // check fclose since we were writing
+    if(opts.dirs && fclose(opts.dirs)){
+        perror(dirs);
+        retval = 1;
+    }
+
+free_patterns:
+    for(size_t i = 0; i < npatterns; i++){
+        pattern_free(&patterns[i]);
+    }
+    free(patterns);
+
+cleanup:
+    unmap_file(&m);
+    return retval;
+}
+
+int findglob_main(int argc, char **argv){
+    return _findglob_main(argc, argv, NULL, 0);
+}
+
+#ifdef FINDGLOB_SPECIALIZED
+/* main() of a generated matcher: findglob, with any OPTIONs given on the
+   command line and the PATTERNs it was generated from */
+int findglob_spec_main(
+    int argc, char **argv, char **patterns, size_t npatterns
+){
+    return _findglob_main(argc, argv, patterns, npatterns);
+}
+#endif
@@ -215,6 +215,21 @@ int test_string(){
     ASSERT(!path_startswith(S("a/bb"), S("a/b")));
     ASSERT(path_startswith(S("/a"), S("/")));
 
+    ASSERT(path_cmp(S("a/x"), S("a-b")) == -1);
+    ASSERT(path_cmp(S("a-b"), S("a/x")) == 1);
+    ASSERT(path_cmp(S("a"), S("a/x")) == -1);
+    ASSERT(path_cmp(S("a/x"), S("a/x")) == 0);
+    ASSERT(path_cmp(S("a/b/c"), S("a/c")) == -1);
+
+    // --sorted events: descending into "a" sorts as "a/"
+    event_t ea = { .name = S("a") };
+    event_t ead = { .name = S("a"), .descend = true };
+    event_t eab = { .name = S("a-b") };
+    ASSERT(_qsort_events_cmp(&ea, &eab) == -1);
+    ASSERT(_qsort_events_cmp(&eab, &ead) == -1);
+    ASSERT(_qsort_events_cmp(&ea, &ead) == -1);
+    ASSERT(_qsort_events_cmp(&ead, &ead) == 0);
+
     return retval;
 }
 
@@ -340,6 +355,77 @@ int path_iter_test_case(
     return failures;
 }
 
+int test_regex_match(){
+    int retval = 0;
+
+    #define TEST_CASE(REGEX, TEXT, EXP) do { \
+        section_t sect; \
+        if(section_parse_regex(&sect, S(REGEX))){ \
+            fprintf(stderr, "TEST_CASE("#REGEX") failed to parse\n"); \
+            retval = 1; \
+            break; \
+        } \
+        if(section_matches(sect, S(TEXT)) != EXP){ \
+            fprintf( \
+                stderr, \
+                "TEST_CASE("#REGEX", "#TEXT", "#EXP") failed\n" \
+            ); \
+            retval = 1; \
+        } \
+        section_free(&sect); \
+    } while(0)
+
+    TEST_CASE("libfoo\\.so\\.[0-9]+\\.[0-9]+", "libfoo.so.1.22", true);
+    TEST_CASE("libfoo\\.so\\.[0-9]+\\.[0-9]+", "libfoo.so.1", false);
+    TEST_CASE("libfoo\\.so\\.[0-9]+\\.[0-9]+", "libfoo.so.1.x", false);
+    TEST_CASE("libfoo\\.so\\.[0-9]+\\.[0-9]+", "libfooXso.1.2", false);
+    // sections always match in full
+    TEST_CASE("a", "ab", false);
+    TEST_CASE("a.", "ab", true);
+    TEST_CASE("^a.$", "ab", true);
+    TEST_CASE("(ab|cd)*e", "e", true);
+    TEST_CASE("(ab|cd)*e", "abcdabe", true);
+    TEST_CASE("(ab|cd)*e", "abce", false);
+    TEST_CASE("x?y", "y", true);
+    TEST_CASE("a{2,3}", "a", false);
+    TEST_CASE("a{2,3}", "aa", true);
+    TEST_CASE("a{2,3}", "aaa", true);
+    TEST_CASE("a{2,3}", "aaaa", false);
+    TEST_CASE("a{2,}", "aaaaa", true);
+    TEST_CASE("a{2}", "aa", true);
+    TEST_CASE("a{2}", "aaa", false);
+    TEST_CASE("[^.].*", ".git", false);
+    TEST_CASE("[^.].*", "git", true);
+    TEST_CASE("[]a]+", "]a]", true);
+    TEST_CASE("[a-]+", "-a", true);
+    TEST_CASE("[[:digit:]_]+", "1_2", true);
+    TEST_CASE("[[:digit:]_]+", "1a2", false);
+    TEST_CASE("(|x)y", "y", true);
+    TEST_CASE("(a*)*b", "aaab", true);
+
+    #undef TEST_CASE
+
+    // malformed regexes
+    SWALLOW_STDERR;
+    char *bad[] = {
+        "*a", "a(", "a)", "[a", "a{3,2}", "a{1", "a^", "$a", "[[:nope:]]",
+        "a{256}", "a\\",
+    };
+    for(size_t i = 0; i < sizeof(bad)/sizeof(*bad); i++){
+        section_t sect;
+        if(section_parse_regex(&sect, S(bad[i])) == 0){
+            UNSWALLOW_STDERR;
+            fprintf(stderr, "bad regex %s parsed successfully\n", bad[i]);
+            SWALLOW_STDERR;
+            section_free(&sect);
+            retval = 1;
+        }
+    }
+    UNSWALLOW_STDERR;
+
+    return retval;
+}
+
 int test_path_iter(){
     int retval = 0;
 
@@ -537,10 +623,16 @@ int test_roots_iter(){
         /* GROUP */ "/a/b", "!/a/b", "/a/b/c", NULL
     );
 
-    // antipattern is always included, even when it's not nested
+    // antipattern is not included when it's not nested
     TEST_CASE(
         /* REALPATHS */ "/a", "!/b", NULL,
-        /* GROUP */ "/a", "!/b", NULL
+        /* GROUP */ "/a", NULL
+    );
+
+    // antipattern above the root is included
+    TEST_CASE(
+        /* REALPATHS */ "/a/b", "!/", "!/a/bb", NULL,
+        /* GROUP */ "/a/b", "!/", NULL
     );
 
     return retval;
@@ -889,6 +981,9 @@ int test_pattern_parse(){
     // used parsed section output to create pattern.start
     TEST_CASE("a\\*b/**", 0, "a*b", false, "a*b", ANY);
 
+    // literal regex sections are constants, and become part of the start
+    TEST_CASE(":r:a\\.b/**", 0, "a.b", false, "a.b", ANY);
+
     // regression cases
     TEST_CASE("/**", 0, "/", false, "/", ANY);
     TEST_CASE("/a/**", 0, "/a", false, "/", "a", ANY);
@@ -1208,12 +1303,81 @@ void sprint_pattern(char *buf, pattern_t pattern, size_t skip){
                             *(bufp++) = c;
                         }
                         break;
+                    case OPT_REGEX:
+                        bufp += sprintf(
+                            bufp,
+                            "%.*s",
+                            (int)sect.val.glob.text.len,
+                            sect.val.glob.text.text
+                        );
+                        break;
                 }
                 break;
         }
     }
 }
 
+int test_patterns_simplify(){
+    int retval = 0;
+
+    // INPUTS is a NULL-terminated list, followed by the expected outputs
+    #define TEST_CASE(...) do { \
+        char *x[] = {__VA_ARGS__}; \
+        size_t nx = sizeof(x)/sizeof(*x); \
+        pattern_t patterns[16]; \
+        size_t npatterns = 0; \
+        size_t i = 0; \
+        for(; x[i]; i++){ \
+            if(pattern_parse(&patterns[npatterns++], x[i])){ \
+                fprintf(stderr, "failed to parse %s\n", x[i]); \
+                retval = 1; \
+            } \
+        } \
+        patterns_simplify(patterns, &npatterns); \
+        bool ok = (npatterns == nx - i - 1); \
+        for(size_t j = 0; ok && j < npatterns; j++){ \
+            char buf[256] = {0}; \
+            sprint_pattern(buf, patterns[j], 0); \
+            ok = (strcmp(buf, x[i + 1 + j]) == 0); \
+        } \
+        if(!ok){ \
+            fprintf(stderr, "TEST_CASE(%s...) failed, got:\n", x[0]); \
+            for(size_t j = 0; j < npatterns; j++){ \
+                char buf[256] = {0}; \
+                sprint_pattern(buf, patterns[j], 0); \
+                fprintf(stderr, "    %s\n", buf); \
+            } \
+            retval = 1; \
+        } \
+        for(size_t j = 0; j < npatterns; j++) pattern_free(&patterns[j]); \
+    } while(0)
+
+    // subsumed patterns
+    TEST_CASE("/x/src/**/*.c", "/x/**/*.c", NULL, "/x/**/*.c");
+    TEST_CASE("/x/**/*.c", "/x/src/*.c", NULL, "/x/**/*.c");
+    TEST_CASE("/x/**/*.c", "/x/**/a.c", "/x/**/b*.c", NULL, "/x/**/*.c");
+    TEST_CASE("/x/**", "/x/a/b/*", "/x/**/c", NULL, "/x/**");
+    TEST_CASE("/x/a*", "/x/ab*", "/x/a*c", NULL, "/x/a*");
+    TEST_CASE("/x/*a*", "/x/*bab", "/x/b*", NULL, "/x/*a*", "/x/b*");
+    // duplicates keep the first one
+    TEST_CASE("/x/*.c", "/x/*.h", "/x/*.c", NULL, "/x/*.c", "/x/*.h");
+    // a trailing ** must match something
+    TEST_CASE("/x/**", "/x", NULL, "/x/**", "/x");
+    // a narrower class covers nothing wider
+    TEST_CASE("/x/**/", "/x/**/*.c", ":d:/x/a", NULL, "/x/**", "/x/**/*.c");
+    // a different start must not change how matches are printed
+    TEST_CASE("/x/**/*.c", "/**/*.c", NULL, "/**/*.c");
+    // antipatterns which no search can reach
+    TEST_CASE("/x/**", "!/y/**", "!/**/.git", "!/x/a", NULL,
+        "/x/**", "!/**/.git", "!/x/a"
+    );
+    // antipatterns cover each other too
+    TEST_CASE("/x/**", "!/x/**/.git", "!/**/.git", NULL, "/x/**", "!/**/.git");
+
+    return retval;
+    #undef TEST_CASE
+}
+
 int process_dir_case(
     pool_t **p,
     match_array_t **ma,
@@ -1435,7 +1599,7 @@ int matches_init_test_case(
 
     bool isterminal;
     match_array_t *matches_out = matches_init(
-        p, ma, patterns, nin, start, start, &isterminal
+        p, ma, patterns, nin, start, &isterminal
     );
 
     int failures = 0; // 1 = patterns, 2 = terminal
@@ -1609,6 +1773,26 @@ int test_main(){
         "a pattern cannot have two consecutive '**' elements\n",
         "**/**"
     );
+    TEST_CASE(
+        "compile without output", 1,
+        "error: --compile requires -o OUTPUT\n",
+        "--compile", "patterns"
+    );
+    TEST_CASE(
+        "set with patterns", 1,
+        "error: PATTERNs are not allowed with --set\n",
+        "--set", "compiled", "**"
+    );
+    TEST_CASE(
+        "emit-c with set", 1,
+        "error: --emit-c is incompatible with --compile and --set\n",
+        "--emit-c", "set.c", "--set", "compiled"
+    );
+    TEST_CASE(
+        "missing option argument", 1,
+        "error: --set requires an argument\n",
+        "--set"
+    );
     return retval;
     #undef TEST_CASE
 }
@@ -1701,6 +1885,73 @@ void cleanup_e2e_test(){
     #undef DETECT
 }
 
+#ifndef _WIN32
+/* --emit-c: build a walker specialized to some patterns, run it from example,
+   and expect it to print what the interpreter prints for the same patterns */
+int emit_c_case(char *cwd, char *exp, int npatterns, char **patterns){
+    int retval = 0;
+    char *argv[16] = {"findglob", "--emit-c", "test_walker.c", "--"};
+    int argc = 4;
+    for(int i = 0; i < npatterns; i++) argv[argc++] = patterns[i];
+    argv[argc] = exp;
+
+    // the interpreter
+    retval |= e2e_test_case(cwd, "example", exp, npatterns + 1, argv + 3);
+
+    // the generated walker
+    retval |= e2e_test_case(cwd, NULL, "", argc, argv);
+    int ret = system(
+        "cc -Wall -Wextra -Werror -pthread -I'" CWD "' "
+        "-o test_walker test_walker.c"
+    );
+    if(ret){
+        fprintf(stderr, "unable to compile test_walker.c\n");
+        retval = 1;
+        goto cu;
+    }
+    // a trailing -- ends the (empty) OPTIONs as usual
+    char *cmds[] = {
+        "cd example && ../test_walker > ../test_walker_out",
+        "cd example && ../test_walker -- > ../test_walker_out",
+    };
+    for(size_t i = 0; i < sizeof(cmds)/sizeof(*cmds); i++){
+        ret = system(cmds[i]);
+        char buf[256] = {0};
+        FILE *f = fopen("test_walker_out", "r");
+        size_t n = f ? fread(buf, 1, sizeof(buf) - 1, f) : 0;
+        if(f) fclose(f);
+        if(ret || n != strlen(exp) || strcmp(buf, exp) != 0){
+            fprintf(stderr, "--emit-c walker for");
+            for(int j = 0; j < npatterns; j++){
+                fprintf(stderr, " %s", patterns[j]);
+            }
+            fprintf(stderr, " (%s) exited %d and printed:\n%s",
+                cmds[i], ret, buf
+            );
+            fprintf(stderr, "--- but the interpreter printed:\n%s", exp);
+            retval = 1;
+        }
+    }
+    // but the walker's PATTERNs are fixed, so others are rejected
+    ret = system("cd example && ../test_walker d > /dev/null 2>&1");
+    if(!ret){
+        fprintf(stderr, "--emit-c walker accepted a PATTERN\n");
+        retval = 1;
+    }
+    ret = system("cd example && ../test_walker -- d > /dev/null 2>&1");
+    if(!ret){
+        fprintf(stderr, "--emit-c walker accepted a PATTERN after --\n");
+        retval = 1;
+    }
+
+cu:
+    unlink("test_walker.c");
+    unlink("test_walker");
+    unlink("test_walker_out");
+    return retval;
+}
+#endif
+
 int test_e2e(){
     int retval = prep_e2e_test();;
 
@@ -1799,6 +2050,61 @@ int test_e2e(){
         "d/f\n"
     );
 
+    // inode order changes how we walk but not what we print
+    TEST_CASE(NULL, "--inode-order", "example/**",
+        "example\n"
+        "example/a\n"
+        "example/b\n"
+        "example/d\n"
+        "example/d/a\n"
+        "example/d/a/c\n"
+        "example/d/e\n"
+        "example/d/f\n"
+    );
+    TEST_CASE("example", "--inode-order", "**", ":!d:*/**", ".\na\n");
+    TEST_CASE("example", "--inode-order", "--", "b/**", "d/**",
+        "b\n"
+        "d\n"
+        "d/a\n"
+        "d/a/c\n"
+        "d/e\n"
+        "d/f\n"
+    );
+    // a file start is printed in place, alone or before another root
+    TEST_CASE("example", "--inode-order", "a", "a\n");
+    TEST_CASE("example", "--inode-order", "--sorted", "a", "a\n");
+    TEST_CASE("example", "--inode-order", "--", "d/f", "b/**", "d/f\nb\n");
+    TEST_CASE("example", "--inode-order", "--sorted", "--", "d/f", "b/**",
+        "b\n"
+        "d/f\n"
+    );
+
+    // sorted output is merged across roots, in bytewise order
+    TEST_CASE("example", "--sorted", "d/**", "b/**", "a",
+        "a\n"
+        "b\n"
+        "d\n"
+        "d/a\n"
+        "d/a/c\n"
+        "d/e\n"
+        "d/f\n"
+    );
+    TEST_CASE("example", "--sorted", "--inode-order", "**", "!d/a",
+        ".\n"
+        "a\n"
+        "b\n"
+        "d\n"
+        "d/e\n"
+        "d/f\n"
+    );
+
+    // regex sections
+    TEST_CASE("example", ":r:d/[ef]", "d/e\nd/f\n");
+    TEST_CASE("example", ":r:**/(a|c)", ":!r:d/a/c", "a\nd/a\n");
+    TEST_CASE("example", ":rf:**/[a-c]", "a\n");
+    // '\' escapes within a section, and is never a separator
+    TEST_CASE("example", ":r:d\\.?/e", "d/e\n");
+
     // match explicitly named files
     TEST_CASE("example", "a", "a\n");
     TEST_CASE("example", "a/", "");
@@ -1817,6 +2123,79 @@ int test_e2e(){
     TEST_CASE("example", "a", "!K:/does_not_exist", "a\n");
     #endif // _WIN32
 
+    // compiled pattern sets
+    FILE *f = fopen("test_patterns", "w");
+    fprintf(f, "example/d/**\n!example/d/a\n\nexample/a\n");
+    fclose(f);
+    TEST_CASE(NULL, "--compile", "test_patterns", "-o", "test_set", "");
+    TEST_CASE(NULL, "--set", "test_set",
+        "example/d\n"
+        "example/d/e\n"
+        "example/d/f\n"
+        "example/a\n"
+    );
+    f = fopen("test_patterns", "w");
+    fprintf(f, "**/f\r\n");
+    fclose(f);
+    TEST_CASE("example", "--compile", "../test_patterns", "-o", "../test_set",
+        ""
+    );
+    TEST_CASE("example", "--set", "../test_set", "d/f\n");
+    // starts resolve differently here, so the set is re-parsed
+    TEST_CASE("example/d", "--set", "../../test_set", "f\n");
+    unlink("test_patterns");
+    unlink("test_set");
+
+    // --dirs records every directory that was read
+    TEST_CASE(NULL, "--dirs", "test_dirs", "example/d/**/f", "example/d/f\n");
+    {
+        char buf[256] = {0};
+        f = fopen("test_dirs", "r");
+        size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+        fclose(f);
+        char *exp = "example/d\nexample/d/a\nexample/d/a/c\nexample/d/e\n";
+        if(n != strlen(exp) || strcmp(buf, exp) != 0){
+            fprintf(stderr, "--dirs wrote:\n%s\nexpected:\n%s\n", buf, exp);
+            retval = 1;
+        }
+    }
+    unlink("test_dirs");
+
+    #ifndef _WIN32
+    // --emit-c walkers, compiled the way mkninja compiles them
+    #define EMIT_C_CASE(EXP, ...) do { \
+        char *patterns[] = {__VA_ARGS__}; \
+        int n = (int)(sizeof(patterns)/sizeof(*patterns)); \
+        if(emit_c_case(cwd, EXP, n, patterns)) retval = 1; \
+    } while(0)
+    EMIT_C_CASE(".\na\nb\nd\nd/e\nd/f\n", "**", "!d/a");
+    EMIT_C_CASE("a\nd/f\n", ":f:**");
+    EMIT_C_CASE("a\nd/a\n", ":r:**/(a|c)", ":!r:d/a/c");
+    EMIT_C_CASE("a\n", ":rf:**/[a-c]");
+    EMIT_C_CASE("b\nd/e\nd/f\n", "b", "d/*", "!d/a");
+    #undef EMIT_C_CASE
+    #endif
+
+    // --front-coded prints each match relative to the one before it
+    TEST_CASE(NULL, "--front-coded", "example/**",
+        "0 example\n"
+        "7 /a\n"
+        "8 b\n"
+        "8 d\n"
+        "9 /a\n"
+        "11 /c\n"
+        "10 e\n"
+        "10 f\n"
+    );
+    TEST_CASE(NULL, "--front-coded", "--sorted", "example/d/**", "example/a",
+        "0 example/a\n"
+        "8 d\n"
+        "9 /a\n"
+        "11 /c\n"
+        "10 e\n"
+        "10 f\n"
+    );
+
     cleanup_e2e_test();
 
     return retval;
@@ -1831,11 +2210,13 @@ int main(){
     } while(0)
     RUN_TEST(test_string);
     RUN_TEST(test_glob_match);
+    RUN_TEST(test_regex_match);
     RUN_TEST(test_path_iter);
     RUN_TEST(test_roots_iter);
     RUN_TEST(test_section_parse);
     RUN_TEST(test_pattern_parse);
     RUN_TEST(test_pattern_rewrite_start);
+    RUN_TEST(test_patterns_simplify);
     RUN_TEST(test_match_text);
     RUN_TEST(test_process_dir);
     RUN_TEST(test_matches_init);
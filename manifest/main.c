@@ -0,0 +1,5 @@
+#include "manifest.c"
+
+int main(int argc, char **argv){
+    return manifest_main(argc, argv);
+}
@@ -12,13 +12,27 @@ SET make=n
 FOR /F %%i IN ('dir make.bat /AA /B 2^>nul') do (SET make=o)
 SET manifest=n
 FOR /F %%i IN ('dir manifest.c /AA /B 2^>nul') do (SET manifest=o)
-:: echo "%make%-%manifest%"
+SET mfx=n
+FOR /F %%i IN ('dir mfx.h /AA /B 2^>nul') do (SET mfx=o)
+SET main=n
+FOR /F %%i IN ('dir main.c /AA /B 2^>nul') do (SET main=o)
+SET test=n
+FOR /F %%i IN ('dir test.c /AA /B 2^>nul') do (SET test=o)
+:: echo "%make%-%manifest%-%mfx%-%main%-%test%"
 
-if "%make%%manifest%"=="oo" (echo manifest is up-to-date) else (
+if "%make%%manifest%%mfx%%main%"=="oooo" (echo manifest is up-to-date) else (
     :: /wd4221: ansi compliance
     :: /wd4204: ansi compliance
-    cl manifest.c /O2 /W4 /wd4221 /wd4204 /WX /link /out:manifest.exe ^
-    && attrib +a manifest.c
+    cl main.c /O2 /W4 /wd4221 /wd4204 /WX /link /out:manifest.exe ^
+    && attrib +a manifest.c && attrib +a mfx.h && attrib +a main.c
+)
+
+if "%make%%manifest%%mfx%%test%"=="oooo" (echo test is up-to-date) else (
+    :: /wd4221: ansi compliance
+    :: /wd4204: ansi compliance
+    cl test.c /O2 /W4 /wd4221 /wd4204 /WX /D_CRT_SECURE_NO_WARNINGS ^
+        /D_CRT_NONSTDC_NO_WARNINGS ^
+    && attrib +a manifest.c && attrib +a mfx.h && attrib +a test.c
 )
 
 attrib +a make.bat
@@ -4,17 +4,27 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <errno.h>
 
+#include "mfx.h"
+
 #define VERSION "0.2.2"
 
 #define FILE_NOT_FOUND 2
-#define STRING_NOT_FOUND ((size_t)-1)
+
+#if defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
 
 #ifdef _WIN32 // WINDOWS
 #include <windows.h>
 #include <fileapi.h>
 #include <sys/utime.h>
+#include <process.h>
+#include <direct.h>
 
 #define fopen fopen_compat
 FILE *fopen_compat(const char *filename, const char *mode){
@@ -86,6 +96,109 @@ int compat_utime(const char *path){
     return _utime(path, NULL);
 }
 
+// set the modification time to exactly t, rather than to now
+int compat_set_mtime(const char *path, filetime_t t){
+    HANDLE hfile = CreateFileA(
+        path,
+        FILE_WRITE_ATTRIBUTES,
+        FILE_SHARE_DELETE|FILE_SHARE_READ|FILE_SHARE_WRITE,
+        NULL,
+        OPEN_EXISTING,
+        0,
+        NULL
+    );
+    if(hfile == INVALID_HANDLE_VALUE) return 1;
+    BOOL ok = SetFileTime(hfile, NULL, NULL, &t);
+    CloseHandle(hfile);
+    return !ok;
+}
+
+// there is no fstatat() on windows, so a dircache_t just holds nothing
+typedef struct {
+    int unused;
+} dircache_t;
+
+int get_filetime_at(dircache_t *dc, const char *path, filetime_t *out){
+    (void)dc;
+    return get_filetime(path, out);
+}
+
+void dircache_free(dircache_t *dc){
+    (void)dc;
+}
+
+int compat_getpid(void){
+    return _getpid();
+}
+
+// returns a malloc'd string, or NULL after printing an error
+char *compat_getcwd(void){
+    char *out = _getcwd(NULL, 0);
+    if(!out) perror("getcwd");
+    return out;
+}
+
+bool is_abs(const char *path){
+    if(path[0] == '/' || path[0] == '\\') return true;
+    // a letter drive, like C:
+    return path[0] && path[1] == ':';
+}
+
+// the parts of a file's identity that --hash compares
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    filetime_t mtime;
+} fileid_t;
+
+int get_fileid(const char *path, fileid_t *out){
+    *out = (fileid_t){0};
+    HANDLE hfile = CreateFileA(
+        path,
+        GENERIC_READ,
+        FILE_SHARE_DELETE|FILE_SHARE_READ|FILE_SHARE_WRITE,
+        NULL,
+        OPEN_EXISTING,
+        0,
+        NULL
+    );
+    if(hfile == INVALID_HANDLE_VALUE) return 1;
+    BY_HANDLE_FILE_INFORMATION info;
+    BOOL ok = GetFileInformationByHandle(hfile, &info);
+    CloseHandle(hfile);
+    if(!ok) return 1;
+    *out = (fileid_t){
+        .dev = info.dwVolumeSerialNumber,
+        .ino = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow,
+        .size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow,
+        .mtime = info.ftLastWriteTime,
+    };
+    return 0;
+}
+
+void filetime_pack(filetime_t t, uint64_t out[2]){
+    out[0] = t.dwHighDateTime;
+    out[1] = t.dwLowDateTime;
+}
+
+// FILETIMEs count 100ns ticks since 1601
+void filetime_unix(filetime_t t, int64_t *sec, uint32_t *nsec){
+    uint64_t ticks = ((uint64_t)t.dwHighDateTime << 32) | t.dwLowDateTime;
+    *sec = (int64_t)(ticks / 10000000) - 11644473600LL;
+    *nsec = (uint32_t)(ticks % 10000000) * 100;
+}
+
+// atomically replace dst with src
+int compat_rename(const char *src, const char *dst){
+    BOOL ok = MoveFileExA(src, dst, MOVEFILE_REPLACE_EXISTING);
+    if(!ok){
+        win_perror(dst);
+        return 1;
+    }
+    return 0;
+}
+
 // result is true when a is newer than b
 bool isnewer(filetime_t a, filetime_t b){
     return (
@@ -99,6 +212,10 @@ bool isnewer(filetime_t a, filetime_t b){
 
 #else // UNIX
 #include <utime.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 #define compat_perror perror
 
@@ -127,6 +244,156 @@ int compat_utime(const char *path){
     return utime(path, NULL);
 }
 
+// set the modification time to exactly t, rather than to now
+int compat_set_mtime(const char *path, filetime_t t){
+    struct timespec times[2] = { { .tv_nsec = UTIME_NOW }, t };
+    return utimensat(AT_FDCWD, path, times, 0);
+}
+
+// parent directories kept open by each stat worker
+#define DIRCACHE_SIZE 8
+
+/* Sorted names from the same directory are adjacent, so rather than let the
+   kernel resolve every full path, a stat worker opens each parent directory
+   once and calls fstatat() on the children.  The cache holds a few recent
+   parents, so returning to a parent after a subdirectory still hits. */
+typedef struct {
+    // each prefix includes its trailing '/'
+    char *prefix[DIRCACHE_SIZE];
+    size_t len[DIRCACHE_SIZE];
+    int fd[DIRCACHE_SIZE];
+    size_t count;
+    // the slot to evict next
+    size_t next;
+} dircache_t;
+
+static int dircache_open(dircache_t *dc, const char *path, size_t len){
+    for(size_t i = 0; i < dc->count; i++){
+        if(dc->len[i] == len && memcmp(dc->prefix[i], path, len) == 0){
+            return dc->fd[i];
+        }
+    }
+    char *prefix = malloc(len + 1);
+    if(!prefix) return -1;
+    memcpy(prefix, path, len);
+    prefix[len] = '\0';
+    int fd = open(prefix, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0){
+        free(prefix);
+        return -1;
+    }
+    size_t i = dc->next;
+    dc->next = (i + 1) % DIRCACHE_SIZE;
+    if(dc->prefix[i]){
+        free(dc->prefix[i]);
+        close(dc->fd[i]);
+    }else{
+        dc->count++;
+    }
+    dc->prefix[i] = prefix;
+    dc->len[i] = len;
+    dc->fd[i] = fd;
+    return fd;
+}
+
+// like get_filetime(), but relative to a cached parent directory
+int get_filetime_at(dircache_t *dc, const char *path, filetime_t *out){
+    const char *slash = strrchr(path, '/');
+    // names without a parent, or with a trailing '/', are stat()ed as usual
+    if(!slash || slash[1] == '\0') return get_filetime(path, out);
+    int fd = dircache_open(dc, path, (size_t)(slash - path) + 1);
+    // let stat() report any error against the full path
+    if(fd < 0) return get_filetime(path, out);
+
+    struct stat s = {0};
+    int ret = fstatat(fd, slash + 1, &s, 0);
+#ifdef __APPLE__
+    *out = s.st_mtimespec;
+#else
+    *out = s.st_mtim;
+#endif
+    if(ret && errno == ENOENT) return FILE_NOT_FOUND;
+    return ret != 0;
+}
+
+void dircache_free(dircache_t *dc){
+    for(size_t i = 0; i < dc->count; i++){
+        free(dc->prefix[i]);
+        close(dc->fd[i]);
+    }
+}
+
+int compat_getpid(void){
+    return (int)getpid();
+}
+
+// returns a malloc'd string, or NULL after printing an error
+char *compat_getcwd(void){
+    size_t cap = 256;
+    while(true){
+        char *out = malloc(cap);
+        if(!out){
+            perror("malloc");
+            return NULL;
+        }
+        if(getcwd(out, cap)) return out;
+        free(out);
+        if(errno != ERANGE){
+            perror("getcwd");
+            return NULL;
+        }
+        cap *= 2;
+    }
+}
+
+bool is_abs(const char *path){
+    return path[0] == '/';
+}
+
+// the parts of a file's identity that --hash compares
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    filetime_t mtime;
+} fileid_t;
+
+int get_fileid(const char *path, fileid_t *out){
+    *out = (fileid_t){0};
+    struct stat s;
+    if(stat(path, &s)) return 1;
+    *out = (fileid_t){
+        .dev = (uint64_t)s.st_dev,
+        .ino = (uint64_t)s.st_ino,
+        .size = (uint64_t)s.st_size,
+#ifdef __APPLE__
+        .mtime = s.st_mtimespec,
+#else
+        .mtime = s.st_mtim,
+#endif
+    };
+    return 0;
+}
+
+void filetime_pack(filetime_t t, uint64_t out[2]){
+    out[0] = (uint64_t)t.tv_sec;
+    out[1] = (uint64_t)t.tv_nsec;
+}
+
+void filetime_unix(filetime_t t, int64_t *sec, uint32_t *nsec){
+    *sec = (int64_t)t.tv_sec;
+    *nsec = (uint32_t)t.tv_nsec;
+}
+
+// atomically replace dst with src
+int compat_rename(const char *src, const char *dst){
+    if(rename(src, dst)){
+        perror(dst);
+        return 1;
+    }
+    return 0;
+}
+
 #endif
 
 typedef struct {
@@ -161,38 +428,7 @@ bool string_eq(string_t a, string_t b){
     return a.len == b.len && strncmp(a.text, b.text, a.len) == 0;
 }
 
-// detects any of the following line endings: \r, \r\n, \n, \n\r
-// the return value will have .text=buffer
-string_t detect_endings(string_t text, char buffer[3]){
-    size_t len = 0;
-    for(size_t i = 0; i < text.len; i++){
-        char c = text.text[i];
-        if(c == '\r' || c == '\n'){
-            if(!len){
-                // first \r or \n
-                buffer[len++] = c;
-            }else if(buffer[0] == c){
-                // \r\r or \n\n
-                break;
-            }else{
-                // mixed case, \r\n or \n\r
-                buffer[len++] = c;
-                break;
-            }
-        }else if(len){
-            // single-character case, \r or \n
-            break;
-        }
-    }
-    if(len){
-        buffer[len] = '\0';
-    }else{
-        // we read the whole string and found no line endings
-        buffer[len++] = '\0';
-    }
-    return (string_t){ .text=buffer, .len=len };
-}
-
+#define READ_CHUNK (1024 * 1024)
 
 int read_stream(FILE *f, string_t *out){
     int retval = 0;
@@ -200,7 +436,7 @@ int read_stream(FILE *f, string_t *out){
     *out = (string_t){0};
 
     size_t len = 0;
-    size_t cap = 1024;
+    size_t cap = READ_CHUNK;
     buffer = malloc(cap);
     if(!buffer){
         perror("malloc");
@@ -208,27 +444,25 @@ int read_stream(FILE *f, string_t *out){
         goto cu;
     }
 
-    int c;
-    // read the whole file, one character at a time
-    while((c = fgetc(f)) != EOF){
-        if(len+1 == cap){
-            // double the buffer size
-            size_t new_cap = cap * 2;
-            char *new_buffer = realloc(buffer, new_cap);
-            if(!new_buffer){
-                perror("realloc");
-                retval = 1;
-                goto cu;
-            }
-            buffer = new_buffer;
-            cap = new_cap;
+    // read the whole file in large blocks, always leaving room for a \0
+    size_t n;
+    while((n = fread(buffer + len, 1, cap - len - 1, f)) > 0){
+        len += n;
+        if(len + 1 < cap) continue;
+        // double the buffer size
+        size_t new_cap = cap * 2;
+        char *new_buffer = realloc(buffer, new_cap);
+        if(!new_buffer){
+            perror("realloc");
+            retval = 1;
+            goto cu;
         }
-        // store the character
-        buffer[len++] = (char)c;
+        buffer = new_buffer;
+        cap = new_cap;
     }
     // check for read error
     if(ferror(f)){
-        perror("fgetc");
+        perror("fread");
         retval = 1;
         goto cu;
     }
@@ -242,186 +476,3014 @@ cu:
 }
 
 
-int read_file(const char *path, string_t *out){
-    *out = (string_t){0};
-    FILE *f = fopen(path, "r");
+// the contents of an existing file, mapped into memory where possible
+typedef struct {
+    string_t text;
+    bool mapped;
+} mapping_t;
+
+// binary only matters on windows, where text mode translates line endings
+int map_file(const char *path, bool binary, mapping_t *m){
+    *m = (mapping_t){0};
+#ifndef _WIN32 // UNIX
+    (void)binary;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        perror(path);
+        return 1;
+    }
+    struct stat s;
+    if(fstat(fd, &s)){
+        perror(path);
+        close(fd);
+        return 1;
+    }
+    size_t len = (size_t)s.st_size;
+    if(len){
+        void *data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data != MAP_FAILED){
+            close(fd);
+            *m = (mapping_t){ .text={ .text=data, .len=len }, .mapped=true };
+            return 0;
+        }
+    }
+    // empty or unmappable file, fall back to reading it
+    FILE *f = fdopen(fd, "r");
     if(!f){
         perror(path);
+        close(fd);
         return 1;
     }
-    int retval = read_stream(f, out);
+#else // WINDOWS
+    /* text mode matches how write_file wrote it, so that the comparison sees
+       the same line endings we would produce */
+    FILE *f = fopen(path, binary ? "rb" : "r");
+    if(!f){
+        perror(path);
+        return 1;
+    }
+#endif
+    int retval = read_stream(f, &m->text);
     fclose(f);
     return retval;
 }
 
 
-int write_file(const char *path, string_t text){
-    FILE *f = fopen(path, "w");
-    if(!f){
-        perror(path);
-        return 1;
+void unmap_file(mapping_t *m){
+#ifndef _WIN32 // UNIX
+    if(m->mapped){
+        munmap(m->text.text, m->text.len);
+        *m = (mapping_t){0};
+        return;
     }
+#endif
+    free(m->text.text);
+    *m = (mapping_t){0};
+}
 
-    // write every character into the file
-    for(size_t i = 0; i < text.len; i++){
-        int ret = fputc(text.text[i], f);
-        if(ret == EOF){
-            perror("fputc");
-            fclose(f);
-            return 1;
-        }
+
+/* open a temporary file beside path, to be renamed into place by
+   temp_commit(), so a concurrent reader sees either the old contents or the
+   new, never a partially written file */
+FILE *temp_open(const char *path, bool binary, char **tmp){
+    size_t tmpcap = strlen(path) + 32;
+    *tmp = malloc(tmpcap);
+    if(!*tmp){
+        perror("malloc");
+        return NULL;
+    }
+    snprintf(*tmp, tmpcap, "%s.tmp%d", path, compat_getpid());
+
+    FILE *f = fopen(*tmp, binary ? "wb" : "w");
+    if(!f){
+        perror(*tmp);
+        free(*tmp);
+        *tmp = NULL;
     }
+    return f;
+}
+
+// close and remove a temporary file after a write error
+void temp_abort(FILE *f, char *tmp){
+    fclose(f);
+    remove(tmp);
+    free(tmp);
+}
 
+int temp_commit(FILE *f, char *tmp, const char *path){
     // check fclose since we were writing
     int ret = fclose(f);
     if(ret){
         perror("fclose");
+        remove(tmp);
+        free(tmp);
         return 1;
     }
 
-    return 0;
+    ret = compat_rename(tmp, path);
+    if(ret) remove(tmp);
+    free(tmp);
+    return ret;
 }
 
+// atomically replace path with the strings, each followed by term
+int write_file(
+    const char *path, const string_t *strings, size_t n, char term
+){
+    char *tmp;
+    FILE *f = temp_open(path, false, &tmp);
+    if(!f) return 1;
 
-size_t find(string_t text, size_t off, string_t pat){
-    if(pat.len > text.len) return STRING_NOT_FOUND;
-    for(size_t i = off; i <= text.len - pat.len; i++){
-        bool found = true;
-        for(size_t j = 0; j < pat.len; j++){
-            if(text.text[i+j] != pat.text[j]){
-                found = false;
-                break;
-            }
+    // stream the strings straight from where they are; stdio buffers them
+    for(size_t i = 0; i < n; i++){
+        size_t written = fwrite(strings[i].text, 1, strings[i].len, f);
+        if(written != strings[i].len || putc(term, f) == EOF){
+            perror(tmp);
+            temp_abort(f, tmp);
+            return 1;
         }
-        if(found) return i;
     }
-    return STRING_NOT_FOUND;
+
+    return temp_commit(f, tmp, path);
+}
+
+
+#ifdef HAVE_SSE2
+
+static unsigned lowest_bit(unsigned mask){
+#ifdef _MSC_VER
+    unsigned long out;
+    _BitScanForward(&out, mask);
+    return (unsigned)out;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+#endif
+
+// returns the offset of the first \r or \n in text, or text.len
+static size_t find_ending(string_t text){
+    size_t i = 0;
+#ifdef HAVE_SSE2
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    for(; i + 16 <= text.len; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)&text.text[i]);
+        __m128i hits = _mm_or_si128(
+            _mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)
+        );
+        unsigned mask = (unsigned)_mm_movemask_epi8(hits);
+        if(mask) return i + lowest_bit(mask);
+    }
+#endif
+    for(; i < text.len; i++){
+        char c = text.text[i];
+        if(c == '\r' || c == '\n') return i;
+    }
+    return text.len;
+}
+
+/* detects any of the following line endings: \r, \r\n, \n, \n\r, based on the
+   first ending in text (at offset loc, or loc == text.len if there is none);
+   with no line endings at all, \0 is the separator */
+static string_t ending_at(string_t text, size_t loc, char buffer[3]){
+    if(loc == text.len){
+        buffer[0] = '\0';
+        return (string_t){ .text=buffer, .len=1 };
+    }
+    size_t len = 0;
+    char c = text.text[loc];
+    buffer[len++] = c;
+    if(loc + 1 < text.len){
+        char d = text.text[loc + 1];
+        // mixed case, \r\n or \n\r
+        if(d != c && (d == '\r' || d == '\n')) buffer[len++] = d;
+    }
+    buffer[len] = '\0';
+    return (string_t){ .text=buffer, .len=len };
+}
+
+typedef struct {
+    string_t text;
+    string_t sep;
+    string_t *strings;
+    size_t count;
+    size_t cap;
+    // where the current string starts
+    size_t start;
+} splitter_t;
+
+// handle a possible separator at loc, where text[loc] == sep[0]
+static int split_at(splitter_t *s, size_t loc){
+    // skip hits inside of a separator we already consumed
+    if(loc < s->start) return 0;
+    if(s->sep.len > 1){
+        if(s->text.len - loc < s->sep.len) return 0;
+        if(memcmp(&s->text.text[loc], s->sep.text, s->sep.len)) return 0;
+    }
+    if(loc > s->start){
+        int retval = string_list_grow(&s->strings, &s->cap, s->count+1);
+        if(retval) return retval;
+        s->strings[s->count++] = (string_t){
+            .len=loc-s->start, .text=&s->text.text[s->start],
+        };
+        s->text.text[loc] = '\0';
+    }
+    // empty strings are ignored; start again after the separator
+    s->start = loc + s->sep.len;
+    return 0;
 }
 
-// this will mangle the input text
+/* split text on sep in a single pass, or on automatically-detected line
+   endings if sep is empty.  This will mangle the input text. */
 int split(string_t text, string_t sep, string_t **out, size_t *count_out){
     *out = NULL;
     *count_out = 0;
-    string_t *strings = NULL;
     int retval = 0;
 
-    size_t count = 0;
-    size_t cap = 1024;
-    strings = malloc(cap * sizeof(*strings));
-    if(!strings){
+    splitter_t s = { .text=text, .cap=1024 };
+    s.strings = malloc(s.cap * sizeof(*s.strings));
+    if(!s.strings){
         perror("malloc");
-        retval = 1;
-        goto cu;
+        return 1;
     }
 
-    size_t start = 0;
-    size_t loc;
-    while((loc = find(text, start, sep)) != STRING_NOT_FOUND){
-        if(start == loc){
-            // empty string, ignore
-            start = loc + sep.len;
-            continue;
+    // no separators can exist before where detection stopped scanning
+    size_t i = 0;
+    char buffer[3];
+    if(sep.len){
+        s.sep = sep;
+    }else{
+        i = find_ending(text);
+        s.sep = ending_at(text, i, buffer);
+        // with no line endings, we have to go back and look for \0
+        if(i == text.len) i = 0;
+    }
+
+    char first = s.sep.text[0];
+#ifdef HAVE_SSE2
+    // find every candidate in each 16-byte block with a single compare
+    const __m128i needle = _mm_set1_epi8(first);
+    for(; i + 16 <= text.len; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)&text.text[i]);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+        while(mask){
+            retval = split_at(&s, i + lowest_bit(mask));
+            if(retval) goto cu;
+            mask &= mask - 1;
         }
-        retval = string_list_grow(&strings, &cap, count+1);
+    }
+#endif
+    while(i < text.len){
+        const char *hit = memchr(&text.text[i], first, text.len - i);
+        if(!hit) break;
+        size_t loc = (size_t)(hit - text.text);
+        retval = split_at(&s, loc);
         if(retval) goto cu;
-        strings[count++] = (string_t){
-            .len=loc-start, .text=&text.text[start],
-        };
-        text.text[loc] = '\0';
-        // start again after the separator
-        start = loc + sep.len;
+        i = loc + 1;
     }
+
     // trailing string?
-    if(start < text.len){
-        retval = string_list_grow(&strings, &cap, count+1);
+    if(s.start < text.len){
+        retval = string_list_grow(&s.strings, &s.cap, s.count+1);
         if(retval) goto cu;
-        strings[count++] = (string_t){
-            .len=text.len-start, .text=&text.text[start],
+        s.strings[s.count++] = (string_t){
+            .len=text.len-s.start, .text=&text.text[s.start],
         };
     }
 
-    *out = strings;
-    *count_out = count;
+    *out = s.strings;
+    *count_out = s.count;
 
 cu:
     if(retval){
         // the contents of the strings do not need freeing
-        free(strings);
+        free(s.strings);
     }
     return retval;
 }
 
 
-int join_names(const string_t *names, size_t n, string_t *out){
-    // build a big list of all names, one per line
-    *out = (string_t){0};
-    size_t outcap = 0;
+/* compare the contents of a file against what write_file() would write for
+   these strings, without building that output in memory */
+bool file_eq(string_t file, const string_t *strings, size_t n, char term){
+    size_t off = 0;
     for(size_t i = 0; i < n; i++){
-        outcap += names[i].len;
+        size_t len = strings[i].len;
+        if(file.len - off <= len) return false;
+        if(memcmp(&file.text[off], strings[i].text, len)) return false;
+        if(file.text[off + len] != term) return false;
+        off += len + 1;
     }
-    // account for newlines and \0
-    outcap += n + 1;
-    char *buffer = malloc(outcap);
-    if(!buffer){
+    return off == file.len;
+}
+
+
+/* A front-coded list stores each name as the number of leading bytes it
+   shares with the name before it, a space, and the rest of the name.  Sorted
+   lists of deep paths shrink several-fold.  findglob --front-coded writes
+   them, --front-coded reads them, and --store-front-coded writes OUTPUT that
+   way; manifest --decode turns one back into plain text. */
+
+// split a record into its shared length and suffix
+static bool fc_parse(
+    string_t rec, size_t prev_len, size_t *shared, string_t *suffix
+){
+    size_t n = 0;
+    size_t i = 0;
+    for(; i < rec.len && rec.text[i] >= '0' && rec.text[i] <= '9'; i++){
+        if(n > prev_len) return false;
+        n = n * 10 + (size_t)(rec.text[i] - '0');
+    }
+    if(i == 0 || i == rec.len || rec.text[i] != ' ' || n > prev_len){
+        return false;
+    }
+    *shared = n;
+    *suffix = (string_t){ .text = &rec.text[i+1], .len = rec.len - i - 1 };
+    return true;
+}
+
+/* decode a list of front-coded records in place; each name then points into
+   *buf, nul-terminated, which the caller frees.  Empty names are dropped,
+   as split() drops empty lines. */
+int fc_decode(string_t *names, size_t *names_len, char **buf){
+    *buf = NULL;
+    size_t total = 0;
+    size_t prev_len = 0;
+    for(size_t i = 0; i < *names_len; i++){
+        size_t shared;
+        string_t suffix;
+        if(!fc_parse(names[i], prev_len, &shared, &suffix)){
+            fprintf(
+                stderr, "invalid front-coded line: %.*s\n",
+                (int)names[i].len, names[i].text
+            );
+            return 1;
+        }
+        prev_len = shared + suffix.len;
+        total += prev_len + 1;
+    }
+    *buf = malloc(total ? total : 1);
+    if(!*buf){
+        perror("malloc");
+        return 1;
+    }
+
+    char *out = *buf;
+    string_t prev = {0};
+    size_t n = 0;
+    for(size_t i = 0; i < *names_len; i++){
+        // already validated above
+        size_t shared = 0;
+        string_t suffix = {0};
+        fc_parse(names[i], prev.len, &shared, &suffix);
+        if(shared) memcpy(out, prev.text, shared);
+        memcpy(&out[shared], suffix.text, suffix.len);
+        prev = (string_t){ .text = out, .len = shared + suffix.len };
+        out[prev.len] = '\0';
+        out += prev.len + 1;
+        if(prev.len) names[n++] = prev;
+    }
+    *names_len = n;
+    return 0;
+}
+
+/* --store-front-coded: encode names as the records which write_file() and
+   file_eq() then handle like any other lines; the records point into *buf,
+   which the caller frees */
+int fc_encode(
+    const string_t *names, size_t names_len, string_t **recs, char **buf
+){
+    *recs = malloc((names_len ? names_len : 1) * sizeof(**recs));
+    size_t total = 0;
+    for(size_t i = 0; i < names_len; i++) total += names[i].len + 24;
+    *buf = malloc(total ? total : 1);
+    if(!*recs || !*buf){
         perror("malloc");
+        free(*recs);
+        free(*buf);
+        *recs = NULL;
+        *buf = NULL;
         return 1;
     }
+    char *out = *buf;
+    string_t prev = {0};
+    for(size_t i = 0; i < names_len; i++){
+        string_t name = names[i];
+        size_t shared = 0;
+        while(
+            shared < prev.len && shared < name.len
+            && prev.text[shared] == name.text[shared]
+        ){
+            shared++;
+        }
+        int n = sprintf(out, "%zu ", shared);
+        memcpy(&out[n], &name.text[shared], name.len - shared);
+        (*recs)[i] = (string_t){ .text = out, .len = n + name.len - shared };
+        out += (*recs)[i].len;
+        prev = name;
+    }
+    return 0;
+}
 
-    // write all the names into the buffer
+/* decode a whole front-coded file, one record per line, into the plain text
+   write_file() would have written */
+int fc_decode_text(string_t text, string_t *out){
+    *out = (string_t){0};
+    // the previous name, as an offset into buf, which may move
+    size_t prev_off = 0;
+    size_t prev_len = 0;
+    size_t cap = 2 * text.len + 1;
+    char *buf = malloc(cap);
+    if(!buf){
+        perror("malloc");
+        return 1;
+    }
     size_t len = 0;
-    for(size_t i = 0; i < n; i++){
-        size_t limit = outcap - len;
-        size_t written = snprintf(&buffer[len], limit, "%s\n", names[i].text);
-        if(written >= limit){
-            // only possible with an arithmetic error
-            fprintf(stderr, "join_names overran its buffer!\n");
-            free(buffer);
+    for(size_t off = 0; off < text.len;){
+        const char *nl = memchr(&text.text[off], '\n', text.len - off);
+        size_t end = nl ? (size_t)(nl - text.text) : text.len;
+        string_t rec = { .text = &text.text[off], .len = end - off };
+        off = end + 1;
+        if(!rec.len) continue;
+        size_t shared;
+        string_t suffix;
+        if(!fc_parse(rec, prev_len, &shared, &suffix)){
+            fprintf(
+                stderr, "invalid front-coded line: %.*s\n",
+                (int)rec.len, rec.text
+            );
+            free(buf);
             return 1;
         }
-        len += written;
+        size_t need = len + shared + suffix.len + 1;
+        if(need > cap){
+            cap = need * 2;
+            char *temp = realloc(buf, cap);
+            if(!temp){
+                perror("realloc");
+                free(buf);
+                return 1;
+            }
+            buf = temp;
+        }
+        memmove(&buf[len], &buf[prev_off], shared);
+        memcpy(&buf[len + shared], suffix.text, suffix.len);
+        prev_off = len;
+        prev_len = shared + suffix.len;
+        len += prev_len;
+        buf[len++] = '\n';
     }
-
-    *out = (string_t){ .len=len, .text=buffer };
+    *out = (string_t){ .text = buf, .len = len };
     return 0;
 }
 
 
-int manifest(const char *output, char *sep_cstr){
-    int retval = 0;
-    string_t in = {0};
-    string_t *names = NULL;
-    size_t names_len = 0;
-    string_t sorted = {0};
-    string_t old = {0};
+#ifndef _WIN32 // UNIX
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+typedef pthread_t thread_t;
 
-    // read the list of names from stdin
-    retval = read_stream(stdin, &in);
-    fclose(stdin);
-    if(retval) goto cu;
+static void mutex_init(mutex_t *m){ pthread_mutex_init(m, NULL); }
+static void mutex_free(mutex_t *m){ pthread_mutex_destroy(m); }
+static void mutex_lock(mutex_t *m){ pthread_mutex_lock(m); }
+static void mutex_unlock(mutex_t *m){ pthread_mutex_unlock(m); }
 
-    char buffer[3];
-    string_t sep;
-    if(sep_cstr){
-        sep = (string_t){
-            .text = sep_cstr,
-            .len=sep_cstr[0] == '\0' ? 1 : strlen(sep_cstr),
-        };
-    }else{
-        sep = detect_endings(in, buffer);
+static void cond_init(cond_t *c){ pthread_cond_init(c, NULL); }
+static void cond_free(cond_t *c){ pthread_cond_destroy(c); }
+static void cond_wait(cond_t *c, mutex_t *m){ pthread_cond_wait(c, m); }
+static void cond_broadcast(cond_t *c){ pthread_cond_broadcast(c); }
+#else // WINDOWS
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+typedef HANDLE thread_t;
+
+static void mutex_init(mutex_t *m){ InitializeCriticalSection(m); }
+static void mutex_free(mutex_t *m){ DeleteCriticalSection(m); }
+static void mutex_lock(mutex_t *m){ EnterCriticalSection(m); }
+static void mutex_unlock(mutex_t *m){ LeaveCriticalSection(m); }
+
+static void cond_init(cond_t *c){ InitializeConditionVariable(c); }
+static void cond_free(cond_t *c){ (void)c; }
+static void cond_wait(cond_t *c, mutex_t *m){
+    SleepConditionVariableCS(c, m, INFINITE);
+}
+static void cond_broadcast(cond_t *c){ WakeAllConditionVariable(c); }
+#endif
+
+typedef struct {
+    void (*fn)(void*);
+    void *arg;
+} worker_t;
+
+#ifndef _WIN32 // UNIX
+static void *thread_main(void *arg){
+    worker_t *w = arg;
+    w->fn(w->arg);
+    return NULL;
+}
+
+static int thread_start(thread_t *t, worker_t *w){
+    int ret = pthread_create(t, NULL, thread_main, w);
+    if(ret){
+        fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+        return 1;
+    }
+    return 0;
+}
+
+static void thread_join(thread_t t){
+    pthread_join(t, NULL);
+}
+#else // WINDOWS
+static DWORD WINAPI thread_main(LPVOID arg){
+    worker_t *w = arg;
+    w->fn(w->arg);
+    return 0;
+}
+
+static int thread_start(thread_t *t, worker_t *w){
+    *t = CreateThread(NULL, 0, thread_main, w, 0, NULL);
+    if(!*t){
+        win_perror("CreateThread");
+        return 1;
+    }
+    return 0;
+}
+
+static void thread_join(thread_t t){
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+#endif
+
+/* run fn(arg) on nthreads threads, including the calling thread, and wait for
+   them all.  fn must tolerate fewer threads than requested, since any thread
+   which fails to start is just skipped. */
+int run_workers(void (*fn)(void*), void *arg, size_t nthreads){
+    thread_t *threads = NULL;
+    if(nthreads > 1){
+        threads = malloc((nthreads - 1) * sizeof(*threads));
+        if(!threads){
+            perror("malloc");
+            return 1;
+        }
+    }
+    worker_t w = { .fn = fn, .arg = arg };
+    size_t started = 0;
+    for(; started + 1 < nthreads; started++){
+        if(thread_start(&threads[started], &w)) break;
+    }
+    fn(arg);
+    for(size_t i = 0; i < started; i++){
+        thread_join(threads[i]);
+    }
+    free(threads);
+    return 0;
+}
+
+
+/* --batch: the modification times found by every manifest in a batch are
+   shared, since many manifests list the same files.  The table is split into
+   stripes, each with its own lock, so that workers rarely wait on each
+   other.  Only successful results are kept; errors are always fresh. */
+#define STATCACHE_STRIPES 64
+
+typedef struct {
+    // NULL for an empty slot
+    char *path;
+    uint64_t hash;
+    filetime_t info;
+} stat_entry_t;
+
+typedef struct {
+    mutex_t lock;
+    stat_entry_t *entries;
+    size_t count;
+    // zero, or a power of two
+    size_t cap;
+} stat_stripe_t;
+
+typedef struct {
+    stat_stripe_t stripes[STATCACHE_STRIPES];
+} statcache_t;
+
+void statcache_init(statcache_t *c){
+    *c = (statcache_t){0};
+    for(size_t i = 0; i < STATCACHE_STRIPES; i++){
+        mutex_init(&c->stripes[i].lock);
+    }
+}
+
+void statcache_free(statcache_t *c){
+    for(size_t i = 0; i < STATCACHE_STRIPES; i++){
+        stat_stripe_t *s = &c->stripes[i];
+        for(size_t j = 0; j < s->cap; j++){
+            free(s->entries[j].path);
+        }
+        free(s->entries);
+        mutex_free(&s->lock);
+    }
+}
+
+// FNV-1a; the low bits pick the stripe, the rest the slot
+static uint64_t path_hash(const char *path){
+    uint64_t h = 0xcbf29ce484222325;
+    for(; *path; path++){
+        h ^= (unsigned char)*path;
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+// the slot which holds path, or the empty slot where it belongs
+static stat_entry_t *stripe_find(
+    stat_stripe_t *s, const char *path, uint64_t hash
+){
+    size_t mask = s->cap - 1;
+    size_t i = (size_t)(hash / STATCACHE_STRIPES) & mask;
+    while(true){
+        stat_entry_t *e = &s->entries[i];
+        if(!e->path) return e;
+        if(e->hash == hash && strcmp(e->path, path) == 0) return e;
+        i = (i + 1) & mask;
+    }
+}
+
+static int stripe_grow(stat_stripe_t *s){
+    size_t cap = s->cap ? s->cap * 2 : 256;
+    stat_entry_t *entries = calloc(cap, sizeof(*entries));
+    if(!entries) return 1;
+    stat_stripe_t grown = { .entries = entries, .cap = cap };
+    for(size_t i = 0; i < s->cap; i++){
+        stat_entry_t e = s->entries[i];
+        if(e.path) *stripe_find(&grown, e.path, e.hash) = e;
+    }
+    free(s->entries);
+    s->entries = entries;
+    s->cap = cap;
+    return 0;
+}
+
+/* like get_filetime_at(), but answered from the cache if the path was seen
+   already; cache may be NULL */
+int stat_cached(
+    statcache_t *cache, dircache_t *dc, const char *path, filetime_t *out
+){
+    if(!cache) return get_filetime_at(dc, path, out);
+    uint64_t hash = path_hash(path);
+    stat_stripe_t *s = &cache->stripes[hash % STATCACHE_STRIPES];
+    mutex_lock(&s->lock);
+    if(s->count){
+        stat_entry_t *e = stripe_find(s, path, hash);
+        if(e->path){
+            *out = e->info;
+            mutex_unlock(&s->lock);
+            return 0;
+        }
+    }
+    mutex_unlock(&s->lock);
+
+    // stat without the lock; a worker racing us just stats the path too
+    int ret = get_filetime_at(dc, path, out);
+    if(ret) return ret;
+    mutex_lock(&s->lock);
+    /* the cache only saves work, so a path which does not fit for want of
+       memory is just not cached */
+    if(s->count * 2 < s->cap || !stripe_grow(s)){
+        stat_entry_t *e = stripe_find(s, path, hash);
+        if(!e->path){
+            size_t len = strlen(path);
+            e->path = malloc(len + 1);
+            if(e->path){
+                memcpy(e->path, path, len + 1);
+                e->hash = hash;
+                e->info = *out;
+                s->count++;
+            }
+        }
+    }
+    mutex_unlock(&s->lock);
+    return 0;
+}
+
+
+// entries claimed by a worker at a time
+#define STAT_BATCH 16
+
+/* a pool of threads which stat the names concurrently, to hide the latency of
+   network filesystems; all workers stop as soon as any result is known */
+typedef struct {
+    const string_t *names;
+    size_t names_len;
+    filetime_t output_info;
+    statcache_t *cache;
+    size_t next;
+    // index of a newer name, or names_len
+    size_t newer;
+    /* when set, every name is checked and flagged, rather than stopping at
+       the first newer one */
+    bool *flags;
+    // when set, every name is checked and the newest mtime is kept
+    bool want_newest;
+    filetime_t newest;
+    /* --tolerant: when set, every name is checked, its mtime is kept, and a
+       vanished name is marked missing rather than being an error */
+    filetime_t *times;
+    bool *missing;
+    bool failed;
+    mutex_t lock;
+} stat_pool_t;
+
+static void stat_worker(void *arg){
+    stat_pool_t *pool = arg;
+    dircache_t dc = {0};
+    bool all = pool->flags || pool->want_newest || pool->times;
+    filetime_t newest = {0};
+    while(true){
+        // claim the next batch, unless somebody already has an answer
+        mutex_lock(&pool->lock);
+        bool done = pool->failed;
+        if(!all) done |= pool->newer < pool->names_len;
+        size_t start = pool->next;
+        size_t end = start + STAT_BATCH;
+        if(end > pool->names_len) end = pool->names_len;
+        pool->next = end;
+        mutex_unlock(&pool->lock);
+        if(done || start == end) break;
+
+        bool stop = false;
+        for(size_t i = start; i < end && !stop; i++){
+            filetime_t info;
+            const char *name = pool->names[i].text;
+            int ret = stat_cached(pool->cache, &dc, name, &info);
+            if(pool->times){
+                pool->missing[i] = ret == FILE_NOT_FOUND;
+                if(pool->missing[i]) continue;
+                if(!ret) pool->times[i] = info;
+            }
+            bool newer = !ret && isnewer(info, pool->output_info);
+            if(pool->flags) pool->flags[i] = newer;
+            if(!ret && isnewer(info, newest)) newest = info;
+            if(!ret && !newer) continue;
+            if(ret) compat_perror(pool->names[i].text);
+            mutex_lock(&pool->lock);
+            if(ret) pool->failed = true;
+            else if(pool->newer == pool->names_len) pool->newer = i;
+            mutex_unlock(&pool->lock);
+            stop = ret || !all;
+        }
+        if(stop) break;
+    }
+    if(pool->want_newest){
+        mutex_lock(&pool->lock);
+        if(isnewer(newest, pool->newest)) pool->newest = newest;
+        mutex_unlock(&pool->lock);
+    }
+    dircache_free(&dc);
+}
+
+/* stat every name with up to jobs threads; sets *newer to the index of a name
+   which is newer than output_info, or to names_len if there are none.  If
+   flags is not NULL, it is filled in for every name.  If newest is not NULL,
+   it is set to the newest modification time of any name.  cache is the
+   --batch stat cache, or NULL. */
+int any_newer(
+    const string_t *names,
+    size_t names_len,
+    filetime_t output_info,
+    int jobs,
+    statcache_t *cache,
+    size_t *newer,
+    bool *flags,
+    filetime_t *newest
+){
+    *newer = names_len;
+    stat_pool_t pool = {
+        .names = names,
+        .names_len = names_len,
+        .output_info = output_info,
+        .cache = cache,
+        .newer = names_len,
+        .flags = flags,
+        .want_newest = newest != NULL,
+    };
+
+    // no point in having threads with nothing to do
+    size_t nthreads = (size_t)jobs;
+    size_t maxthreads = (names_len + STAT_BATCH - 1) / STAT_BATCH;
+    if(nthreads > maxthreads) nthreads = maxthreads;
+
+    mutex_init(&pool.lock);
+    int retval = run_workers(stat_worker, &pool, nthreads);
+    mutex_free(&pool.lock);
+    if(retval) return retval;
+
+    *newer = pool.newer;
+    if(newest) *newest = pool.newest;
+    return pool.failed;
+}
+
+/* --tolerant: stat every name once with up to jobs threads, drop the names
+   which have vanished since they were listed, and return the modification
+   times of the survivors in *times, so nothing needs to be statted again;
+   done, if not NULL, sees each survivor in order */
+int stat_survivors(
+    string_t *names,
+    size_t *names_len,
+    int jobs,
+    statcache_t *cache,
+    filetime_t **times,
+    void (*done)(void*, const string_t*, size_t),
+    void *arg
+){
+    size_t n = *names_len;
+    *times = malloc((n ? n : 1) * sizeof(**times));
+    bool *missing = malloc((n ? n : 1) * sizeof(*missing));
+    if(!*times || !missing){
+        perror("malloc");
+        free(*times);
+        *times = NULL;
+        free(missing);
+        return 1;
+    }
+    stat_pool_t pool = {
+        .names = names,
+        .names_len = n,
+        .cache = cache,
+        .newer = n,
+        .times = *times,
+        .missing = missing,
+    };
+    size_t nthreads = (size_t)jobs;
+    size_t maxthreads = (n + STAT_BATCH - 1) / STAT_BATCH;
+    if(nthreads > maxthreads) nthreads = maxthreads;
+
+    mutex_init(&pool.lock);
+    int retval = run_workers(stat_worker, &pool, nthreads);
+    mutex_free(&pool.lock);
+    if(!retval) retval = pool.failed;
+    if(retval){
+        free(*times);
+        *times = NULL;
+        free(missing);
+        return retval;
+    }
+
+    // compact the survivors in place, which keeps them sorted
+    size_t kept = 0;
+    for(size_t i = 0; i < n; i++){
+        if(missing[i]) continue;
+        names[kept] = names[i];
+        (*times)[kept] = (*times)[i];
+        if(done) done(arg, &names[kept], 1);
+        kept++;
+    }
+    *names_len = kept;
+    free(missing);
+    return 0;
+}
+
+// find the first time newer than output_info, like any_newer()
+static size_t first_newer(
+    const filetime_t *times,
+    size_t len,
+    filetime_t output_info,
+    filetime_t *newest
+){
+    size_t newer = len;
+    filetime_t max = {0};
+    for(size_t i = 0; i < len; i++){
+        if(newer == len && isnewer(times[i], output_info)){
+            newer = i;
+            if(!newest) break;
+        }
+        if(isnewer(times[i], max)) max = times[i];
+    }
+    if(newest) *newest = max;
+    return newer;
+}
+
+
+// below this size, a range is insertion sorted
+#define RADIX_SMALL 32
+// lists at least this long are sorted by multiple threads, if allowed
+#define RADIX_PARALLEL 1000000
+// in parallel sorting, ranges below this size are finished by one thread
+#define RADIX_GRAIN 65536
+
+// a range of strings which share their first depth bytes
+typedef struct {
+    size_t start;
+    size_t n;
+    size_t depth;
+} sort_task_t;
+
+typedef struct {
+    sort_task_t *tasks;
+    size_t len;
+    size_t cap;
+} sort_stack_t;
+
+static int sort_push(sort_stack_t *stack, sort_task_t task){
+    if(stack->len == stack->cap){
+        size_t cap = stack->cap ? stack->cap * 2 : 256;
+        sort_task_t *temp = realloc(stack->tasks, cap * sizeof(*temp));
+        if(!temp){
+            perror("realloc");
+            return 1;
+        }
+        stack->tasks = temp;
+        stack->cap = cap;
+    }
+    stack->tasks[stack->len++] = task;
+    return 0;
+}
+
+// 0 for the end of the string, otherwise the byte at depth plus one
+static unsigned radix_key(string_t s, size_t depth){
+    return depth < s.len ? (unsigned)(unsigned char)s.text[depth] + 1 : 0;
+}
+
+// bytewise comparison, ignoring the first depth bytes (which are equal)
+static int cmp_from(string_t a, string_t b, size_t depth){
+    size_t n = (a.len < b.len ? a.len : b.len) - depth;
+    int cmp = memcmp(a.text + depth, b.text + depth, n);
+    if(cmp) return cmp;
+    if(a.len < b.len) return -1;
+    return (int)(b.len < a.len);
+}
+
+static void insertion_sort(string_t *a, size_t n, size_t depth){
+    for(size_t i = 1; i < n; i++){
+        string_t x = a[i];
+        size_t j = i;
+        for(; j > 0 && cmp_from(x, a[j-1], depth) < 0; j--){
+            a[j] = a[j-1];
+        }
+        a[j] = x;
+    }
+}
+
+/* distribute one range into buckets by the byte at its depth, via tmp, and
+   call push() for each bucket which still needs sorting */
+static int radix_split(
+    string_t *a,
+    string_t *tmp,
+    sort_task_t task,
+    int (*push)(void*, sort_task_t),
+    void *arg
+){
+    string_t *x = &a[task.start];
+    size_t counts[257];
+    while(true){
+        memset(counts, 0, sizeof(counts));
+        for(size_t i = 0; i < task.n; i++){
+            counts[radix_key(x[i], task.depth)]++;
+        }
+        // strings ending here are all equal, so they are done
+        if(counts[0] == task.n) return 0;
+        // skip over shared prefixes without moving anything
+        if(counts[radix_key(x[0], task.depth)] != task.n) break;
+        task.depth++;
+    }
+
+    size_t offsets[257];
+    size_t sum = 0;
+    for(size_t k = 0; k < 257; k++){
+        offsets[k] = sum;
+        sum += counts[k];
+    }
+    string_t *y = &tmp[task.start];
+    for(size_t i = 0; i < task.n; i++){
+        y[offsets[radix_key(x[i], task.depth)]++] = x[i];
+    }
+    memcpy(x, y, task.n * sizeof(*x));
+
+    // buckets are pushed from the last, so a stack pops them in order
+    size_t end = task.start + task.n;
+    for(size_t k = 256; k > 0; k--){
+        end -= counts[k];
+        if(counts[k] > 1){
+            sort_task_t sub = {
+                .start = end, .n = counts[k], .depth = task.depth + 1,
+            };
+            int retval = push(arg, sub);
+            if(retval) return retval;
+        }
+    }
+    return 0;
+}
+
+static int push_local(void *arg, sort_task_t task){
+    return sort_push(arg, task);
+}
+
+/* sort one range completely on the calling thread; if done is not NULL,
+   the range is passed to it in order, a piece at a time, as each piece
+   reaches its final place */
+static int radix_sort_task(
+    string_t *a,
+    string_t *tmp,
+    sort_task_t task,
+    void (*done)(void*, const string_t*, size_t),
+    void *arg
+){
+    sort_stack_t stack = {0};
+    // ranges are popped in order, so everything before the next is final
+    size_t final = task.start;
+    int retval = sort_push(&stack, task);
+    while(!retval && stack.len){
+        sort_task_t t = stack.tasks[--stack.len];
+        if(done && t.start > final){
+            done(arg, &a[final], t.start - final);
+            final = t.start;
+        }
+        if(t.n < RADIX_SMALL){
+            insertion_sort(&a[t.start], t.n, t.depth);
+            continue;
+        }
+        retval = radix_split(a, tmp, t, push_local, &stack);
+    }
+    free(stack.tasks);
+    if(!retval && done) done(arg, &a[final], task.start + task.n - final);
+    return retval;
+}
+
+/* shared state for parallel sorting: large ranges are split and their buckets
+   are pushed back for any thread to take, small ranges are finished by
+   whichever thread takes them */
+typedef struct {
+    string_t *a;
+    string_t *tmp;
+    sort_stack_t stack;
+    // how many threads are splitting a range, and might push more work
+    size_t active;
+    bool failed;
+    mutex_t lock;
+    cond_t cond;
+} sort_pool_t;
+
+static int push_shared(void *arg, sort_task_t task){
+    sort_pool_t *pool = arg;
+    mutex_lock(&pool->lock);
+    int retval = sort_push(&pool->stack, task);
+    cond_broadcast(&pool->cond);
+    mutex_unlock(&pool->lock);
+    return retval;
+}
+
+static void sort_worker(void *arg){
+    sort_pool_t *pool = arg;
+    mutex_lock(&pool->lock);
+    while(true){
+        while(!pool->stack.len && pool->active && !pool->failed){
+            cond_wait(&pool->cond, &pool->lock);
+        }
+        if(!pool->stack.len || pool->failed) break;
+        sort_task_t task = pool->stack.tasks[--pool->stack.len];
+        pool->active++;
+        mutex_unlock(&pool->lock);
+
+        int retval;
+        if(task.n < RADIX_GRAIN){
+            retval = radix_sort_task(
+                pool->a, pool->tmp, task, NULL, NULL
+            );
+        }else{
+            retval = radix_split(pool->a, pool->tmp, task, push_shared, pool);
+        }
+
+        mutex_lock(&pool->lock);
+        if(retval) pool->failed = true;
+        pool->active--;
+        // wake anybody waiting to see if the work is all done
+        if(!pool->active) cond_broadcast(&pool->cond);
+    }
+    // let the other workers see that we are done
+    cond_broadcast(&pool->cond);
+    mutex_unlock(&pool->lock);
+}
+
+/* sort strings bytewise with an MSD radix sort, using up to jobs threads for
+   large lists; if done is not NULL, it sees every string in sorted order */
+int radix_sort(
+    string_t *names,
+    size_t names_len,
+    int jobs,
+    void (*done)(void*, const string_t*, size_t),
+    void *arg
+){
+    if(names_len < 2){
+        if(done) done(arg, names, names_len);
+        return 0;
+    }
+    string_t *tmp = malloc(names_len * sizeof(*tmp));
+    if(!tmp){
+        perror("malloc");
+        return 1;
+    }
+    sort_task_t all = { .start = 0, .n = names_len, .depth = 0 };
+    int retval;
+    if(jobs < 2 || names_len < RADIX_PARALLEL){
+        retval = radix_sort_task(names, tmp, all, done, arg);
+    }else{
+        sort_pool_t pool = { .a = names, .tmp = tmp };
+        mutex_init(&pool.lock);
+        cond_init(&pool.cond);
+        retval = sort_push(&pool.stack, all);
+        if(!retval) retval = run_workers(sort_worker, &pool, (size_t)jobs);
+        if(!retval) retval = pool.failed;
+        cond_free(&pool.cond);
+        mutex_free(&pool.lock);
+        free(pool.stack.tasks);
+        // threads finish ranges out of order, so done sees them afterwards
+        if(!retval && done) done(arg, names, names_len);
+    }
+    free(tmp);
+    return retval;
+}
+
+// an O(n) check to avoid sorting input that is already in order
+bool is_sorted(const string_t *names, size_t names_len){
+    for(size_t i = 1; i < names_len; i++){
+        if(cmp_from(names[i-1], names[i], 0) > 0) return false;
+    }
+    return true;
+}
+
+// the next unmerged string of each run, kept as a binary min-heap
+typedef struct {
+    const string_t *next;
+    const string_t *end;
+} run_t;
+
+static void heap_down(run_t *heap, size_t n, size_t i){
+    while(true){
+        size_t min = i;
+        size_t l = 2*i + 1;
+        size_t r = l + 1;
+        if(l < n && cmp_from(*heap[l].next, *heap[min].next, 0) < 0) min = l;
+        if(r < n && cmp_from(*heap[r].next, *heap[min].next, 0) < 0) min = r;
+        if(min == i) return;
+        run_t temp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = temp;
+        i = min;
+    }
+}
+
+/* merge several sorted lists of names in one pass; out must have room for all
+   of them, and done, if not NULL, sees each name as it is merged */
+int merge_runs(
+    string_t **runs,
+    const size_t *lens,
+    size_t nruns,
+    string_t *out,
+    void (*done)(void*, const string_t*, size_t),
+    void *arg
+){
+    run_t *heap = malloc(nruns * sizeof(*heap));
+    if(!heap){
+        perror("malloc");
+        return 1;
+    }
+    size_t n = 0;
+    for(size_t i = 0; i < nruns; i++){
+        if(!lens[i]) continue;
+        heap[n++] = (run_t){ .next = runs[i], .end = runs[i] + lens[i] };
+    }
+    for(size_t i = n; i > 0; i--){
+        heap_down(heap, n, i - 1);
+    }
+    size_t len = 0;
+    while(n){
+        out[len] = *heap[0].next++;
+        if(done) done(arg, &out[len], 1);
+        len++;
+        if(heap[0].next == heap[0].end) heap[0] = heap[--n];
+        heap_down(heap, n, 0);
+    }
+    free(heap);
+    return 0;
+}
+
+// drop adjacent duplicates from a sorted list
+size_t dedupe(string_t *names, size_t names_len){
+    if(!names_len) return 0;
+    size_t out = 1;
+    for(size_t i = 1; i < names_len; i++){
+        if(string_eq(names[i], names[out-1])) continue;
+        names[out++] = names[i];
+    }
+    return out;
+}
+
+
+// most hot entries we keep
+#define HOT_MAX 32
+
+/* the hot set is a sidecar file next to the output listing, most recent first,
+   the names which caused the output to be touched.  Those are the files being
+   actively edited, so they are checked before anything else.  Each entry is
+   \0-terminated, so that entries are valid c-strings inside the mapping. */
+typedef struct {
+    mapping_t map;
+    string_t names[HOT_MAX];
+    size_t len;
+} hot_t;
+
+// a missing or malformed sidecar is just an empty hot set
+int hot_load(const char *path, hot_t *hot){
+    *hot = (hot_t){0};
+    filetime_t unused;
+    int ret = get_filetime(path, &unused);
+    if(ret == FILE_NOT_FOUND) return 0;
+    if(ret){
+        compat_perror(path);
+        return 1;
+    }
+    int retval = map_file(path, false, &hot->map);
+    if(retval) return retval;
+    string_t text = hot->map.text;
+    size_t start = 0;
+    while(start < text.len && hot->len < HOT_MAX){
+        const char *end = memchr(&text.text[start], '\0', text.len - start);
+        // ignore an unterminated entry
+        if(!end) break;
+        size_t len = (size_t)(end - &text.text[start]);
+        if(len){
+            hot->names[hot->len++] = (string_t){
+                .text=&text.text[start], .len=len,
+            };
+        }
+        start += len + 1;
+    }
+    return 0;
+}
+
+// returns the index of name in the sorted names list, or names_len
+static size_t find_name(string_t name, const string_t *names, size_t names_len){
+    const string_t *found = bsearch(
+        &name, names, names_len, sizeof(*names), cmp_string
+    );
+    return found ? (size_t)(found - names) : names_len;
+}
+
+/* stat the hot entries which are still in the names list; sets *newer like
+   any_newer() does */
+int hot_check(
+    const hot_t *hot,
+    const string_t *names,
+    size_t names_len,
+    filetime_t output_info,
+    size_t *newer
+){
+    *newer = names_len;
+    for(size_t i = 0; i < hot->len; i++){
+        size_t idx = find_name(hot->names[i], names, names_len);
+        if(idx == names_len) continue;
+        filetime_t info;
+        int ret = get_filetime(names[idx].text, &info);
+        if(ret){
+            compat_perror(names[idx].text);
+            return 1;
+        }
+        if(isnewer(info, output_info)){
+            *newer = idx;
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// move trigger to the front of the hot set and rewrite the sidecar
+int hot_save(
+    const char *path,
+    const hot_t *hot,
+    string_t trigger,
+    const string_t *names,
+    size_t names_len
+){
+    string_t out[HOT_MAX];
+    size_t count = 0;
+    out[count++] = trigger;
+    for(size_t i = 0; i < hot->len && count < HOT_MAX; i++){
+        string_t name = hot->names[i];
+        if(string_eq(name, trigger)) continue;
+        // forget entries which are no longer in the manifest
+        if(find_name(name, names, names_len) == names_len) continue;
+        out[count++] = name;
+    }
+    return write_file(path, out, count, '\0');
+}
+
+// XXH64, by Yann Collet (github.com/Cyan4973/xxHash), from its specification
+
+#define XXH_P1 0x9E3779B185EBCA87ULL
+#define XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH_P3 0x165667B19E3779F9ULL
+#define XXH_P4 0x85EBCA77C2B2AE63ULL
+#define XXH_P5 0x27D4EB2F165667C5ULL
+
+typedef struct {
+    uint64_t v[4];
+    uint64_t total;
+    unsigned char buf[32];
+    size_t buflen;
+} xxh64_t;
+
+static uint64_t rotl64(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const unsigned char *p){
+    uint64_t out = 0;
+    for(int i = 7; i >= 0; i--) out = (out << 8) | p[i];
+    return out;
+}
+
+static uint32_t read32(const unsigned char *p){
+    uint32_t out = 0;
+    for(int i = 3; i >= 0; i--) out = (out << 8) | p[i];
+    return out;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input){
+    acc += input * XXH_P2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_P1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, uint64_t v){
+    acc ^= xxh64_round(0, v);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+static void xxh64_init(xxh64_t *x, uint64_t seed){
+    *x = (xxh64_t){
+        .v = { seed + XXH_P1 + XXH_P2, seed + XXH_P2, seed, seed - XXH_P1 },
+    };
+}
+
+static void xxh64_stripe(xxh64_t *x, const unsigned char *p){
+    for(int i = 0; i < 4; i++){
+        x->v[i] = xxh64_round(x->v[i], read64(p + 8*i));
+    }
+}
+
+static void xxh64_update(xxh64_t *x, const unsigned char *p, size_t len){
+    x->total += len;
+    // finish a partial stripe
+    if(x->buflen){
+        size_t n = 32 - x->buflen;
+        if(n > len) n = len;
+        memcpy(x->buf + x->buflen, p, n);
+        x->buflen += n;
+        p += n;
+        len -= n;
+        if(x->buflen < 32) return;
+        xxh64_stripe(x, x->buf);
+        x->buflen = 0;
+    }
+    for(; len >= 32; p += 32, len -= 32){
+        xxh64_stripe(x, p);
+    }
+    memcpy(x->buf, p, len);
+    x->buflen = len;
+}
+
+static uint64_t xxh64_final(const xxh64_t *x){
+    uint64_t h;
+    if(x->total >= 32){
+        h = rotl64(x->v[0], 1) + rotl64(x->v[1], 7)
+            + rotl64(x->v[2], 12) + rotl64(x->v[3], 18);
+        for(int i = 0; i < 4; i++) h = xxh64_merge(h, x->v[i]);
+    }else{
+        // no stripes were consumed, so v[2] still holds the seed
+        h = x->v[2] + XXH_P5;
+    }
+    h += x->total;
+    const unsigned char *p = x->buf;
+    size_t len = x->buflen;
+    for(; len >= 8; p += 8, len -= 8){
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * XXH_P1 + XXH_P4;
+    }
+    if(len >= 4){
+        h ^= (uint64_t)read32(p) * XXH_P1;
+        h = rotl64(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+        len -= 4;
+    }
+    for(; len; p++, len--){
+        h ^= *p * XXH_P5;
+        h = rotl64(h, 11) * XXH_P1;
+    }
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+// end of XXH64
+
+int hash_file(const char *path, uint64_t *out){
+    *out = 0;
+    FILE *f = fopen(path, "rb");
+    if(!f) return 1;
+    xxh64_t x;
+    xxh64_init(&x, 0);
+    unsigned char buf[65536];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), f)) > 0){
+        xxh64_update(&x, buf, n);
+    }
+    int retval = ferror(f) != 0;
+    fclose(f);
+    *out = xxh64_final(&x);
+    return retval;
+}
+
+/* The hash cache is a sidecar next to the output which remembers, for each
+   name, the content digest it had when the output was last brought up to
+   date, and the stat information it had when that digest was computed.  It
+   is a header, an array of hash_rec_t in the order of the names, then the
+   text of the names. */
+
+#define HASH_MAGIC "mfhash01"
+
+typedef struct {
+    char magic[8];
+    uint64_t count;
+} hash_header_t;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtime[2];
+    uint64_t digest;
+    // offset and length of the name, relative to the text after the records
+    uint64_t name_off;
+    uint64_t name_len;
+} hash_rec_t;
+
+typedef struct {
+    mapping_t map;
+    const hash_rec_t *recs;
+    size_t count;
+    const char *text;
+    size_t text_len;
+} hash_cache_t;
+
+// a missing or malformed cache is just an empty one
+int hash_cache_load(const char *path, hash_cache_t *cache){
+    *cache = (hash_cache_t){0};
+    filetime_t unused;
+    int ret = get_filetime(path, &unused);
+    if(ret == FILE_NOT_FOUND) return 0;
+    if(ret){
+        compat_perror(path);
+        return 1;
+    }
+    int retval = map_file(path, true, &cache->map);
+    if(retval) return retval;
+
+    string_t text = cache->map.text;
+    hash_header_t h;
+    if(text.len < sizeof(h)) return 0;
+    memcpy(&h, text.text, sizeof(h));
+    if(memcmp(h.magic, HASH_MAGIC, sizeof(h.magic))) return 0;
+    size_t avail = (text.len - sizeof(h)) / sizeof(hash_rec_t);
+    if(h.count > avail) return 0;
+    size_t count = (size_t)h.count;
+    const char *recs = text.text + sizeof(h);
+    const char *names = recs + count * sizeof(hash_rec_t);
+    size_t names_len = text.len - sizeof(h) - count * sizeof(hash_rec_t);
+    // the mapping is page-aligned and the header is 16 bytes
+    const hash_rec_t *r = (const hash_rec_t*)recs;
+    for(size_t i = 0; i < count; i++){
+        if(r[i].name_off > names_len) return 0;
+        if(r[i].name_len > names_len - r[i].name_off) return 0;
+    }
+    cache->recs = r;
+    cache->count = count;
+    cache->text = names;
+    cache->text_len = names_len;
+    return 0;
+}
+
+static string_t rec_name(const hash_cache_t *cache, const hash_rec_t *rec){
+    return (string_t){
+        .text = (char*)cache->text + rec->name_off,
+        .len = (size_t)rec->name_len,
+    };
+}
+
+// records are written in sorted order, so this is a binary search
+static const hash_rec_t *hash_cache_find(
+    const hash_cache_t *cache, string_t name
+){
+    size_t lo = 0;
+    size_t hi = cache->count;
+    while(lo < hi){
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = cmp_from(rec_name(cache, &cache->recs[mid]), name, 0);
+        if(cmp == 0) return &cache->recs[mid];
+        if(cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+typedef struct {
+    const string_t *names;
+    size_t names_len;
+    const hash_cache_t *cache;
+    filetime_t output_info;
+    // one record per name, except for the name offsets
+    hash_rec_t *recs;
+    size_t next;
+    // some digest differs from what the output was built with
+    bool changed;
+    // the cache needs to be rewritten
+    bool dirty;
+    bool failed;
+    mutex_t lock;
+} hash_pool_t;
+
+static void hash_worker(void *arg){
+    hash_pool_t *pool = arg;
+    while(true){
+        mutex_lock(&pool->lock);
+        bool done = pool->failed;
+        size_t start = pool->next;
+        size_t end = start + STAT_BATCH;
+        if(end > pool->names_len) end = pool->names_len;
+        pool->next = end;
+        mutex_unlock(&pool->lock);
+        if(done || start == end) return;
+
+        bool changed = false;
+        bool dirty = false;
+        for(size_t i = start; i < end; i++){
+            const char *name = pool->names[i].text;
+            fileid_t id;
+            if(get_fileid(name, &id)){
+                compat_perror(name);
+                mutex_lock(&pool->lock);
+                pool->failed = true;
+                mutex_unlock(&pool->lock);
+                return;
+            }
+            hash_rec_t *rec = &pool->recs[i];
+            *rec = (hash_rec_t){ .dev=id.dev, .ino=id.ino, .size=id.size };
+            filetime_pack(id.mtime, rec->mtime);
+            const hash_rec_t *old = hash_cache_find(
+                pool->cache, pool->names[i]
+            );
+            if(
+                old && old->dev == rec->dev && old->ino == rec->ino
+                && old->size == rec->size && old->mtime[0] == rec->mtime[0]
+                && old->mtime[1] == rec->mtime[1]
+            ){
+                // unchanged since it was last hashed
+                rec->digest = old->digest;
+                continue;
+            }
+            dirty = true;
+            if(hash_file(name, &rec->digest)){
+                compat_perror(name);
+                mutex_lock(&pool->lock);
+                pool->failed = true;
+                mutex_unlock(&pool->lock);
+                return;
+            }
+            if(old){
+                changed |= rec->digest != old->digest;
+            }else{
+                // never hashed before, so fall back to the modification time
+                changed |= isnewer(id.mtime, pool->output_info);
+            }
+        }
+        mutex_lock(&pool->lock);
+        pool->changed |= changed;
+        pool->dirty |= dirty;
+        mutex_unlock(&pool->lock);
+    }
+}
+
+int hash_cache_write(
+    const char *path, const string_t *names, size_t names_len, hash_rec_t *recs
+){
+    size_t off = 0;
+    for(size_t i = 0; i < names_len; i++){
+        recs[i].name_off = off;
+        recs[i].name_len = names[i].len;
+        off += names[i].len;
+    }
+
+    char *tmp;
+    FILE *f = temp_open(path, true, &tmp);
+    if(!f) return 1;
+    hash_header_t h = { .count = names_len };
+    memcpy(h.magic, HASH_MAGIC, sizeof(h.magic));
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    if(ok && names_len){
+        ok = fwrite(recs, sizeof(*recs), names_len, f) == names_len;
+    }
+    for(size_t i = 0; ok && i < names_len; i++){
+        ok = fwrite(names[i].text, 1, names[i].len, f) == names[i].len;
+    }
+    if(!ok){
+        perror(tmp);
+        temp_abort(f, tmp);
+        return 1;
+    }
+    return temp_commit(f, tmp, path);
+}
+
+/* hash every name whose stat information changed since it was last hashed,
+   with up to jobs threads; sets *changed if any content differs from when
+   the output was last brought up to date */
+int hash_check(
+    const char *cache_path,
+    const string_t *names,
+    size_t names_len,
+    filetime_t output_info,
+    int jobs,
+    bool *changed
+){
+    *changed = false;
+    hash_cache_t cache;
+    int retval = hash_cache_load(cache_path, &cache);
+    if(retval) return retval;
+
+    hash_pool_t pool = {
+        .names = names,
+        .names_len = names_len,
+        .cache = &cache,
+        .output_info = output_info,
+    };
+    pool.recs = malloc((names_len ? names_len : 1) * sizeof(*pool.recs));
+    if(!pool.recs){
+        perror("malloc");
+        retval = 1;
+        goto cu;
+    }
+
+    size_t nthreads = (size_t)jobs;
+    size_t maxthreads = (names_len + STAT_BATCH - 1) / STAT_BATCH;
+    if(nthreads > maxthreads) nthreads = maxthreads;
+    mutex_init(&pool.lock);
+    retval = run_workers(hash_worker, &pool, nthreads);
+    mutex_free(&pool.lock);
+    if(retval) goto cu;
+    if(pool.failed){
+        retval = 1;
+        goto cu;
+    }
+
+    // names which left the manifest also leave the cache
+    if(pool.dirty || cache.count != names_len){
+        unmap_file(&cache.map);
+        retval = hash_cache_write(cache_path, names, names_len, pool.recs);
+        if(retval) goto cu;
+    }
+    *changed = pool.changed;
+
+cu:
+    free(pool.recs);
+    unmap_file(&cache.map);
+    return retval;
+}
+
+/* The fingerprint is a sidecar next to the output which holds a 128-bit
+   digest of the list of names in the output (two XXH64 digests with
+   different seeds, which also differ between plain and front-coded outputs),
+   the number of names and bytes in the list, and the output's identity when
+   the fingerprint was written.  While the output's identity still matches,
+   the fingerprint can stand in for the output's text, and the old output
+   never needs to be read.  The new list's digest is computed by whichever
+   step puts the list in its final order, as the names pass through it. */
+
+#define FP_MAGIC "mffp0001"
+
+typedef struct {
+    char magic[8];
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t digest[2];
+    // the output's identity
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtime[2];
+} fingerprint_t;
+
+// a fingerprint being computed one name at a time
+typedef struct {
+    fingerprint_t fp;
+    xxh64_t x[2];
+    // with -u, a name equal to the last one is not added again
+    bool unique;
+    string_t last;
+} fingerprinter_t;
+
+void fingerprint_begin(fingerprinter_t *f, bool front_coded, bool unique){
+    *f = (fingerprinter_t){ .unique = unique };
+    memcpy(f->fp.magic, FP_MAGIC, sizeof(f->fp.magic));
+    uint64_t seed = front_coded ? 2 : 0;
+    xxh64_init(&f->x[0], seed);
+    xxh64_init(&f->x[1], seed + 1);
+}
+
+// add the next name of the list, as one line
+void fingerprint_add(fingerprinter_t *f, string_t name){
+    if(f->unique){
+        if(f->fp.count && string_eq(name, f->last)) return;
+        f->last = name;
+    }
+    for(int j = 0; j < 2; j++){
+        xxh64_update(&f->x[j], (unsigned char*)name.text, name.len);
+        xxh64_update(&f->x[j], (unsigned char*)"\n", 1);
+    }
+    f->fp.count++;
+    f->fp.bytes += name.len + 1;
+}
+
+void fingerprint_end(fingerprinter_t *f, fingerprint_t *fp){
+    *fp = f->fp;
+    fp->digest[0] = xxh64_final(&f->x[0]);
+    fp->digest[1] = xxh64_final(&f->x[1]);
+}
+
+// add a range of the list, for radix_sort() and the other steps which sort
+static void fingerprint_range(void *arg, const string_t *names, size_t n){
+    for(size_t i = 0; i < n; i++) fingerprint_add(arg, names[i]);
+}
+
+static void fingerprint_id(fingerprint_t *fp, fileid_t id){
+    fp->dev = id.dev;
+    fp->ino = id.ino;
+    fp->size = id.size;
+    filetime_pack(id.mtime, fp->mtime);
+}
+
+/* sets *trusted if the fingerprint at path describes the output as it is
+   now, in which case *old is the fingerprint of the list the output holds */
+int fingerprint_load(
+    const char *path, const char *output, fingerprint_t *old, bool *trusted
+){
+    *trusted = false;
+    filetime_t unused;
+    int ret = get_filetime(path, &unused);
+    if(ret == FILE_NOT_FOUND) return 0;
+    if(ret){
+        compat_perror(path);
+        return 1;
+    }
+    FILE *f = fopen(path, "rb");
+    if(!f){
+        perror(path);
+        return 1;
+    }
+    bool ok = fread(old, sizeof(*old), 1, f) == 1;
+    fclose(f);
+    // a short or malformed fingerprint is just an untrusted one
+    if(!ok || memcmp(old->magic, FP_MAGIC, sizeof(old->magic))) return 0;
+
+    fileid_t id;
+    if(get_fileid(output, &id)){
+        compat_perror(output);
+        return 1;
+    }
+    fingerprint_t now = *old;
+    fingerprint_id(&now, id);
+    *trusted = memcmp(&now, old, sizeof(now)) == 0;
+    return 0;
+}
+
+// record the output's current identity and write the fingerprint
+int fingerprint_save(const char *path, const char *output, fingerprint_t *fp){
+    fileid_t id;
+    if(get_fileid(output, &id)){
+        compat_perror(output);
+        return 1;
+    }
+    fingerprint_id(fp, id);
+    char *tmp;
+    FILE *f = temp_open(path, true, &tmp);
+    if(!f) return 1;
+    if(fwrite(fp, sizeof(*fp), 1, f) != 1){
+        perror(tmp);
+        temp_abort(f, tmp);
+        return 1;
+    }
+    return temp_commit(f, tmp, path);
+}
+
+typedef struct {
+    char *sep;
+    // input files, each with its own sorted list of names; "-" is stdin
+    char **inputs;
+    size_t ninputs;
+    bool presorted;
+    int jobs;
+    bool hot;
+    bool hash;
+    bool unique;
+    bool delta;
+    bool fingerprint;
+    bool exact_mtime;
+    // a memory budget in bytes, or 0 for none
+    size_t max_mem;
+    bool mfx;
+    bool mfx_stat;
+    // a number of OUTPUT.N shards to write, or 0 for just OUTPUT
+    size_t shards;
+    bool shard_by_dir;
+    // --front-coded input, and --store-front-coded OUTPUT
+    bool front_coded;
+    bool store_fc;
+    // drop names which vanished since they were listed
+    bool tolerant;
+    // a list of INPUT and OUTPUT pairs, for --batch
+    char *batch;
+    // within --batch, the shared stat cache and depfile
+    statcache_t *stats;
+    struct batch_dep_t *batch_dep;
+    char *depfile;
+    char *extra_deps;
+} opts_t;
+
+
+// write a path into a makefile-style depfile, as ninja parses it
+static int depfile_put(FILE *f, const char *prefix, string_t path){
+    if(prefix && fprintf(f, "%s/", prefix) < 0) return 1;
+    for(size_t i = 0; i < path.len; i++){
+        char c = path.text[i];
+        int ret;
+        if(c == ' ' || c == '#') ret = fprintf(f, "\\%c", c);
+        else if(c == '$') ret = fprintf(f, "$$");
+        else ret = putc(c, f);
+        if(ret < 0) return 1;
+    }
+    return 0;
+}
+
+/* A depfile for ninja names output, every name, and any extra paths.  Ninja
+   reads depfile paths relative to where it runs, which is not where we run,
+   so relative paths are made absolute. */
+typedef struct {
+    FILE *f;
+    char *tmp;
+    char *cwd;
+    bool ok;
+} depfile_t;
+
+int depfile_open(depfile_t *d, const char *path, const char *output){
+    *d = (depfile_t){0};
+    d->cwd = compat_getcwd();
+    if(!d->cwd) return 1;
+    d->f = temp_open(path, true, &d->tmp);
+    if(!d->f){
+        free(d->cwd);
+        return 1;
+    }
+    string_t out = { .text = (char*)output, .len = strlen(output) };
+    d->ok = !depfile_put(d->f, NULL, out) && fprintf(d->f, ":") > 0;
+    return 0;
+}
+
+void depfile_add(depfile_t *d, string_t dep){
+    d->ok = d->ok && fprintf(d->f, " \\\n  ") > 0;
+    d->ok = d->ok && !depfile_put(d->f, is_abs(dep.text) ? NULL : d->cwd, dep);
+}
+
+// commit the depfile, or just discard it if failed is set
+int depfile_close(depfile_t *d, const char *path, bool failed){
+    free(d->cwd);
+    d->ok = d->ok && putc('\n', d->f) != EOF;
+    if(!d->ok || failed){
+        if(!failed) perror(d->tmp);
+        temp_abort(d->f, d->tmp);
+        return 1;
+    }
+    return temp_commit(d->f, d->tmp, path);
+}
+
+// --batch --depfile: one depfile for the whole batch, shared by the workers
+typedef struct batch_dep_t {
+    depfile_t d;
+    mutex_t lock;
+} batch_dep_t;
+
+static void batch_dep_add(batch_dep_t *b, const string_t *names, size_t n){
+    mutex_lock(&b->lock);
+    for(size_t i = 0; i < n; i++) depfile_add(&b->d, names[i]);
+    mutex_unlock(&b->lock);
+}
+
+int write_depfile(
+    const char *path,
+    const char *output,
+    const string_t *names,
+    size_t names_len,
+    const string_t *extra,
+    size_t extra_len
+){
+    depfile_t d;
+    int retval = depfile_open(&d, path, output);
+    if(retval) return retval;
+    for(size_t i = 0; i < names_len; i++) depfile_add(&d, names[i]);
+    for(size_t i = 0; i < extra_len; i++) depfile_add(&d, extra[i]);
+    return depfile_close(&d, path, false);
+}
+
+
+// the path of a file which lives next to the output
+char *sidecar_path(const char *output, const char *suffix){
+    size_t outlen = strlen(output);
+    size_t suffixlen = strlen(suffix);
+    char *out = malloc(outlen + suffixlen + 1);
+    if(!out){
+        perror("malloc");
+        return NULL;
+    }
+    memcpy(out, output, outlen);
+    memcpy(&out[outlen], suffix, suffixlen + 1);
+    return out;
+}
+
+// set the output's mtime to *newest, or to now if newest is NULL
+static int touch(const char *output, const filetime_t *newest){
+    if(newest) return compat_set_mtime(output, *newest);
+    return compat_utime(output);
+}
+
+/* like write_file(), but leave path alone if it exists and either changed
+   is false or it holds that text already, so its mtime only moves when its
+   contents do */
+static int update_file(
+    const char *path, const string_t *strings, size_t n, char term, bool changed
+){
+    filetime_t unused;
+    int ret = get_filetime(path, &unused);
+    if(ret && ret != FILE_NOT_FOUND){
+        compat_perror(path);
+        return 1;
+    }
+    if(!ret){
+        if(!changed) return 0;
+        mapping_t m;
+        int retval = map_file(path, false, &m);
+        if(retval) return retval;
+        bool same = file_eq(m.text, strings, n, term);
+        unmap_file(&m);
+        if(same) return 0;
+    }
+    return write_file(path, strings, n, term);
+}
+
+/* --delta: write OUTPUT.added and OUTPUT.removed by walking the sorted names
+   against the old output (NULL if there was none), and OUTPUT.modified with
+   the names in both which are newer than the old output.  Sets *modified if
+   there were any of those, and *newest like any_newer() if it is not NULL.
+   If times is not NULL, it has the mtime of every name already. */
+int write_delta(
+    const char *output,
+    const string_t *names,
+    size_t names_len,
+    const filetime_t *times,
+    const mapping_t *old,
+    filetime_t output_info,
+    int jobs,
+    statcache_t *cache,
+    bool *modified,
+    filetime_t *newest
+){
+    int retval = 0;
+    *modified = false;
+    string_t text = old ? old->text : (string_t){0};
+    // the old output has one name per line
+    size_t old_len = 0;
+    for(size_t i = 0; i < text.len; old_len++){
+        const char *nl = memchr(&text.text[i], '\n', text.len - i);
+        i = nl ? (size_t)(nl - text.text) + 1 : text.len;
+    }
+
+    string_t *added = malloc((names_len + 1) * sizeof(*added));
+    string_t *removed = malloc((old_len + 1) * sizeof(*removed));
+    // names in both lists; the newer ones make up the modified list
+    string_t *both = malloc((names_len + 1) * sizeof(*both));
+    bool *flags = malloc((names_len + 1) * sizeof(*flags));
+    char *path = NULL;
+    if(!added || !removed || !both || !flags){
+        perror("malloc");
+        retval = 1;
+        goto cu;
+    }
+    size_t nadded = 0;
+    size_t nremoved = 0;
+    size_t nboth = 0;
+
+    size_t i = 0;
+    size_t off = 0;
+    while(i < names_len || off < text.len){
+        string_t line = {0};
+        if(off < text.len){
+            const char *nl = memchr(&text.text[off], '\n', text.len - off);
+            size_t end = nl ? (size_t)(nl - text.text) : text.len;
+            line = (string_t){ .text = &text.text[off], .len = end - off };
+        }
+        int cmp;
+        if(i == names_len) cmp = 1;
+        else if(off >= text.len) cmp = -1;
+        else cmp = cmp_from(names[i], line, 0);
+        if(cmp < 0){
+            added[nadded++] = names[i++];
+        }else if(cmp > 0){
+            removed[nremoved++] = line;
+            off += line.len + 1;
+        }else{
+            if(times) flags[nboth] = isnewer(times[i], output_info);
+            both[nboth++] = names[i++];
+            off += line.len + 1;
+        }
+    }
+
+    if(times){
+        if(newest) first_newer(times, names_len, output_info, newest);
+    }else{
+        size_t newer;
+        retval = any_newer(
+            both, nboth, output_info, jobs, cache, &newer, flags, newest
+        );
+        if(retval) goto cu;
+    }
+    // compact the modified names into the front of both
+    size_t nmodified = 0;
+    for(size_t j = 0; j < nboth; j++){
+        if(flags[j]) both[nmodified++] = both[j];
+    }
+    *modified = nmodified > 0;
+
+    /* a run which changes nothing leaves the files from the last change for
+       consumers to read, and only writes any which are missing */
+    bool changed = !old || nadded || nremoved || nmodified;
+    const char *suffixes[] = { ".added", ".removed", ".modified" };
+    const string_t *lists[] = { added, removed, both };
+    size_t lens[] = { nadded, nremoved, nmodified };
+    for(size_t j = 0; j < 3; j++){
+        path = sidecar_path(output, suffixes[j]);
+        if(!path){
+            retval = 1;
+            goto cu;
+        }
+        retval = update_file(path, lists[j], lens[j], '\n', changed);
+        if(retval) goto cu;
+        free(path);
+        path = NULL;
+    }
+
+cu:
+    free(path);
+    free(flags);
+    free(both);
+    free(removed);
+    free(added);
+    return retval;
+}
+
+
+// entries per block of an OUTPUT.mfx file
+#define MFX_BLOCK 64
+
+/* --mfx: write the names in the indexed binary format that mfx.h describes
+   and reads; with stat, every entry also has its file's size and mtime */
+int write_mfx(
+    const char *path, const string_t *names, size_t names_len, bool stat
+){
+    size_t nblocks = (names_len + MFX_BLOCK - 1) / MFX_BLOCK;
+    uint64_t *index = malloc((nblocks ? nblocks : 1) * sizeof(*index));
+    if(!index){
+        perror("malloc");
+        return 1;
+    }
+    size_t max_len = 0;
+    for(size_t i = 0; i < names_len; i++){
+        if(names[i].len > max_len) max_len = names[i].len;
+    }
+
+    char *tmp;
+    FILE *f = temp_open(path, true, &tmp);
+    if(!f){
+        free(index);
+        return 1;
+    }
+    // the header is written last, once the index offset is known
+    unsigned char header[MFX_HEADER_SIZE] = {0};
+    bool ok = fwrite(header, sizeof(header), 1, f) == 1;
+    uint64_t off = sizeof(header);
+    string_t prev = {0};
+    for(size_t i = 0; ok && i < names_len; i++){
+        string_t name = names[i];
+        size_t shared = 0;
+        if(i % MFX_BLOCK == 0){
+            index[i / MFX_BLOCK] = off;
+        }else{
+            size_t n = name.len < prev.len ? name.len : prev.len;
+            while(shared < n && name.text[shared] == prev.text[shared]){
+                shared++;
+            }
+        }
+        unsigned char buf[50];
+        size_t len = mfx_put_varint(buf, shared);
+        len += mfx_put_varint(&buf[len], name.len - shared);
+        ok = fwrite(buf, 1, len, f) == len;
+        size_t suffix = name.len - shared;
+        ok = ok && fwrite(&name.text[shared], 1, suffix, f) == suffix;
+        off += len + suffix;
+        if(ok && stat){
+            fileid_t id;
+            if(get_fileid(name.text, &id)){
+                compat_perror(name.text);
+                temp_abort(f, tmp);
+                free(index);
+                return 1;
+            }
+            int64_t sec;
+            uint32_t nsec;
+            filetime_unix(id.mtime, &sec, &nsec);
+            len = mfx_put_varint(buf, id.size);
+            len += mfx_put_varint(&buf[len], (uint64_t)sec);
+            len += mfx_put_varint(&buf[len], nsec);
+            ok = fwrite(buf, 1, len, f) == len;
+            off += len;
+        }
+        prev = name;
+    }
+    for(size_t i = 0; ok && i < nblocks; i++){
+        unsigned char buf[8];
+        mfx_put64(buf, index[i]);
+        ok = fwrite(buf, sizeof(buf), 1, f) == 1;
+    }
+    free(index);
+
+    memcpy(header, MFX_MAGIC, 8);
+    mfx_put64(&header[8], names_len);
+    mfx_put64(&header[16], nblocks);
+    mfx_put64(&header[24], MFX_BLOCK);
+    mfx_put64(&header[32], stat ? MFX_STAT : 0);
+    mfx_put64(&header[40], max_len);
+    mfx_put64(&header[48], off);
+    ok = ok && fseek(f, 0, SEEK_SET) == 0;
+    ok = ok && fwrite(header, sizeof(header), 1, f) == 1;
+    if(!ok){
+        perror(tmp);
+        temp_abort(f, tmp);
+        return 1;
+    }
+    return temp_commit(f, tmp, path);
+}
+
+// rewrite OUTPUT.mfx if OUTPUT was updated, or if it is missing
+int update_mfx(
+    const char *output,
+    const string_t *names,
+    size_t names_len,
+    bool stat,
+    bool updated
+){
+    char *path = sidecar_path(output, ".mfx");
+    if(!path) return 1;
+    int retval = 0;
+    filetime_t unused;
+    int ret = get_filetime(path, &unused);
+    if(ret && ret != FILE_NOT_FOUND){
+        compat_perror(path);
+        retval = 1;
+    }else if(ret || updated){
+        retval = write_mfx(path, names, names_len, stat);
+    }
+    free(path);
+    return retval;
+}
+
+
+int read_input(const char *path, string_t *out){
+    if(strcmp(path, "-") == 0){
+        int retval = read_stream(stdin, out);
+        fclose(stdin);
+        return retval;
+    }
+    *out = (string_t){0};
+    FILE *f = fopen(path, "r");
+    if(!f){
+        perror(path);
+        return 1;
+    }
+    int retval = read_stream(f, out);
+    fclose(f);
+    return retval;
+}
+
+
+// a reader's buffer for each of the sources being merged, at least
+#define READER_MIN 4096
+// names stat()ed at a time while merging
+#define SPILL_STAT_BATCH 4096
+
+/* A reader streams the strings of a file through a bounded buffer, for when
+   the whole list may not fit in memory.  Strings are split like split()
+   does, and each is nul-terminated in place and only valid until the next
+   call to reader_next(). */
+typedef struct {
+    FILE *f;
+    char *buf;
+    size_t cap;
+    // the unread part of buf
+    size_t start;
+    size_t len;
+    bool eof;
+    // empty until it is detected, if it was not given
+    string_t sep;
+    char sepbuf[3];
+} reader_t;
+
+int reader_open(reader_t *r, FILE *f, string_t sep, size_t cap){
+    *r = (reader_t){ .f = f, .sep = sep, .cap = cap };
+    r->buf = malloc(cap);
+    if(!r->buf){
+        perror("malloc");
+        return 1;
+    }
+    return 0;
+}
+
+void reader_close(reader_t *r){
+    if(r->f) fclose(r->f);
+    free(r->buf);
+    *r = (reader_t){0};
+}
+
+// keep the unread part, then read more after it
+static int reader_fill(reader_t *r){
+    memmove(r->buf, &r->buf[r->start], r->len - r->start);
+    r->len -= r->start;
+    r->start = 0;
+    // a string longer than the buffer grows it; always leave room for a \0
+    if(r->len + 1 >= r->cap){
+        char *buf = realloc(r->buf, r->cap * 2);
+        if(!buf){
+            perror("realloc");
+            return 1;
+        }
+        r->buf = buf;
+        r->cap *= 2;
+    }
+    size_t n = fread(&r->buf[r->len], 1, r->cap - r->len - 1, r->f);
+    r->len += n;
+    if(n == 0){
+        if(ferror(r->f)){
+            perror("fread");
+            return 1;
+        }
+        r->eof = true;
+    }
+    return 0;
+}
+
+// sets *out to the next string, or to an empty string at the end
+int reader_next(reader_t *r, string_t *out){
+    *out = (string_t){0};
+    size_t scan = r->start;
+    while(true){
+        if(!r->sep.len){
+            string_t text = {
+                .text = &r->buf[r->start], .len = r->len - r->start
+            };
+            size_t loc = find_ending(text);
+            // an ending at the end of the buffer could be half of \r\n
+            if(loc + 1 < text.len || r->eof){
+                r->sep = ending_at(text, loc, r->sepbuf);
+            }
+        }
+        while(r->sep.len && scan < r->len){
+            char *hit = memchr(&r->buf[scan], r->sep.text[0], r->len - scan);
+            if(!hit){
+                scan = r->len;
+                break;
+            }
+            size_t loc = (size_t)(hit - r->buf);
+            // a separator cut off by the end of the buffer needs more data
+            if(r->len - loc < r->sep.len && !r->eof){
+                scan = loc;
+                break;
+            }
+            if(memcmp(hit, r->sep.text, r->sep.len)){
+                scan = loc + 1;
+                continue;
+            }
+            size_t start = r->start;
+            r->start = loc + r->sep.len;
+            scan = r->start;
+            // empty strings are ignored
+            if(loc == start) continue;
+            r->buf[loc] = '\0';
+            *out = (string_t){ .text = &r->buf[start], .len = loc - start };
+            return 0;
+        }
+        if(r->eof){
+            // trailing string?
+            if(r->start < r->len){
+                *out = (string_t){
+                    .text = &r->buf[r->start], .len = r->len - r->start
+                };
+                r->buf[r->len] = '\0';
+                r->start = r->len;
+            }
+            return 0;
+        }
+        size_t scanned = scan - r->start;
+        int retval = reader_fill(r);
+        if(retval) return retval;
+        scan = r->start + scanned;
+    }
+}
+
+FILE *open_input(const char *path){
+    if(strcmp(path, "-") == 0) return stdin;
+    FILE *f = fopen(path, "r");
+    if(!f) perror(path);
+    return f;
+}
+
+/* start a temporary file for path with a copy of the first n bytes of what
+   path holds now */
+FILE *temp_copy(const char *path, size_t n, char **tmp){
+    FILE *f = temp_open(path, false, tmp);
+    if(!f) return NULL;
+    FILE *src = fopen(path, "r");
+    if(!src){
+        perror(path);
+        temp_abort(f, *tmp);
+        return NULL;
+    }
+    char buf[65536];
+    while(n){
+        size_t want = n < sizeof(buf) ? n : sizeof(buf);
+        size_t got = fread(buf, 1, want, src);
+        if(got != want || fwrite(buf, 1, got, f) != got){
+            perror(path);
+            fclose(src);
+            temp_abort(f, *tmp);
+            return NULL;
+        }
+        n -= got;
+    }
+    fclose(src);
+    return f;
+}
+
+// one sorted list being merged, and its current string
+typedef struct {
+    reader_t r;
+    string_t cur;
+} source_t;
+
+static void source_heap_down(source_t **heap, size_t n, size_t i){
+    while(true){
+        size_t min = i;
+        size_t l = 2*i + 1;
+        size_t r = l + 1;
+        if(l < n && cmp_from(heap[l]->cur, heap[min]->cur, 0) < 0) min = l;
+        if(r < n && cmp_from(heap[r]->cur, heap[min]->cur, 0) < 0) min = r;
+        if(min == i) return;
+        source_t *temp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = temp;
+        i = min;
+    }
+}
+
+/* the sorted lists which manifest_external() merges: its spilled runs, or
+   with --sorted, its inputs; with -u, duplicates are skipped */
+typedef struct {
+    source_t *srcs;
+    size_t nsrcs;
+    // the sources with strings left, as a min-heap
+    source_t **heap;
+    size_t n;
+    // the top of the heap was returned, and is advanced by the next call
+    bool advance;
+    bool unique;
+    // a copy of the last string returned, for -u
+    char *prev;
+    size_t prev_len;
+    size_t prev_cap;
+    bool have_prev;
+} merger_t;
+
+void merger_close(merger_t *m){
+    for(size_t i = 0; i < m->nsrcs; i++){
+        reader_close(&m->srcs[i].r);
+    }
+    free(m->srcs);
+    free(m->heap);
+    free(m->prev);
+    *m = (merger_t){0};
+}
+
+/* runs are nul-separated files; inputs are split on sep, and "-" is stdin;
+   each reader gets a buffer of chunk bytes */
+int merger_open(
+    merger_t *m,
+    char **paths,
+    size_t npaths,
+    bool runs,
+    string_t sep,
+    size_t chunk,
+    bool unique
+){
+    *m = (merger_t){ .unique = unique };
+    m->srcs = calloc(npaths ? npaths : 1, sizeof(*m->srcs));
+    m->heap = malloc((npaths ? npaths : 1) * sizeof(*m->heap));
+    if(!m->srcs || !m->heap){
+        perror("malloc");
+        merger_close(m);
+        return 1;
+    }
+    string_t nul = { .text = "\0", .len = 1 };
+    for(size_t i = 0; i < npaths; i++){
+        FILE *f = runs ? fopen(paths[i], "rb") : open_input(paths[i]);
+        if(!f){
+            if(runs) perror(paths[i]);
+            merger_close(m);
+            return 1;
+        }
+        source_t *src = &m->srcs[m->nsrcs];
+        int retval = reader_open(&src->r, f, runs ? nul : sep, chunk);
+        if(retval){
+            fclose(f);
+            merger_close(m);
+            return retval;
+        }
+        m->nsrcs++;
+        retval = reader_next(&src->r, &src->cur);
+        if(retval){
+            merger_close(m);
+            return retval;
+        }
+        if(src->cur.len) m->heap[m->n++] = src;
+    }
+    for(size_t i = m->n; i > 0; i--){
+        source_heap_down(m->heap, m->n, i - 1);
+    }
+    return 0;
+}
+
+/* sets *out to the next string in order, or to an empty string at the end;
+   it is valid until the next call */
+int merger_next(merger_t *m, string_t *out){
+    while(true){
+        if(m->advance){
+            m->advance = false;
+            source_t *top = m->heap[0];
+            int retval = reader_next(&top->r, &top->cur);
+            if(retval) return retval;
+            if(!top->cur.len) m->heap[0] = m->heap[--m->n];
+            source_heap_down(m->heap, m->n, 0);
+        }
+        if(!m->n){
+            *out = (string_t){0};
+            return 0;
+        }
+        string_t name = m->heap[0]->cur;
+        m->advance = true;
+        if(m->unique){
+            bool dup = m->have_prev && m->prev_len == name.len
+                && memcmp(m->prev, name.text, name.len) == 0;
+            if(dup) continue;
+            if(m->prev_cap < name.len){
+                free(m->prev);
+                m->prev_cap = name.len * 2;
+                m->prev = malloc(m->prev_cap);
+                if(!m->prev){
+                    perror("malloc");
+                    return 1;
+                }
+            }
+            memcpy(m->prev, name.text, name.len);
+            m->prev_len = name.len;
+            m->have_prev = true;
+        }
+        *out = name;
+        return 0;
+    }
+}
+
+// write a name and a newline to a temporary file
+static int put_line(FILE *f, const char *tmp, string_t name){
+    size_t written = fwrite(name.text, 1, name.len, f);
+    if(written != name.len || putc('\n', f) == EOF){
+        perror(tmp);
+        return 1;
+    }
+    return 0;
+}
+
+// names collected for sorting, or for a stat pass, within a memory budget
+typedef struct {
+    char *text;
+    size_t text_len;
+    size_t text_cap;
+    string_t *names;
+    size_t names_len;
+    size_t names_cap;
+} arena_t;
+
+int arena_init(arena_t *a, size_t text_cap, size_t names_cap){
+    *a = (arena_t){ .text_cap = text_cap, .names_cap = names_cap };
+    a->text = malloc(text_cap);
+    a->names = malloc(names_cap * sizeof(*a->names));
+    if(!a->text || !a->names){
+        perror("malloc");
+        return 1;
+    }
+    return 0;
+}
+
+void arena_free(arena_t *a){
+    free(a->text);
+    free(a->names);
+}
+
+static bool arena_fits(const arena_t *a, string_t name){
+    return a->names_len < a->names_cap
+        && a->text_cap - a->text_len > name.len;
+}
+
+// the caller must check arena_fits() first
+static void arena_add(arena_t *a, string_t name){
+    char *text = &a->text[a->text_len];
+    memcpy(text, name.text, name.len);
+    text[name.len] = '\0';
+    a->text_len += name.len + 1;
+    a->names[a->names_len++] = (string_t){ .text = text, .len = name.len };
+}
+
+// the path of the nth run spilled for output
+static char *run_path(const char *output, size_t n){
+    size_t cap = strlen(output) + 64;
+    char *out = malloc(cap);
+    if(!out){
+        perror("malloc");
+        return NULL;
+    }
+    snprintf(out, cap, "%s.run%d.%zu", output, compat_getpid(), n);
+    return out;
+}
+
+// sort the names in the arena and write them to a new run file
+static int spill_run(
+    const char *output, arena_t *a, opts_t opts, char ***runs, size_t *nruns
+){
+    int retval = radix_sort(a->names, a->names_len, opts.jobs, NULL, NULL);
+    if(retval) return retval;
+    size_t n = a->names_len;
+    if(opts.unique) n = dedupe(a->names, n);
+
+    char **new_runs = realloc(*runs, (*nruns + 1) * sizeof(*new_runs));
+    if(!new_runs){
+        perror("realloc");
+        return 1;
+    }
+    *runs = new_runs;
+    char *path = run_path(output, *nruns);
+    if(!path) return 1;
+    FILE *f = fopen(path, "wb");
+    if(!f){
+        perror(path);
+        free(path);
+        return 1;
+    }
+    (*runs)[(*nruns)++] = path;
+
+    // runs are nul-separated
+    bool ok = true;
+    for(size_t i = 0; ok && i < n; i++){
+        string_t name = a->names[i];
+        ok = fwrite(name.text, 1, name.len + 1, f) == name.len + 1;
+    }
+    if(fclose(f)) ok = false;
+    if(!ok){
+        perror(path);
+        return 1;
+    }
+    a->text_len = 0;
+    a->names_len = 0;
+    return 0;
+}
+
+// stat the names collected in the arena, then empty it
+static int stat_arena(
+    arena_t *a,
+    filetime_t output_info,
+    int jobs,
+    statcache_t *cache,
+    bool *newer,
+    filetime_t *newest
+){
+    size_t found;
+    filetime_t batch_newest;
+    int retval = any_newer(
+        a->names,
+        a->names_len,
+        output_info,
+        jobs,
+        cache,
+        &found,
+        NULL,
+        newest ? &batch_newest : NULL
+    );
+    if(retval) return retval;
+    if(found < a->names_len) *newer = true;
+    if(newest && isnewer(batch_newest, *newest)) *newest = batch_newest;
+    a->text_len = 0;
+    a->names_len = 0;
+    return 0;
+}
+
+/* --max-mem: like manifest(), but using about opts.max_mem of memory no
+   matter how long the list is.  Unsorted inputs are sorted in runs which fit
+   in the budget and are spilled to files next to the output.  The runs (or
+   the inputs themselves, with --sorted) are merged, and the merged list is
+   streamed to a new output while it is compared against the old output,
+   fingerprinted, and stat()ed, so no step holds the whole list. */
+int manifest_external(const char *output, opts_t opts){
+    int retval = 0;
+    char *stdin_only = "-";
+    if(!opts.ninputs){
+        opts.inputs = &stdin_only;
+        opts.ninputs = 1;
+    }
+    char **runs = NULL;
+    size_t nruns = 0;
+    arena_t arena = {0};
+    reader_t in = {0};
+    merger_t merge = {0};
+    reader_t old = {0};
+    char *tmp = NULL;
+    FILE *f = NULL;
+    depfile_t dep = {0};
+    bool dep_open = false;
+    char *fp_path = NULL;
+    string_t extra_in = {0};
+    string_t *extra = NULL;
+    size_t extra_len = 0;
+
+    string_t sep = {0};
+    if(opts.sep){
+        sep = (string_t){
+            .text = opts.sep,
+            .len=opts.sep[0] == '\0' ? 1 : strlen(opts.sep),
+        };
+    }
+
+    // half of the budget holds names; sorting them needs as much again
+    size_t half = opts.max_mem / 2;
+    size_t names_cap = half / 2 / (2 * sizeof(string_t));
+    if(!opts.presorted){
+        retval = arena_init(&arena, half, names_cap);
+        if(retval) goto cu;
+        for(size_t i = 0; i < opts.ninputs; i++){
+            FILE *inf = open_input(opts.inputs[i]);
+            if(!inf){
+                retval = 1;
+                goto cu;
+            }
+            retval = reader_open(&in, inf, sep, READ_CHUNK);
+            if(retval){
+                fclose(inf);
+                goto cu;
+            }
+            while(true){
+                string_t name;
+                retval = reader_next(&in, &name);
+                if(retval) goto cu;
+                if(!name.len) break;
+                if(!arena_fits(&arena, name) && arena.names_len){
+                    retval = spill_run(output, &arena, opts, &runs, &nruns);
+                    if(retval) goto cu;
+                }
+                if(!arena_fits(&arena, name)){
+                    fprintf(stderr, "a filename is longer than --max-mem\n");
+                    retval = 1;
+                    goto cu;
+                }
+                arena_add(&arena, name);
+            }
+            reader_close(&in);
+        }
+        if(arena.names_len){
+            retval = spill_run(output, &arena, opts, &runs, &nruns);
+            if(retval) goto cu;
+        }
+        arena_free(&arena);
+        arena = (arena_t){0};
+    }
+
+    // what is merged is either the runs or the presorted inputs
+    char **paths = opts.presorted ? opts.inputs : runs;
+    size_t npaths = opts.presorted ? opts.ninputs : nruns;
+    size_t chunk = half / (npaths + 1);
+    if(chunk < READER_MIN) chunk = READER_MIN;
+    retval = merger_open(
+        &merge, paths, npaths, !opts.presorted, sep, chunk, opts.unique
+    );
+    if(retval) goto cu;
+    // stdin can only be merged once; files can be merged again
+    bool replayable = true;
+    for(size_t i = 0; opts.presorted && i < npaths; i++){
+        if(strcmp(paths[i], "-") == 0) replayable = false;
+    }
+
+    if(opts.depfile){
+        retval = depfile_open(&dep, opts.depfile, output);
+        if(retval) goto cu;
+        dep_open = true;
+    }
+    fingerprinter_t fpr;
+    fingerprint_begin(&fpr, false, false);
+    filetime_t output_info;
+    int ret = get_filetime(output, &output_info);
+    if(ret && ret != FILE_NOT_FOUND){
+        compat_perror(output);
+        retval = 1;
+        goto cu;
+    }
+    bool exists = !ret;
+    fingerprint_t old_fp;
+    bool fp_trusted = false;
+    if(opts.fingerprint){
+        fp_path = sidecar_path(output, ".fp");
+        if(!fp_path){
+            retval = 1;
+            goto cu;
+        }
+        if(exists){
+            retval = fingerprint_load(fp_path, output, &old_fp, &fp_trusted);
+            if(retval) goto cu;
+        }
+    }
+    if(exists && !fp_trusted){
+        FILE *of = fopen(output, "r");
+        if(!of){
+            perror(output);
+            retval = 1;
+            goto cu;
+        }
+        string_t lf = { .text = "\n", .len = 1 };
+        retval = reader_open(&old, of, lf, READ_CHUNK);
+        if(retval){
+            fclose(of);
+            goto cu;
+        }
+    }
+    // names are stat()ed along the way, in case the list turns out the same
+    retval = arena_init(&arena, READ_CHUNK, SPILL_STAT_BATCH);
+    if(retval) goto cu;
+    bool same = exists;
+    /* while the list matches the old output, there is nothing to write; at
+       the first difference, the matching part is copied from the old output.
+       A trusted fingerprint only differs at the end, and then the sources are
+       merged again to write the new list, unless stdin is one of them, in
+       which case the list is written as it is read. */
+    size_t matched = 0;
+    if(!exists || (fp_trusted && !replayable)){
+        f = temp_open(output, false, &tmp);
+        if(!f){
+            retval = 1;
+            goto cu;
+        }
+    }
+    bool newer = false;
+    filetime_t newest = {0};
+    filetime_t *want_newest = opts.exact_mtime ? &newest : NULL;
+
+    while(true){
+        string_t name;
+        retval = merger_next(&merge, &name);
+        if(retval) goto cu;
+        if(!name.len) break;
+        if(dep_open) depfile_add(&dep, name);
+        if(opts.batch_dep) batch_dep_add(opts.batch_dep, &name, 1);
+        fingerprint_add(&fpr, name);
+        if(same && old.buf){
+            string_t line;
+            retval = reader_next(&old, &line);
+            if(retval) goto cu;
+            same = line.len && string_eq(line, name);
+        }
+        if(!same && !f){
+            f = temp_copy(output, matched, &tmp);
+            if(!f){
+                retval = 1;
+                goto cu;
+            }
+        }
+        if(f){
+            retval = put_line(f, tmp, name);
+            if(retval) goto cu;
+        }else{
+            matched += name.len + 1;
+        }
+        if(same && (!newer || want_newest)){
+            if(!arena_fits(&arena, name)){
+                retval = stat_arena(
+                    &arena, output_info, opts.jobs, opts.stats, &newer,
+                    want_newest
+                );
+                if(retval) goto cu;
+            }
+            // a name longer than the arena is stat()ed on its own
+            if(!arena_fits(&arena, name)){
+                string_t one = name;
+                arena_t single = {
+                    .names = &one, .names_len = 1, .names_cap = 1
+                };
+                retval = stat_arena(
+                    &single, output_info, 1, opts.stats, &newer, want_newest
+                );
+                if(retval) goto cu;
+            }else{
+                arena_add(&arena, name);
+            }
+        }
+    }
+
+    fingerprint_t fp;
+    fingerprint_end(&fpr, &fp);
+    if(same && old.buf){
+        // the old output must not have anything more
+        string_t line;
+        retval = reader_next(&old, &line);
+        if(retval) goto cu;
+        same = !line.len;
+    }else if(same && fp_trusted){
+        same = fp.count == old_fp.count
+            && fp.bytes == old_fp.bytes
+            && memcmp(fp.digest, old_fp.digest, sizeof(fp.digest)) == 0;
+    }
+    reader_close(&old);
+
+    bool fp_stale = !fp_trusted;
+    if(!same){
+        // contents differ (or there was no output); replace it
+        fp_stale = true;
+        if(!f && fp_trusted){
+            // only the digests differed, so merge again to write the list
+            merger_close(&merge);
+            retval = merger_open(
+                &merge, paths, npaths, !opts.presorted, sep, chunk,
+                opts.unique
+            );
+            if(retval) goto cu;
+            f = temp_open(output, false, &tmp);
+            if(!f){
+                retval = 1;
+                goto cu;
+            }
+            while(true){
+                string_t name;
+                retval = merger_next(&merge, &name);
+                if(retval) goto cu;
+                if(!name.len) break;
+                retval = put_line(f, tmp, name);
+                if(retval) goto cu;
+            }
+        }else if(!f){
+            // the new list is a prefix of the old one
+            f = temp_copy(output, matched, &tmp);
+            if(!f){
+                retval = 1;
+                goto cu;
+            }
+        }
+        retval = temp_commit(f, tmp, output);
+        f = NULL;
+        tmp = NULL;
+        if(retval) goto cu;
+    }else{
+        if(f) temp_abort(f, tmp);
+        f = NULL;
+        tmp = NULL;
+        if(arena.names_len){
+            retval = stat_arena(
+                &arena, output_info, opts.jobs, opts.stats, &newer,
+                want_newest
+            );
+            if(retval) goto cu;
+        }
+        if(newer){
+            fp_stale = true;
+            ret = touch(output, want_newest);
+            if(ret){
+                perror(output);
+                retval = 1;
+                goto cu;
+            }
+        }
     }
 
-    // split names on newlines
-    retval = split(in, sep, &names, &names_len);
-    if(retval) goto cu;
+    if(dep_open){
+        // directories or other paths which ninja should also watch
+        if(opts.extra_deps){
+            retval = read_input(opts.extra_deps, &extra_in);
+            if(retval) goto cu;
+            retval = split(extra_in, sep, &extra, &extra_len);
+            if(retval) goto cu;
+        }
+        for(size_t i = 0; i < extra_len; i++) depfile_add(&dep, extra[i]);
+        dep_open = false;
+        retval = depfile_close(&dep, opts.depfile, false);
+        if(retval) goto cu;
+    }
 
-    // sort the list of names
-    qsort(names, names_len, sizeof(*names), cmp_string);
+    if(opts.fingerprint && fp_stale){
+        retval = fingerprint_save(fp_path, output, &fp);
+    }
 
-    retval = join_names(names, names_len, &sorted);
-    if(retval) goto cu;
+cu:
+    if(f) temp_abort(f, tmp);
+    if(dep_open) depfile_close(&dep, opts.depfile, true);
+    reader_close(&old);
+    reader_close(&in);
+    merger_close(&merge);
+    for(size_t i = 0; i < nruns; i++){
+        remove(runs[i]);
+        free(runs[i]);
+    }
+    free(runs);
+    arena_free(&arena);
+    free(fp_path);
+    free(extra);
+    free(extra_in.text);
+    return retval;
+}
+
+
+/* bring one OUTPUT up to date with a sorted list of names: rewrite it if the
+   list changed, or else touch it if any of the named files is newer; with
+   --fingerprint, list_fp is the fingerprint of the names */
+static int update_output(
+    const char *output,
+    string_t *names,
+    size_t names_len,
+    const filetime_t *times,
+    const fingerprint_t *list_fp,
+    opts_t opts
+){
+    int retval = 0;
+    mapping_t old = {0};
+    char *sidecar = NULL;
+    char *fp_path = NULL;
+    hot_t hot = {0};
+    // the lines of OUTPUT, which are the names unless they are front-coded
+    string_t *lines = names;
+    string_t *recs = NULL;
+    char *recbuf = NULL;
+    string_t old_names = {0};
+    if(opts.store_fc){
+        retval = fc_encode(names, names_len, &recs, &recbuf);
+        if(retval) goto cu;
+        lines = recs;
+    }
+
+    fingerprint_t fp = {0};
+    fingerprint_t old_fp;
+    bool fp_trusted = false;
+    // whether the output was written or touched
+    bool updated = false;
+    // whether the output was written
+    bool rewritten = false;
+    if(opts.fingerprint){
+        fp_path = sidecar_path(output, ".fp");
+        if(!fp_path){
+            retval = 1;
+            goto cu;
+        }
+        fp = *list_fp;
+    }
 
     // check if the output exists (try to stat() it)
-    filetime_t output_info;
+    filetime_t output_info = {0};
     int ret = get_filetime(output, &output_info);
     if(ret){
         if(ret != FILE_NOT_FOUND){
@@ -430,58 +3492,737 @@ int manifest(const char *output, char *sep_cstr){
             goto cu;
         }
         // no output yet, write it now
-        retval = write_file(output, sorted);
-        goto cu;
+        if(opts.delta){
+            bool modified;
+            retval = write_delta(
+                output, names, names_len, times, NULL, output_info, 1, NULL,
+                &modified, NULL
+            );
+            if(retval) goto cu;
+        }
+        updated = true;
+        rewritten = true;
+        retval = write_file(output, lines, names_len, '\n');
+        goto done;
     }
 
-    // read the old file
-    retval = read_file(output, &old);
-    if(retval) goto cu;
+    if(opts.fingerprint){
+        retval = fingerprint_load(fp_path, output, &old_fp, &fp_trusted);
+        if(retval) goto cu;
+    }
+
+    // map the old file, unless a trusted fingerprint can stand in for it
+    if(!fp_trusted || opts.delta){
+        retval = map_file(output, false, &old);
+        if(retval) goto cu;
+    }
+
+    // --delta stats every name, which also decides if we need to touch
+    bool modified = false;
+    filetime_t newest;
+    filetime_t *want_newest = opts.exact_mtime ? &newest : NULL;
+    if(opts.delta){
+        mapping_t plain = old;
+        if(opts.store_fc){
+            retval = fc_decode_text(old.text, &old_names);
+            if(retval) goto cu;
+            plain = (mapping_t){ .text = old_names };
+        }
+        retval = write_delta(
+            output, names, names_len, times, &plain, output_info, opts.jobs,
+            opts.stats, &modified, want_newest
+        );
+        if(retval) goto cu;
+    }
 
     // compare contents
-    if(!string_eq(old, sorted)){
+    bool same;
+    if(fp_trusted){
+        same = fp.count == old_fp.count
+            && fp.bytes == old_fp.bytes
+            && memcmp(fp.digest, old_fp.digest, sizeof(fp.digest)) == 0;
+    }else{
+        same = file_eq(old.text, lines, names_len, '\n');
+    }
+    if(!same){
         // contents differ; overwrite it
-        retval = write_file(output, sorted);
-        goto cu;
+        updated = true;
+        rewritten = true;
+        retval = write_file(output, lines, names_len, '\n');
+        goto done;
+    }
+
+    if(opts.delta && !opts.hash){
+        if(modified){
+            updated = true;
+            ret = touch(output, want_newest);
+            if(ret){
+                perror(output);
+                retval = 1;
+            }
+        }
+        goto done;
     }
 
     /* make sure that the output file has a modified-time that is at least as
        new as the latest matching file we found */
-    for(size_t i = 0; i < names_len; i++){
-        filetime_t info;
-        ret = get_filetime(names[i].text, &info);
-        if(ret){
-            compat_perror(names[i].text);
+    if(opts.hash){
+        // content digests decide, rather than modification times
+        sidecar = sidecar_path(output, ".hash");
+        if(!sidecar){
             retval = 1;
             goto cu;
         }
-        if(isnewer(info, output_info)){
+        bool changed;
+        retval = hash_check(
+            sidecar, names, names_len, output_info, opts.jobs, &changed
+        );
+        if(retval) goto cu;
+        if(changed){
+            updated = true;
             ret = compat_utime(output);
             if(ret){
                 perror(output);
                 retval = 1;
-                goto cu;
             }
-            // quit after the first new file is found
+        }
+        goto done;
+    }
+
+    size_t newer = names_len;
+    if(opts.hot){
+        sidecar = sidecar_path(output, ".hot");
+        if(!sidecar){
+            retval = 1;
+            goto cu;
+        }
+        retval = hot_load(sidecar, &hot);
+        if(retval) goto cu;
+        retval = hot_check(&hot, names, names_len, output_info, &newer);
+        if(retval) goto cu;
+    }
+    if(times){
+        // --tolerant already statted everything
+        newer = first_newer(times, names_len, output_info, want_newest);
+    }else if(newer == names_len || opts.exact_mtime){
+        // --exact-mtime needs the newest of all, not just any newer name
+        retval = any_newer(
+            names, names_len, output_info, opts.jobs, opts.stats, &newer,
+            NULL, want_newest
+        );
+        if(retval) goto cu;
+    }
+    if(newer < names_len){
+        updated = true;
+        ret = touch(output, want_newest);
+        if(ret){
+            perror(output);
+            retval = 1;
+            goto cu;
+        }
+        if(opts.hot){
+            retval = hot_save(sidecar, &hot, names[newer], names, names_len);
+            if(retval) goto cu;
+        }
+    }
+
+done:
+    if(!retval && opts.hash && rewritten){
+        /* the rewrite already covers every digest as it is now, so bring the
+           cache up to date too, or the next run would touch the output again
+           for the same changes */
+        sidecar = sidecar_path(output, ".hash");
+        if(!sidecar){
+            retval = 1;
+            goto cu;
+        }
+        bool unused;
+        retval = hash_check(
+            sidecar, names, names_len, output_info, opts.jobs, &unused
+        );
+    }
+    // the output's identity changed, so the fingerprint must be rewritten
+    if(!retval && opts.fingerprint && (updated || !fp_trusted)){
+        retval = fingerprint_save(fp_path, output, &fp);
+    }
+    if(!retval && opts.mfx){
+        retval = update_mfx(output, names, names_len, opts.mfx_stat, updated);
+    }
+
+cu:
+    free(recs);
+    free(recbuf);
+    free(old_names.text);
+    unmap_file(&old);
+    unmap_file(&hot.map);
+    free(sidecar);
+    free(fp_path);
+    return retval;
+}
+
+
+// the path of shard i of OUTPUT, for --shards
+static char *shard_path(const char *output, size_t i){
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%zu", i);
+    return sidecar_path(output, suffix);
+}
+
+static bool is_sep(char c){
+#ifndef _WIN32 // UNIX
+    return c == '/';
+#else // WINDOWS
+    return c == '/' || c == '\\';
+#endif
+}
+
+/* remove shard i of OUTPUT and any sidecars it has, or return FILE_NOT_FOUND
+   if there is no such shard */
+static int remove_shard(const char *output, size_t i){
+    static const char *suffixes[] = {
+        "", ".fp", ".hash", ".hot", ".mfx", ".added", ".removed", ".modified",
+    };
+    char *path = shard_path(output, i);
+    if(!path) return 1;
+    filetime_t unused;
+    int ret = get_filetime(path, &unused);
+    if(ret){
+        if(ret != FILE_NOT_FOUND) compat_perror(path);
+        free(path);
+        return ret;
+    }
+    int retval = 0;
+    for(size_t j = 0; !retval && j < sizeof(suffixes)/sizeof(*suffixes); j++){
+        char *file = sidecar_path(path, suffixes[j]);
+        if(!file){
+            retval = 1;
+            break;
+        }
+        if(remove(file) && errno != ENOENT){
+            perror(file);
+            retval = 1;
+        }
+        free(file);
+    }
+    free(path);
+    return retval;
+}
+
+/* the shard of a name is a hash of the whole name or, with --shard-by-dir, of
+   its first path component, so a top-level directory's files stay together;
+   either way a name stays in its shard while other names come and go */
+static size_t shard_of(string_t name, bool by_dir, size_t nshards){
+    const char *p = name.text;
+    size_t len = name.len;
+    if(by_dir){
+        // skip any leading separators or "./", which every name may share
+        while(len){
+            if(is_sep(p[0])){
+                p++;
+                len--;
+            }else if(len > 1 && p[0] == '.' && is_sep(p[1])){
+                p += 2;
+                len -= 2;
+            }else{
+                break;
+            }
+        }
+        size_t i = 0;
+        while(i < len && !is_sep(p[i])) i++;
+        len = i;
+    }
+    xxh64_t x;
+    xxh64_init(&x, 0);
+    xxh64_update(&x, (const unsigned char*)p, len);
+    return (size_t)(xxh64_final(&x) % nshards);
+}
+
+/* --shards: split the sorted names into OUTPUT.0 through OUTPUT.N-1, each of
+   which is updated on its own, so a change to one file only updates the
+   shard which lists it; each shard's fingerprint is computed as the names
+   are assigned to shards */
+static int update_shards(
+    const char *output,
+    const string_t *names,
+    size_t names_len,
+    const filetime_t *times,
+    opts_t opts
+){
+    int retval = 0;
+    size_t n = opts.shards;
+    size_t alloc_len = names_len ? names_len : 1;
+    size_t *which = malloc(alloc_len * sizeof(*which));
+    string_t *parted = malloc(alloc_len * sizeof(*parted));
+    filetime_t *parted_times = NULL;
+    size_t *ends = calloc(n, sizeof(*ends));
+    fingerprinter_t *fprs = NULL;
+    if(times) parted_times = malloc(alloc_len * sizeof(*parted_times));
+    if(opts.fingerprint) fprs = malloc(n * sizeof(*fprs));
+    if(
+        !which || !parted || !ends || (times && !parted_times)
+        || (opts.fingerprint && !fprs)
+    ){
+        perror("malloc");
+        retval = 1;
+        goto cu;
+    }
+    for(size_t s = 0; fprs && s < n; s++){
+        fingerprint_begin(&fprs[s], opts.store_fc, false);
+    }
+
+    // a stable counting sort, which keeps each shard in sorted order
+    for(size_t i = 0; i < names_len; i++){
+        which[i] = shard_of(names[i], opts.shard_by_dir, n);
+        ends[which[i]]++;
+        if(fprs) fingerprint_add(&fprs[which[i]], names[i]);
+    }
+    size_t start = 0;
+    for(size_t s = 0; s < n; s++){
+        size_t count = ends[s];
+        ends[s] = start;
+        start += count;
+    }
+    for(size_t i = 0; i < names_len; i++){
+        size_t j = ends[which[i]]++;
+        parted[j] = names[i];
+        if(times) parted_times[j] = times[i];
+    }
+
+    // now ends[s] is the end of shard s, and the start of shard s+1
+    start = 0;
+    for(size_t s = 0; s < n; s++){
+        char *path = shard_path(output, s);
+        if(!path){
+            retval = 1;
+            goto cu;
+        }
+        fingerprint_t fp;
+        if(fprs) fingerprint_end(&fprs[s], &fp);
+        retval = update_output(
+            path,
+            &parted[start],
+            ends[s] - start,
+            times ? &parted_times[start] : NULL,
+            fprs ? &fp : NULL,
+            opts
+        );
+        free(path);
+        if(retval) goto cu;
+        start = ends[s];
+    }
+
+    /* shards from an earlier run with a larger N would otherwise be left
+       behind, listing their files a second time */
+    for(size_t s = n; !retval; s++){
+        retval = remove_shard(output, s);
+    }
+    if(retval == FILE_NOT_FOUND) retval = 0;
+
+cu:
+    free(which);
+    free(parted);
+    free(parted_times);
+    free(ends);
+    free(fprs);
+    return retval;
+}
+
+
+int manifest(const char *output, opts_t opts){
+    if(opts.max_mem) return manifest_external(output, opts);
+    int retval = 0;
+    char *stdin_only = "-";
+    if(!opts.ninputs){
+        opts.inputs = &stdin_only;
+        opts.ninputs = 1;
+    }
+    string_t *ins = calloc(opts.ninputs, sizeof(*ins));
+    string_t **runs = calloc(opts.ninputs, sizeof(*runs));
+    size_t *run_lens = calloc(opts.ninputs, sizeof(*run_lens));
+    string_t *names = NULL;
+    size_t names_len = 0;
+    string_t extra_in = {0};
+    string_t *extra = NULL;
+    size_t extra_len = 0;
+    char *shard0 = NULL;
+    filetime_t *times = NULL;
+    if(!ins || !runs || !run_lens){
+        perror("calloc");
+        retval = 1;
+        goto cu;
+    }
+
+    /* --fingerprint: the last step which orders the list computes its
+       fingerprint as the names pass through: the --tolerant stat pass, the
+       merge of several inputs, or the sort of just one; shards fingerprint
+       themselves as they are split up */
+    fingerprinter_t fpr;
+    bool want_fp = opts.fingerprint && !opts.shards;
+    bool have_fp = false;
+    fingerprint_begin(&fpr, opts.store_fc, opts.unique);
+
+    // an empty sep means to detect line endings while splitting
+    string_t sep = {0};
+    if(opts.sep){
+        sep = (string_t){
+            .text = opts.sep,
+            .len=opts.sep[0] == '\0' ? 1 : strlen(opts.sep),
+        };
+    }
+
+    for(size_t i = 0; i < opts.ninputs; i++){
+        // read each list of names
+        retval = read_input(opts.inputs[i], &ins[i]);
+        if(retval) goto cu;
+
+        // split names on newlines
+        retval = split(ins[i], sep, &runs[i], &run_lens[i]);
+        if(retval) goto cu;
+        if(opts.front_coded){
+            // the decoded names replace the input text
+            char *buf;
+            retval = fc_decode(runs[i], &run_lens[i], &buf);
+            if(retval) goto cu;
+            free(ins[i].text);
+            ins[i].text = buf;
+        }
+        names_len += run_lens[i];
+
+        // sort the list of names, unless it is already sorted
+        if(!opts.presorted && !is_sorted(runs[i], run_lens[i])){
+            bool fp_here = want_fp && opts.ninputs == 1 && !opts.tolerant;
+            retval = radix_sort(
+                runs[i],
+                run_lens[i],
+                opts.jobs,
+                fp_here ? fingerprint_range : NULL,
+                &fpr
+            );
+            if(retval) goto cu;
+            have_fp |= fp_here;
+        }
+    }
+
+    if(opts.ninputs == 1){
+        names = runs[0];
+        runs[0] = NULL;
+    }else{
+        names = malloc((names_len ? names_len : 1) * sizeof(*names));
+        if(!names){
+            perror("malloc");
+            retval = 1;
             goto cu;
         }
+        bool fp_here = want_fp && !opts.tolerant;
+        retval = merge_runs(
+            runs,
+            run_lens,
+            opts.ninputs,
+            names,
+            fp_here ? fingerprint_range : NULL,
+            &fpr
+        );
+        if(retval) goto cu;
+        have_fp = fp_here;
+        for(size_t i = 0; i < opts.ninputs; i++){
+            free(runs[i]);
+            runs[i] = NULL;
+        }
+    }
+    if(opts.unique) names_len = dedupe(names, names_len);
+
+    // --tolerant: drop vanished names before anything else sees the list
+    if(opts.tolerant){
+        retval = stat_survivors(
+            names,
+            &names_len,
+            opts.jobs,
+            opts.stats,
+            &times,
+            want_fp ? fingerprint_range : NULL,
+            &fpr
+        );
+        if(retval) goto cu;
+        have_fp = want_fp;
+    }
+
+    // input which was already in order never passed through a sort
+    if(want_fp && !have_fp) fingerprint_range(&fpr, names, names_len);
+    fingerprint_t fp;
+    if(want_fp) fingerprint_end(&fpr, &fp);
+
+    if(opts.batch_dep) batch_dep_add(opts.batch_dep, names, names_len);
+    if(opts.depfile){
+        if(opts.shards){
+            shard0 = shard_path(output, 0);
+            if(!shard0){
+                retval = 1;
+                goto cu;
+            }
+        }
+        // directories or other paths which ninja should also watch
+        if(opts.extra_deps){
+            retval = read_input(opts.extra_deps, &extra_in);
+            if(retval) goto cu;
+            retval = split(extra_in, sep, &extra, &extra_len);
+            if(retval) goto cu;
+        }
+        // ninja expects the depfile to name the edge's first output
+        retval = write_depfile(
+            opts.depfile, shard0 ? shard0 : output, names, names_len, extra,
+            extra_len
+        );
+        if(retval) goto cu;
+    }
+
+    if(opts.shards){
+        retval = update_shards(output, names, names_len, times, opts);
+    }else{
+        retval = update_output(
+            output, names, names_len, times, want_fp ? &fp : NULL, opts
+        );
     }
 
 cu:
     // free all of the names we collected
     free(names);
-    free(in.text);
-    free(sorted.text);
-    free(old.text);
+    for(size_t i = 0; runs && i < opts.ninputs; i++){
+        free(runs[i]);
+    }
+    free(runs);
+    free(run_lens);
+    for(size_t i = 0; ins && i < opts.ninputs; i++){
+        free(ins[i].text);
+    }
+    free(ins);
+    free(extra);
+    free(extra_in.text);
+    free(shard0);
+    free(times);
+    return retval;
+}
+
+
+// a pool of threads which each run manifest() for one pair at a time
+typedef struct {
+    // alternating inputs and outputs
+    const string_t *entries;
+    size_t npairs;
+    opts_t opts;
+    size_t next;
+    bool failed;
+    mutex_t lock;
+} batch_pool_t;
+
+static void batch_worker(void *arg){
+    batch_pool_t *pool = arg;
+    while(true){
+        mutex_lock(&pool->lock);
+        size_t i = pool->next;
+        if(i < pool->npairs) pool->next++;
+        mutex_unlock(&pool->lock);
+        if(i == pool->npairs) return;
+
+        opts_t opts = pool->opts;
+        char *input = pool->entries[2*i].text;
+        opts.inputs = &input;
+        opts.ninputs = 1;
+        // a failed manifest does not stop the rest of the batch
+        if(manifest(pool->entries[2*i + 1].text, opts)){
+            mutex_lock(&pool->lock);
+            pool->failed = true;
+            mutex_unlock(&pool->lock);
+        }
+    }
+}
+
+/* --batch: update every OUTPUT in the spec from its INPUT in one process,
+   with up to jobs manifests at a time, which share one stat cache; a depfile
+   names the first OUTPUT and the names from every INPUT */
+int manifest_batch(opts_t opts){
+    string_t text;
+    int retval = read_input(opts.batch, &text);
+    if(retval) return retval;
+    string_t *entries = NULL;
+    size_t nentries = 0;
+
+    // the spec is NUL-framed if it has any NULs, or else one path per line
+    string_t sep = {0};
+    if(memchr(text.text, '\0', text.len)){
+        sep = (string_t){ .text = "\0", .len = 1 };
+    }
+    retval = split(text, sep, &entries, &nentries);
+    if(retval) goto cu;
+    if(nentries % 2 || (opts.depfile && !nentries)){
+        fprintf(stderr, "%s: expected INPUT and OUTPUT pairs\n", opts.batch);
+        retval = 1;
+        goto cu;
+    }
+
+    batch_pool_t pool = {
+        .entries = entries,
+        .npairs = nentries / 2,
+        .opts = opts,
+    };
+    batch_dep_t dep;
+    if(opts.depfile){
+        // ninja expects the depfile to name the edge's first output
+        retval = depfile_open(&dep.d, opts.depfile, entries[1].text);
+        if(retval) goto cu;
+        mutex_init(&dep.lock);
+        pool.opts.batch_dep = &dep;
+        pool.opts.depfile = NULL;
+    }
+    statcache_t cache;
+    statcache_init(&cache);
+    pool.opts.stats = &cache;
+    // parallelism goes to the pairs, not to each manifest
+    size_t nthreads = (size_t)opts.jobs;
+    if(nthreads > pool.npairs) nthreads = pool.npairs;
+    if(nthreads > 1) pool.opts.jobs = 1;
+    mutex_init(&pool.lock);
+    retval = run_workers(batch_worker, &pool, nthreads);
+    mutex_free(&pool.lock);
+    statcache_free(&cache);
+    if(!retval) retval = pool.failed;
+    if(opts.depfile){
+        mutex_free(&dep.lock);
+        int ret = depfile_close(&dep.d, opts.depfile, retval != 0);
+        if(!retval) retval = ret;
+    }
+
+cu:
+    free(entries);
+    free(text.text);
+    return retval;
+}
+
+
+// --decode: print a front-coded list as plain text, for humans
+int decode(const char *path){
+    string_t text;
+    int retval = read_input(path, &text);
+    if(retval) return retval;
+    string_t plain;
+    retval = fc_decode_text(text, &plain);
+    free(text.text);
+    if(retval) return retval;
+    if(fwrite(plain.text, 1, plain.len, stdout) != plain.len){
+        perror("stdout");
+        retval = 1;
+    }
+    free(plain.text);
     return retval;
 }
 
 
+// the smallest budget --max-mem accepts
+#define MAX_MEM_MIN (16 * 1024 * 1024)
+
+// parse a --max-mem size, which may have a K, M, or G suffix
+int parse_size(const char *text, size_t *out){
+    char *end;
+    unsigned long long n = strtoull(text, &end, 10);
+    if(end == text) return 1;
+    unsigned long long mult = 1;
+    if(*end == 'K' || *end == 'k') mult = 1024;
+    else if(*end == 'M' || *end == 'm') mult = 1024 * 1024;
+    else if(*end == 'G' || *end == 'g') mult = 1024 * 1024 * 1024;
+    if(mult > 1) end++;
+    if(*end) return 1;
+    if(n > SIZE_MAX / mult || n * mult < MAX_MEM_MIN) return 1;
+    *out = (size_t)(n * mult);
+    return 0;
+}
+
+
 int print_help(FILE *f){
-    fprintf(f, "usage: manifest [SEP] OUTPUT <filenames\n");
+    fprintf(f, "usage: manifest [OPTIONS] [SEP] OUTPUT <filenames\n");
+    fprintf(f, "       manifest [OPTIONS] [SEP] -i INPUT [-i INPUT...] "
+               "OUTPUT\n");
+    fprintf(f, "       manifest [OPTIONS] [SEP] --batch SPEC\n");
+    fprintf(f, "       manifest --decode FILE\n");
     fprintf(f, "where SEP may be one of: -0 -cr -lf -crlf -lfcr\n");
     fprintf(f, "when SEP is not provided, stdin is split on ");
     fprintf(f, "automatically-detected line endings\n");
+    fprintf(f, "--sorted promises that stdin is already in bytewise order ");
+    fprintf(f, "(as from findglob --sorted), so it is not sorted again\n");
+    fprintf(f, "-i INPUT reads filenames from INPUT (\"-\" for stdin) ");
+    fprintf(f, "instead of stdin; with several\n");
+    fprintf(f, "inputs, each is sorted on its own (or found to be sorted ");
+    fprintf(f, "already) and they are\n");
+    fprintf(f, "merged in a single pass\n");
+    fprintf(f, "-u drops duplicate filenames\n");
+    fprintf(f, "--depfile DEPFILE writes a makefile-style depfile naming ");
+    fprintf(f, "OUTPUT and every filename,\n");
+    fprintf(f, "for ninja's deps = gcc; --extra-deps FILE adds the paths ");
+    fprintf(f, "listed in FILE to it\n");
+    fprintf(f, "--delta writes OUTPUT.added and OUTPUT.removed with the ");
+    fprintf(f, "filenames which entered or\n");
+    fprintf(f, "left the list, and OUTPUT.modified with those which are ");
+    fprintf(f, "newer than OUTPUT\n");
+    fprintf(f, "-j N uses N threads (default 1) to check the modification ");
+    fprintf(f, "times of the filenames,\n");
+    fprintf(f, "which helps on high-latency filesystems like NFS, and to ");
+    fprintf(f, "sort very long lists\n");
+    fprintf(f, "--hot keeps OUTPUT.hot, a list of the files which recently ");
+    fprintf(f, "caused OUTPUT to be\n");
+    fprintf(f, "touched, and checks those files first; it is ");
+    fprintf(f, "incompatible with --delta,\n");
+    fprintf(f, "which checks every file anyway\n");
+    fprintf(f, "--hash keeps OUTPUT.hash, a cache of content digests, and ");
+    fprintf(f, "only touches OUTPUT\n");
+    fprintf(f, "when the content of some file changed, not just its ");
+    fprintf(f, "modification time\n");
+    fprintf(f, "--fingerprint keeps OUTPUT.fp, a digest of OUTPUT, so that ");
+    fprintf(f, "OUTPUT itself need not be\n");
+    fprintf(f, "read to see if the list of filenames changed\n");
+    fprintf(f, "--exact-mtime sets the modification time of OUTPUT to ");
+    fprintf(f, "exactly that of the newest\n");
+    fprintf(f, "filename, rather than to now, when OUTPUT is touched\n");
+    fprintf(f, "--max-mem SIZE keeps memory use near SIZE (at least 16M; ");
+    fprintf(f, "K, M and G suffixes are\n");
+    fprintf(f, "allowed) for lists of any length, by sorting in runs ");
+    fprintf(f, "which are spilled to files\n");
+    fprintf(f, "next to OUTPUT and streaming the comparison; it is ");
+    fprintf(f, "incompatible with --hot,\n");
+    fprintf(f, "--hash, --delta, --mfx and front-coding\n");
+    fprintf(f, "--mfx also writes OUTPUT.mfx, an indexed binary copy of ");
+    fprintf(f, "OUTPUT which mfx.h can\n");
+    fprintf(f, "search without reading it all; --mfx-stat also stores the ");
+    fprintf(f, "size and modification\n");
+    fprintf(f, "time of each file\n");
+    fprintf(f, "--shards N writes the filenames to OUTPUT.0 through ");
+    fprintf(f, "OUTPUT.N-1 instead of OUTPUT,\n");
+    fprintf(f, "by a hash of each filename, or with --shard-by-dir, of its ");
+    fprintf(f, "top-level directory;\n");
+    fprintf(f, "each shard is updated on its own, and --depfile names ");
+    fprintf(f, "OUTPUT.0; any shards from\n");
+    fprintf(f, "OUTPUT.N on, left by an earlier run with more shards, are ");
+    fprintf(f, "deleted\n");
+    fprintf(f, "--tolerant drops filenames which no longer exist, ");
+    fprintf(f, "rather than failing, as when\n");
+    fprintf(f, "files are deleted between listing and checking them; ");
+    fprintf(f, "every file is statted once,\n");
+    fprintf(f, "before anything else, and OUTPUT and the depfile list only ");
+    fprintf(f, "the survivors; it is\n");
+    fprintf(f, "incompatible with --hot, --hash and --max-mem\n");
+    fprintf(f, "--front-coded reads front-coded input (as from findglob ");
+    fprintf(f, "--front-coded), where each\n");
+    fprintf(f, "line is the length of the prefix shared with the line ");
+    fprintf(f, "before, a space, and the\n");
+    fprintf(f, "rest of the filename; --store-front-coded writes OUTPUT ");
+    fprintf(f, "that way, and\n");
+    fprintf(f, "--decode FILE (\"-\" for stdin) prints a front-coded FILE ");
+    fprintf(f, "as plain lines\n");
+    fprintf(f, "--batch SPEC updates many manifests in one process; SPEC ");
+    fprintf(f, "(\"-\" for stdin) lists\n");
+    fprintf(f, "an INPUT and then its OUTPUT, one path per line, or ");
+    fprintf(f, "NUL-separated; with -j N,\n");
+    fprintf(f, "up to N manifests are updated at a time; they share one ");
+    fprintf(f, "cache of modification\n");
+    fprintf(f, "times, and --depfile names the first OUTPUT and the ");
+    fprintf(f, "filenames of every INPUT\n");
     // return 0 or 1 to make main easier to write.
     return f == stdout ? 0 : 1;
 }
@@ -494,19 +4235,93 @@ int print_version(void){
 }
 
 
-int main(int argc, char **argv){
+// inputs has room for every -i, and is owned by manifest_main()
+static int _manifest_main(int argc, char **argv, char **inputs){
     // parse args
-    char *sep = NULL;
+    opts_t opts = { .jobs = 1, .inputs = inputs };
     char *output = NULL;
     bool nomoreflags = false;
     for(int i = 1; i < argc; i++){
         if(nomoreflags && output) return print_help(stderr);
         else if(nomoreflags) output = argv[i];
-        else if(strcmp(argv[i], "-0") == 0) sep = "\0";
-        else if(strcmp(argv[i], "-cr") == 0) sep = "\r";
-        else if(strcmp(argv[i], "-lf") == 0) sep = "\n";
-        else if(strcmp(argv[i], "-crlf") == 0) sep = "\r\n";
-        else if(strcmp(argv[i], "-lfcr") == 0) sep = "\n\r";
+        else if(strcmp(argv[i], "-0") == 0) opts.sep = "\0";
+        else if(strcmp(argv[i], "-cr") == 0) opts.sep = "\r";
+        else if(strcmp(argv[i], "-lf") == 0) opts.sep = "\n";
+        else if(strcmp(argv[i], "-crlf") == 0) opts.sep = "\r\n";
+        else if(strcmp(argv[i], "-lfcr") == 0) opts.sep = "\n\r";
+        else if(strcmp(argv[i], "--sorted") == 0) opts.presorted = true;
+        else if(strcmp(argv[i], "--hot") == 0) opts.hot = true;
+        else if(strcmp(argv[i], "--hash") == 0) opts.hash = true;
+        else if(strcmp(argv[i], "--delta") == 0) opts.delta = true;
+        else if(strcmp(argv[i], "--fingerprint") == 0){
+            opts.fingerprint = true;
+        }
+        else if(strcmp(argv[i], "--mfx") == 0) opts.mfx = true;
+        else if(strcmp(argv[i], "--mfx-stat") == 0){
+            opts.mfx = true;
+            opts.mfx_stat = true;
+        }
+        else if(strcmp(argv[i], "--exact-mtime") == 0){
+            opts.exact_mtime = true;
+        }
+        else if(strcmp(argv[i], "-u") == 0) opts.unique = true;
+        else if(strcmp(argv[i], "--depfile") == 0){
+            if(++i == argc) return print_help(stderr);
+            opts.depfile = argv[i];
+        }
+        else if(strcmp(argv[i], "--batch") == 0){
+            if(++i == argc) return print_help(stderr);
+            opts.batch = argv[i];
+        }
+        else if(strcmp(argv[i], "--extra-deps") == 0){
+            if(++i == argc) return print_help(stderr);
+            opts.extra_deps = argv[i];
+        }
+        else if(strcmp(argv[i], "-i") == 0){
+            if(++i == argc) return print_help(stderr);
+            opts.inputs[opts.ninputs++] = argv[i];
+        }
+        else if(strcmp(argv[i], "--max-mem") == 0){
+            if(++i == argc) return print_help(stderr);
+            if(parse_size(argv[i], &opts.max_mem)){
+                fprintf(stderr, "invalid --max-mem value: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "--shards") == 0){
+            if(++i == argc) return print_help(stderr);
+            char *end;
+            long n = strtol(argv[i], &end, 10);
+            if(*end || end == argv[i] || n < 1 || n > 65536){
+                fprintf(stderr, "invalid --shards value: %s\n", argv[i]);
+                return 1;
+            }
+            opts.shards = (size_t)n;
+        }
+        else if(strcmp(argv[i], "--front-coded") == 0){
+            opts.front_coded = true;
+        }
+        else if(strcmp(argv[i], "--store-front-coded") == 0){
+            opts.store_fc = true;
+        }
+        else if(strcmp(argv[i], "--decode") == 0){
+            if(++i == argc) return print_help(stderr);
+            return decode(argv[i]);
+        }
+        else if(strcmp(argv[i], "--tolerant") == 0) opts.tolerant = true;
+        else if(strcmp(argv[i], "--shard-by-dir") == 0){
+            opts.shard_by_dir = true;
+        }
+        else if(strcmp(argv[i], "-j") == 0){
+            if(++i == argc) return print_help(stderr);
+            char *end;
+            long n = strtol(argv[i], &end, 10);
+            if(*end || end == argv[i] || n < 1 || n > 1024){
+                fprintf(stderr, "invalid -j value: %s\n", argv[i]);
+                return 1;
+            }
+            opts.jobs = (int)n;
+        }
         else if(strcmp(argv[i], "--help") == 0) return print_help(stdout);
         else if(strcmp(argv[i], "-h") == 0) return print_help(stdout);
         else if(strcmp(argv[i], "--version") == 0) return print_version();
@@ -514,7 +4329,68 @@ int main(int argc, char **argv){
         else if(output) return print_help(stderr);
         else output = argv[i];
     }
-    if(!output) return print_help(stderr);
+    if(opts.batch){
+        if(output) return print_help(stderr);
+        if(opts.ninputs || opts.extra_deps){
+            fprintf(
+                stderr, "-i and --extra-deps are not valid with --batch\n"
+            );
+            return 1;
+        }
+    }else if(!output){
+        return print_help(stderr);
+    }
+    if(opts.extra_deps && !opts.depfile){
+        fprintf(stderr, "--extra-deps is only valid with --depfile\n");
+        return 1;
+    }
+    if(opts.shard_by_dir && !opts.shards){
+        fprintf(stderr, "--shard-by-dir is only valid with --shards\n");
+        return 1;
+    }
+    if(opts.shards && (opts.batch || opts.max_mem)){
+        fprintf(stderr, "--shards is not valid with --batch or --max-mem\n");
+        return 1;
+    }
+    if(opts.hot && opts.hash){
+        fprintf(stderr, "--hot and --hash are incompatible\n");
+        return 1;
+    }
+    if(opts.hot && opts.delta){
+        fprintf(stderr, "--hot and --delta are incompatible\n");
+        return 1;
+    }
+    if(
+        opts.max_mem && (
+            opts.hot || opts.hash || opts.delta || opts.mfx
+            || opts.front_coded || opts.store_fc
+        )
+    ){
+        fprintf(stderr, "--max-mem is incompatible with --hot, --hash, ");
+        fprintf(stderr, "--delta, --mfx and front-coding\n");
+        return 1;
+    }
+    if(opts.tolerant && (opts.hot || opts.hash || opts.max_mem)){
+        fprintf(stderr, "--tolerant is incompatible with --hot, --hash and ");
+        fprintf(stderr, "--max-mem\n");
+        return 1;
+    }
+    if(opts.exact_mtime && opts.hash){
+        fprintf(stderr, "--exact-mtime and --hash are incompatible\n");
+        return 1;
+    }
+
+    return opts.batch ? manifest_batch(opts) : manifest(output, opts);
+}
 
-    return manifest(output, sep);
+int manifest_main(int argc, char **argv){
+    // there can't be more inputs than arguments
+    char **inputs = malloc(argc * sizeof(*inputs));
+    if(!inputs){
+        perror("malloc");
+        return 1;
+    }
+    int retval = _manifest_main(argc, argv, inputs);
+    free(inputs);
+    return retval;
 }
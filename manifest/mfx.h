@@ -0,0 +1,374 @@
+/* mfx.h: the indexed binary manifest format, and a reader for it.
+
+   This header is all that a C program needs to read the OUTPUT.mfx files
+   which `manifest --mfx` writes.  Everything is static inline, so it can be
+   included anywhere without a library to link.  The file is mapped, and
+   lookups and prefix scans are O(log n) in the number of entries.
+
+   The format is little-endian throughout:
+
+     header: eight uint64 fields
+       magic       "mfx00001"
+       count       number of entries
+       nblocks     number of blocks
+       block       entries per block (the last block may have fewer)
+       flags       MFX_STAT if entries carry a size and mtime
+       max_len     length of the longest name
+       index_off   file offset of the block index
+       reserved    zero
+
+     blocks: the entries in bytewise-sorted order, front-coded; each entry is
+       varint shared      bytes shared with the previous name
+       varint suffix_len  bytes which follow
+       suffix bytes
+       (with MFX_STAT) varint size, varint mtime_sec, varint mtime_nsec
+     The first entry of every block has shared = 0, so every block can be
+     decoded on its own.
+
+     index: nblocks uint64 file offsets, one per block
+
+   Varints are LEB128: seven bits at a time, low bits first, with the high
+   bit set on every byte but the last.  Mtimes are seconds and nanoseconds
+   since the unix epoch, stored as uint64. */
+
+#ifndef MFX_H
+#define MFX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MFX_MAGIC "mfx00001"
+#define MFX_HEADER_SIZE 64
+#define MFX_STAT 1
+
+typedef struct {
+    uint64_t count;
+    uint64_t nblocks;
+    uint64_t block;
+    uint64_t flags;
+    uint64_t max_len;
+    uint64_t index_off;
+} mfx_header_t;
+
+typedef struct {
+    // a name is not nul-terminated, and is valid until the next call
+    const char *name;
+    size_t len;
+    uint64_t size;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+} mfx_entry_t;
+
+typedef struct {
+    const unsigned char *data;
+    size_t len;
+    mfx_header_t h;
+#ifndef _WIN32 // UNIX
+    bool mapped;
+#else // WINDOWS
+    void *file;
+    void *mapping;
+#endif
+} mfx_t;
+
+static inline uint64_t mfx_get64(const unsigned char *p){
+    uint64_t out = 0;
+    for(int i = 7; i >= 0; i--) out = (out << 8) | p[i];
+    return out;
+}
+
+static inline void mfx_put64(unsigned char *p, uint64_t v){
+    for(int i = 0; i < 8; i++){
+        p[i] = (unsigned char)(v & 0xff);
+        v >>= 8;
+    }
+}
+
+// decode a varint at *p, not reading past end; false if it is truncated
+static inline bool mfx_varint(
+    const unsigned char **p, const unsigned char *end, uint64_t *out
+){
+    *out = 0;
+    for(int shift = 0; *p < end && shift < 64; shift += 7){
+        unsigned char c = *(*p)++;
+        *out |= (uint64_t)(c & 0x7f) << shift;
+        if(!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+// encode a varint into buf, which needs room for 10 bytes; returns its size
+static inline size_t mfx_put_varint(unsigned char *buf, uint64_t v){
+    size_t n = 0;
+    while(v >= 0x80){
+        buf[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (unsigned char)v;
+    return n;
+}
+
+// a position within the entries, which decodes names into its own buffer
+typedef struct {
+    const mfx_t *m;
+    uint64_t block;
+    // entries left to decode in this block
+    uint64_t left;
+    const unsigned char *p;
+    char *buf;
+    size_t len;
+} mfx_iter_t;
+
+static inline const unsigned char *mfx_block_start(
+    const mfx_t *m, uint64_t block
+){
+    uint64_t off = mfx_get64(m->data + m->h.index_off + 8 * block);
+    if(off >= m->len) return NULL;
+    return m->data + off;
+}
+
+static inline uint64_t mfx_block_count(const mfx_t *m, uint64_t block){
+    if(block + 1 < m->h.nblocks) return m->h.block;
+    return m->h.count - block * m->h.block;
+}
+
+/* decode the next entry of an iterator; returns false at the end of the
+   entries, or if the file is malformed */
+static inline bool mfx_next(mfx_iter_t *it, mfx_entry_t *out){
+    const mfx_t *m = it->m;
+    const unsigned char *end = m->data + m->h.index_off;
+    while(!it->left){
+        if(++it->block >= m->h.nblocks) return false;
+        it->p = mfx_block_start(m, it->block);
+        if(!it->p) return false;
+        it->left = mfx_block_count(m, it->block);
+        it->len = 0;
+    }
+    uint64_t shared, suffix;
+    if(!mfx_varint(&it->p, end, &shared)) return false;
+    if(!mfx_varint(&it->p, end, &suffix)) return false;
+    if(shared > it->len || suffix > m->h.max_len - shared) return false;
+    if(suffix > (uint64_t)(end - it->p)) return false;
+    memcpy(it->buf + shared, it->p, (size_t)suffix);
+    it->p += suffix;
+    it->len = (size_t)(shared + suffix);
+    *out = (mfx_entry_t){ .name = it->buf, .len = it->len };
+    if(m->h.flags & MFX_STAT){
+        uint64_t sec, nsec;
+        if(!mfx_varint(&it->p, end, &out->size)) return false;
+        if(!mfx_varint(&it->p, end, &sec)) return false;
+        if(!mfx_varint(&it->p, end, &nsec)) return false;
+        out->mtime_sec = (int64_t)sec;
+        out->mtime_nsec = (uint32_t)nsec;
+    }
+    it->left--;
+    return true;
+}
+
+static inline int mfx_cmp(
+    const char *a, size_t alen, const char *b, size_t blen
+){
+    int cmp = memcmp(a, b, alen < blen ? alen : blen);
+    if(cmp) return cmp;
+    return (alen > blen) - (alen < blen);
+}
+
+// the first name of a block is stored whole, so it can be read in place
+static inline bool mfx_block_first(
+    const mfx_t *m, uint64_t block, const char **name, size_t *len
+){
+    const unsigned char *p = mfx_block_start(m, block);
+    const unsigned char *end = m->data + m->h.index_off;
+    uint64_t shared, suffix;
+    if(!p) return false;
+    if(!mfx_varint(&p, end, &shared) || shared) return false;
+    if(!mfx_varint(&p, end, &suffix)) return false;
+    if(suffix > (uint64_t)(end - p)) return false;
+    *name = (const char*)p;
+    *len = (size_t)suffix;
+    return true;
+}
+
+/* start an iterator at the first entry not less than key; the iterator must
+   be freed with mfx_iter_free() */
+static inline int mfx_seek(
+    mfx_iter_t *it, const mfx_t *m, const char *key, size_t len
+){
+    *it = (mfx_iter_t){ .m = m };
+    it->buf = malloc((size_t)m->h.max_len + 1);
+    if(!it->buf) return 1;
+    // with no blocks, mfx_next() finds nothing
+    if(!m->h.nblocks) return 0;
+    // find the last block whose first name is not greater than key
+    uint64_t lo = 0;
+    uint64_t hi = m->h.nblocks;
+    while(lo < hi){
+        uint64_t mid = lo + (hi - lo) / 2;
+        const char *name;
+        size_t nlen;
+        if(!mfx_block_first(m, mid, &name, &nlen)) return 1;
+        if(mfx_cmp(name, nlen, key, len) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    uint64_t block = lo ? lo - 1 : 0;
+    // start at that block, then skip entries less than key
+    it->block = block;
+    it->p = mfx_block_start(m, block);
+    if(!it->p) return 1;
+    it->left = mfx_block_count(m, block);
+    while(it->left){
+        /* peeking shares the buffer, which is harmless: the entry it decodes
+           starts with the same shared prefix that decoding it again needs */
+        mfx_iter_t peek = *it;
+        mfx_entry_t e;
+        if(!mfx_next(&peek, &e)) return 1;
+        if(mfx_cmp(e.name, e.len, key, len) >= 0) break;
+        *it = peek;
+    }
+    return 0;
+}
+
+static inline void mfx_iter_free(mfx_iter_t *it){
+    free(it->buf);
+    it->buf = NULL;
+}
+
+/* look up a name; returns 1 if found (filling *out, whose name points into
+   the iterator's buffer until mfx_iter_free()), 0 if not, -1 on error */
+static inline int mfx_find(
+    const mfx_t *m, const char *name, size_t len, mfx_iter_t *it,
+    mfx_entry_t *out
+){
+    if(mfx_seek(it, m, name, len)) return -1;
+    if(!mfx_next(it, out)) return 0;
+    return mfx_cmp(out->name, out->len, name, len) == 0;
+}
+
+/* with an iterator from mfx_seek(it, m, prefix, len), return the next entry
+   starting with prefix, or false once they run out */
+static inline bool mfx_next_prefixed(
+    mfx_iter_t *it, const char *prefix, size_t len, mfx_entry_t *out
+){
+    if(!mfx_next(it, out)) return false;
+    return out->len >= len && memcmp(out->name, prefix, len) == 0;
+}
+
+static inline bool mfx_parse_header(mfx_t *m){
+    if(m->len < MFX_HEADER_SIZE) return false;
+    if(memcmp(m->data, MFX_MAGIC, 8)) return false;
+    m->h = (mfx_header_t){
+        .count = mfx_get64(m->data + 8),
+        .nblocks = mfx_get64(m->data + 16),
+        .block = mfx_get64(m->data + 24),
+        .flags = mfx_get64(m->data + 32),
+        .max_len = mfx_get64(m->data + 40),
+        .index_off = mfx_get64(m->data + 48),
+    };
+    if(!m->h.block || m->h.index_off > m->len) return false;
+    if(m->h.nblocks != (m->h.count + m->h.block - 1) / m->h.block){
+        return false;
+    }
+    return m->h.nblocks <= (m->len - m->h.index_off) / 8;
+}
+
+#ifndef _WIN32 // UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// returns 0 on success, or 1 with errno set (EINVAL if malformed)
+static inline int mfx_open(mfx_t *m, const char *path){
+    *m = (mfx_t){0};
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return 1;
+    struct stat s;
+    if(fstat(fd, &s)){
+        close(fd);
+        return 1;
+    }
+    m->len = (size_t)s.st_size;
+    if(m->len){
+        void *p = mmap(NULL, m->len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(p == MAP_FAILED){
+            close(fd);
+            return 1;
+        }
+        m->data = p;
+        m->mapped = true;
+    }
+    close(fd);
+    if(!mfx_parse_header(m)){
+        if(m->mapped) munmap((void*)m->data, m->len);
+        *m = (mfx_t){0};
+        errno = EINVAL;
+        return 1;
+    }
+    return 0;
+}
+
+static inline void mfx_close(mfx_t *m){
+    if(m->mapped) munmap((void*)m->data, m->len);
+    *m = (mfx_t){0};
+}
+
+#else // WINDOWS
+#include <windows.h>
+
+static inline void mfx_close(mfx_t *m){
+    if(m->data) UnmapViewOfFile(m->data);
+    if(m->mapping) CloseHandle(m->mapping);
+    if(m->file) CloseHandle(m->file);
+    *m = (mfx_t){0};
+}
+
+// returns 0 on success, or 1 (see GetLastError())
+static inline int mfx_open(mfx_t *m, const char *path){
+    *m = (mfx_t){0};
+    HANDLE file = CreateFileA(
+        path,
+        GENERIC_READ,
+        FILE_SHARE_DELETE|FILE_SHARE_READ|FILE_SHARE_WRITE,
+        NULL,
+        OPEN_EXISTING,
+        0,
+        NULL
+    );
+    if(file == INVALID_HANDLE_VALUE) return 1;
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size) || size.QuadPart < MFX_HEADER_SIZE){
+        CloseHandle(file);
+        SetLastError(ERROR_INVALID_DATA);
+        return 1;
+    }
+    HANDLE mapping = CreateFileMappingA(
+        file, NULL, PAGE_READONLY, 0, 0, NULL
+    );
+    if(!mapping){
+        CloseHandle(file);
+        return 1;
+    }
+    const void *p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(!p){
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return 1;
+    }
+    m->data = p;
+    m->len = (size_t)size.QuadPart;
+    m->file = file;
+    m->mapping = mapping;
+    if(!mfx_parse_header(m)){
+        mfx_close(m);
+        SetLastError(ERROR_INVALID_DATA);
+        return 1;
+    }
+    return 0;
+}
+
+#endif
+
+#endif // MFX_H
@@ -0,0 +1,1406 @@
+#include "manifest.c"
+
+#include <stdarg.h>
+#include <time.h>
+#ifndef _WIN32 // UNIX
+    #include <dirent.h>
+    #define NULL_DEVICE "/dev/null"
+#else // WINDOWS
+    #include <io.h>
+    #define dup _dup
+    #define dup2 _dup2
+    #define NULL_DEVICE "NUL"
+#endif
+
+#define ASSERT(code) do { \
+    if(!(code)){ \
+        fprintf(stderr, "ASSERT(" #code ") failed\n"); \
+        retval = 1; \
+    } \
+} while(0)
+
+// every test works in this directory, which is removed afterwards
+#define T "manifest_test_tmp/"
+
+// assumes errors are non-recoverable
+void put(const char *path, const char *text){
+    FILE *f = fopen(path, "wb");
+    if(!f){
+        perror(path);
+        exit(2);
+    }
+    size_t len = strlen(text);
+    if(fwrite(text, 1, len, f) != len || fclose(f)){
+        perror(path);
+        exit(3);
+    }
+}
+
+// true if path exists and holds exactly text
+bool has(const char *path, const char *text){
+    string_t got;
+    FILE *f = fopen(path, "rb");
+    if(!f) return false;
+    int ret = read_stream(f, &got);
+    fclose(f);
+    if(ret) return false;
+    bool ok = got.len == strlen(text) && !memcmp(got.text, text, got.len);
+    if(!ok) fprintf(stderr, "%s: %.*s", path, (int)got.len, got.text);
+    free(got.text);
+    return ok;
+}
+
+bool exists(const char *path){
+    filetime_t t;
+    return get_filetime(path, &t) == 0;
+}
+
+filetime_t mtime(const char *path){
+    filetime_t t;
+    if(get_filetime(path, &t)){
+        fprintf(stderr, "unable to stat %s\n", path);
+        exit(4);
+    }
+    return t;
+}
+
+bool same_time(filetime_t a, filetime_t b){
+    return !isnewer(a, b) && !isnewer(b, a);
+}
+
+// set the modification time of path to secs seconds ago
+void age(const char *path, int secs){
+    filetime_t t;
+#ifndef _WIN32 // UNIX
+    t = (filetime_t){ .tv_sec = time(NULL) - secs };
+#else // WINDOWS
+    GetSystemTimeAsFileTime(&t);
+    ULARGE_INTEGER u;
+    u.LowPart = t.dwLowDateTime;
+    u.HighPart = t.dwHighDateTime;
+    u.QuadPart -= (ULONGLONG)secs * 10000000;
+    t.dwLowDateTime = u.LowPart;
+    t.dwHighDateTime = u.HighPart;
+#endif
+    if(compat_set_mtime(path, t)){
+        fprintf(stderr, "unable to set mtime of %s\n", path);
+        exit(5);
+    }
+}
+
+// run manifest with a NULL-terminated list of arguments
+int run(const char *arg, ...){
+    char *argv[32] = { "manifest" };
+    int argc = 1;
+    va_list ap;
+    va_start(ap, arg);
+    for(; arg; arg = va_arg(ap, const char*)){
+        if(argc == 31){
+            fprintf(stderr, "too many arguments to run()\n");
+            exit(6);
+        }
+        argv[argc++] = (char*)arg;
+    }
+    va_end(ap);
+    return manifest_main(argc, argv);
+}
+
+// drop stderr for a test which expects errors; returns the real stderr
+int quiet(void){
+    fflush(stderr);
+    int saved = dup(2);
+    FILE *f = fopen(NULL_DEVICE, "w");
+    if(saved < 0 || !f){
+        perror("quiet");
+        exit(8);
+    }
+    dup2(fileno(f), 2);
+    fclose(f);
+    return saved;
+}
+
+void unquiet(int saved){
+    fflush(stderr);
+    dup2(saved, 2);
+    close(saved);
+}
+
+// remove a directory and everything in it
+void rm_tree(const char *dir){
+    char path[1024];
+#ifndef _WIN32 // UNIX
+    DIR *d = opendir(dir);
+    if(!d) return;
+    struct dirent *entry;
+    while((entry = readdir(d))){
+        const char *name = entry->d_name;
+        if(!strcmp(name, ".") || !strcmp(name, "..")) continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        if(unlink(path)) rm_tree(path);
+    }
+    closedir(d);
+    rmdir(dir);
+#else // WINDOWS
+    WIN32_FIND_DATAA ffd;
+    snprintf(path, sizeof(path), "%s/*", dir);
+    HANDLE h = FindFirstFileA(path, &ffd);
+    if(h == INVALID_HANDLE_VALUE) return;
+    do{
+        const char *name = ffd.cFileName;
+        if(!strcmp(name, ".") || !strcmp(name, "..")) continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        if(ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) rm_tree(path);
+        else remove(path);
+    }while(FindNextFileA(h, &ffd));
+    FindClose(h);
+    _rmdir(dir);
+#endif
+}
+
+void make_dir(const char *dir){
+#ifndef _WIN32 // UNIX
+    int ret = mkdir(dir, 0777);
+#else // WINDOWS
+    int ret = _mkdir(dir);
+#endif
+    if(ret){
+        perror(dir);
+        exit(7);
+    }
+}
+
+// the files which tests list, all modified well in the past
+#define A T "a"
+#define B T "b"
+#define C T "c"
+#define E T "d/e"
+#define F T "d/f"
+
+void prep_files(void){
+    rm_tree(T);
+    make_dir(T);
+    make_dir(T "d");
+    const char *files[] = { A, B, C, E, F };
+    for(size_t i = 0; i < sizeof(files) / sizeof(*files); i++){
+        put(files[i], files[i]);
+        age(files[i], 1000);
+    }
+}
+
+/* The checks which every mode must pass, for a manifest written from the
+   list in T "in" with some extra arguments (NULL-terminated):
+     - the first run writes exp to out (or skips that check if exp is NULL)
+     - a rerun with nothing changed leaves out alone
+     - touching a listed file touches out */
+int mode_case(
+    const char *name,
+    const char *in,
+    const char *out,
+    const char *exp,
+    const char *touch_me,
+    const char **args
+){
+    int retval = 0;
+    prep_files();
+    put(T "in", in);
+
+    const char *argv[16] = { "manifest" };
+    int argc = 1;
+    for(; *args; args++) argv[argc++] = *args;
+    argv[argc++] = "-i";
+    argv[argc++] = T "in";
+    argv[argc++] = out;
+
+    ASSERT(manifest_main(argc, (char**)argv) == 0);
+    if(exp) ASSERT(has(out, exp));
+
+    // the out file must be newer than everything listed, but not now
+    age(out, 100);
+    filetime_t before = mtime(out);
+    ASSERT(manifest_main(argc, (char**)argv) == 0);
+    ASSERT(same_time(mtime(out), before));
+    if(exp) ASSERT(has(out, exp));
+
+    age(touch_me, 0);
+    ASSERT(manifest_main(argc, (char**)argv) == 0);
+    ASSERT(isnewer(mtime(out), before));
+    if(exp) ASSERT(has(out, exp));
+
+    if(retval) fprintf(stderr, "mode_case(%s) failed\n", name);
+    return retval;
+}
+
+int test_plain(void){
+    int retval = 0;
+    const char *none[] = { NULL };
+    const char *exp = A "\n" B "\n" C "\n" E "\n" F "\n";
+
+    retval |= mode_case(
+        "unsorted", C "\n" A "\n" F "\n" B "\n" E "\n", T "out", exp, B, none
+    );
+    retval |= mode_case(
+        "no trailing newline",
+        F "\n" E "\n" C "\n" B "\n" A, T "out", exp, A, none
+    );
+    retval |= mode_case(
+        "crlf", B "\r\n" A "\r\n" C "\r\n" F "\r\n" E "\r\n", T "out", exp, F,
+        none
+    );
+    // put() stops at the first nul, so write the -0 list by hand
+    char in[256];
+    const char *names[] = { E, A, F, C, B };
+    size_t len = 0;
+    for(size_t i = 0; i < 5; i++){
+        size_t n = strlen(names[i]) + 1;
+        memcpy(in + len, names[i], n);
+        len += n;
+    }
+    prep_files();
+    FILE *f = fopen(T "in", "wb");
+    ASSERT(f && fwrite(in, 1, len, f) == len && !fclose(f));
+    ASSERT(run("-0", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(has(T "out", exp));
+
+    // a change to the list rewrites OUTPUT, even when nothing is newer
+    prep_files();
+    put(T "in", A "\n" B "\n");
+    ASSERT(run("-i", T "in", T "out", NULL) == 0);
+    age(T "out", 100);
+    put(T "in", A "\n" B "\n" C "\n");
+    ASSERT(run("-i", T "in", T "out", NULL) == 0);
+    ASSERT(has(T "out", A "\n" B "\n" C "\n"));
+
+    // a listed file which is missing when it is checked is an error
+    prep_files();
+    put(T "in", A "\n" T "missing\n");
+    ASSERT(run("-i", T "in", T "out", NULL) == 0);
+    int saved = quiet();
+    int ret = run("-i", T "in", T "out", NULL);
+    unquiet(saved);
+    ASSERT(ret != 0);
+
+    return retval;
+}
+
+// more files than one stat worker takes at a time (STAT_BATCH)
+#define NMANY 100
+
+// write T "many/0" through T "many/99", all modified well in the past, and
+// list them (in reverse) in T "in"
+void prep_many(void){
+    prep_files();
+    make_dir(T "many");
+    FILE *f = fopen(T "in", "wb");
+    if(!f){
+        perror(T "in");
+        exit(2);
+    }
+    char path[64];
+    for(int i = NMANY - 1; i >= 0; i--){
+        snprintf(path, sizeof(path), T "many/%d", i);
+        put(path, path);
+        age(path, 1000);
+        fprintf(f, "%s\n", path);
+    }
+    fclose(f);
+}
+
+int jobs_case(const char *touch_me){
+    int retval = 0;
+    prep_many();
+    ASSERT(run("-j", "4", "-i", T "in", T "out", NULL) == 0);
+    age(T "out", 100);
+    filetime_t before = mtime(T "out");
+    ASSERT(run("-j", "4", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(same_time(mtime(T "out"), before));
+    age(touch_me, 0);
+    ASSERT(run("-j", "4", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(isnewer(mtime(T "out"), before));
+    if(retval) fprintf(stderr, "jobs_case(%s) failed\n", touch_me);
+    return retval;
+}
+
+int test_jobs(void){
+    int retval = 0;
+    const char *jobs[] = { "-j", "4", NULL };
+    retval |= mode_case(
+        "-j 4",
+        C "\n" A "\n" F "\n" B "\n" E "\n",
+        T "out",
+        A "\n" B "\n" C "\n" E "\n" F "\n",
+        E,
+        jobs
+    );
+    // a newer file is found wherever it falls among the workers' batches
+    retval |= jobs_case(T "many/0");
+    retval |= jobs_case(T "many/50");
+    retval |= jobs_case(T "many/99");
+    return retval;
+}
+
+// true if any file directly in dir has needle in its name
+bool dir_has(const char *dir, const char *needle){
+    bool found = false;
+#ifndef _WIN32 // UNIX
+    DIR *d = opendir(dir);
+    if(!d) return false;
+    struct dirent *entry;
+    while(!found && (entry = readdir(d))){
+        found = strstr(entry->d_name, needle) != NULL;
+    }
+    closedir(d);
+#else // WINDOWS
+    char path[1024];
+    WIN32_FIND_DATAA ffd;
+    snprintf(path, sizeof(path), "%s/*", dir);
+    HANDLE h = FindFirstFileA(path, &ffd);
+    if(h == INVALID_HANDLE_VALUE) return false;
+    do{
+        found = strstr(ffd.cFileName, needle) != NULL;
+    }while(!found && FindNextFileA(h, &ffd));
+    FindClose(h);
+#endif
+    return found;
+}
+
+/* run the --max-mem path with a budget far below what the command line
+   allows, so that even a short list is sorted in several spilled runs */
+int external(char **inputs, size_t ninputs, bool presorted, bool fp){
+    opts_t opts = {
+        .jobs = 1,
+        .max_mem = 4096,
+        .inputs = inputs,
+        .ninputs = ninputs,
+        .presorted = presorted,
+        .fingerprint = fp,
+    };
+    return manifest(T "out", opts);
+}
+
+// the --max-mem checks, given the same list written by the in-memory path
+int external_case(
+    const char *name, char **inputs, size_t ninputs, bool presorted, bool fp
+){
+    int retval = 0;
+    ASSERT(external(inputs, ninputs, presorted, fp) == 0);
+    string_t exp;
+    ASSERT(read_input(T "ref", &exp) == 0);
+    char *exp_text = malloc(exp.len + 1);
+    if(!exp_text){
+        perror("malloc");
+        exit(9);
+    }
+    memcpy(exp_text, exp.text, exp.len);
+    exp_text[exp.len] = '\0';
+    free(exp.text);
+    ASSERT(has(T "out", exp_text));
+    // spilled runs are cleaned up
+    ASSERT(!dir_has(T, ".run"));
+
+    age(T "out", 100);
+    filetime_t before = mtime(T "out");
+    ASSERT(external(inputs, ninputs, presorted, fp) == 0);
+    ASSERT(same_time(mtime(T "out"), before));
+    ASSERT(has(T "out", exp_text));
+
+    age(T "many/42", 0);
+    ASSERT(external(inputs, ninputs, presorted, fp) == 0);
+    ASSERT(isnewer(mtime(T "out"), before));
+    ASSERT(has(T "out", exp_text));
+    ASSERT(!dir_has(T, ".run"));
+
+    free(exp_text);
+    if(retval) fprintf(stderr, "external_case(%s) failed\n", name);
+    return retval;
+}
+
+int test_max_mem(void){
+    int retval = 0;
+    char *in[] = { T "in" };
+    char *sorted[] = { T "sorted" };
+    char *halves[] = { T "half0", T "half1" };
+
+    prep_many();
+    ASSERT(run("-i", T "in", T "ref", NULL) == 0);
+    retval |= external_case("unsorted", in, 1, false, false);
+
+    prep_many();
+    ASSERT(run("-i", T "in", T "ref", NULL) == 0);
+    retval |= external_case("fingerprint", in, 1, false, true);
+
+    // --sorted inputs are merged without any runs
+    prep_many();
+    ASSERT(run("-i", T "in", T "ref", NULL) == 0);
+    ASSERT(compat_rename(T "ref", T "sorted") == 0);
+    ASSERT(run("-i", T "sorted", T "ref", NULL) == 0);
+    retval |= external_case("presorted", sorted, 1, true, false);
+
+    // two inputs, each spilled on its own, then merged
+    prep_many();
+    FILE *f0 = fopen(T "half0", "wb");
+    FILE *f1 = fopen(T "half1", "wb");
+    ASSERT(f0 && f1);
+    if(f0 && f1){
+        for(int i = 0; i < NMANY; i++){
+            fprintf(i % 2 ? f1 : f0, T "many/%d\n", i);
+        }
+    }
+    if(f0) fclose(f0);
+    if(f1) fclose(f1);
+    ASSERT(run("-i", T "half0", "-i", T "half1", T "ref", NULL) == 0);
+    retval |= external_case("two inputs", halves, 2, false, false);
+
+    // a changed list is rewritten
+    prep_many();
+    ASSERT(external(in, 1, false, false) == 0);
+    age(T "out", 100);
+    put(T "in", A "\n" B "\n");
+    ASSERT(external(in, 1, false, false) == 0);
+    ASSERT(has(T "out", A "\n" B "\n"));
+
+    return retval;
+}
+
+/* split() with line lengths which put separators at every offset within
+   and across 16-byte blocks, against a simple reference */
+int split_case(const char *sep, size_t seplen, bool detect, uint64_t seed){
+    int retval = 0;
+    char text[8192];
+    string_t exp[512];
+    size_t nexp = 0;
+    size_t len = 0;
+    while(len + 64 + 2 * seplen < sizeof(text) && nexp < 512){
+        seed = seed * 6364136223846793005u + 1442695040888963407u;
+        size_t n = (size_t)(seed >> 58);
+        if(n){
+            exp[nexp++] = (string_t){ .text = &text[len], .len = n };
+            for(size_t i = 0; i < n; i++) text[len++] = 'a' + (char)(i % 26);
+        }
+        // empty names, from n == 0 or doubled separators, are dropped
+        for(size_t k = 0; k < 1 + ((seed >> 20) % 8 == 0); k++){
+            memcpy(&text[len], sep, seplen);
+            len += seplen;
+        }
+    }
+    // the names must be compared before split() mangles the text
+    char copy[8192];
+    memcpy(copy, text, len);
+    for(size_t i = 0; i < nexp; i++) exp[i].text = copy + (exp[i].text - text);
+
+    string_t *got;
+    size_t ngot;
+    string_t all = { .text = text, .len = len };
+    string_t with = { .text = (char*)sep, .len = detect ? 0 : seplen };
+    ASSERT(split(all, with, &got, &ngot) == 0);
+    ASSERT(ngot == nexp);
+    bool same = true;
+    for(size_t i = 0; i < ngot && i < nexp; i++){
+        same &= string_eq(got[i], exp[i]);
+    }
+    ASSERT(same);
+    free(got);
+    if(retval){
+        fprintf(stderr, "split_case(%zu, %d) failed\n", seplen, (int)detect);
+    }
+    return retval;
+}
+
+int test_split(void){
+    int retval = 0;
+    const char *seps[] = { "\n", "\r\n", "\n\r", "\r", "" };
+    for(size_t i = 0; i < sizeof(seps) / sizeof(*seps); i++){
+        // "" stands in for "\0", which is one byte long
+        size_t seplen = strlen(seps[i]) ? strlen(seps[i]) : 1;
+        for(uint64_t seed = 0; seed < 4; seed++){
+            retval |= split_case(seps[i], seplen, false, seed);
+            retval |= split_case(seps[i], seplen, true, seed);
+        }
+    }
+    return retval;
+}
+
+// a deterministic list of n names over a small alphabet, so that many of
+// them share long prefixes; free both *text and the list
+string_t *gen_names(size_t n, uint64_t seed, char **text_out){
+    static const char alphabet[] = "ab/.\x7f\x80\xff";
+    string_t *names = malloc((n ? n : 1) * sizeof(*names));
+    char *text = malloc((n ? n : 1) * 12);
+    if(!names || !text){
+        perror("malloc");
+        exit(9);
+    }
+    for(size_t i = 0; i < n; i++){
+        seed = seed * 6364136223846793005u + 1442695040888963407u;
+        size_t len = 1 + (size_t)(seed >> 60) % 12;
+        names[i] = (string_t){ .text = text + 12 * i, .len = len };
+        for(size_t j = 0; j < len; j++){
+            seed = seed * 6364136223846793005u + 1442695040888963407u;
+            names[i].text[j] = alphabet[(seed >> 40) % (sizeof(alphabet) - 1)];
+        }
+    }
+    *text_out = text;
+    return names;
+}
+
+// checks that a radix_sort() done callback sees every name, in order
+typedef struct {
+    const string_t *exp;
+    size_t seen;
+    bool ok;
+} done_check_t;
+
+void done_check(void *arg, const string_t *names, size_t n){
+    done_check_t *check = arg;
+    for(size_t i = 0; i < n; i++){
+        if(!string_eq(names[i], check->exp[check->seen++])) check->ok = false;
+    }
+}
+
+int radix_sort_case(size_t n, int jobs, uint64_t seed){
+    int retval = 0;
+    char *text;
+    string_t *names = gen_names(n, seed, &text);
+    string_t *exp = malloc((n ? n : 1) * sizeof(*exp));
+    if(!exp){
+        perror("malloc");
+        exit(9);
+    }
+    memcpy(exp, names, n * sizeof(*exp));
+    qsort(exp, n, sizeof(*exp), cmp_string);
+
+    done_check_t check = { .exp = exp, .ok = true };
+    ASSERT(radix_sort(names, n, jobs, done_check, &check) == 0);
+    ASSERT(check.ok && check.seen == n);
+    bool same = true;
+    for(size_t i = 0; i < n; i++) same &= string_eq(names[i], exp[i]);
+    ASSERT(same);
+    ASSERT(is_sorted(names, n));
+
+    if(retval) fprintf(stderr, "radix_sort_case(%zu, %d) failed\n", n, jobs);
+    free(text);
+    free(names);
+    free(exp);
+    return retval;
+}
+
+int test_radix_sort(void){
+    int retval = 0;
+
+    // around the insertion sort cutoff, and a few full radix passes
+    size_t sizes[] = { 0, 1, 2, RADIX_SMALL, RADIX_SMALL + 1, 1000, 70000 };
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++){
+        retval |= radix_sort_case(sizes[i], 1, i);
+    }
+
+    // long lists are split among threads, which finish ranges out of order
+    retval |= radix_sort_case(RADIX_PARALLEL + 12345, 4, 7);
+
+    // -u drops duplicates after sorting
+    const char *unique[] = { "-u", NULL };
+    retval |= mode_case(
+        "-u",
+        C "\n" A "\n" C "\n" B "\n" A "\n", T "out", A "\n" B "\n" C "\n", C,
+        unique
+    );
+
+    return retval;
+}
+
+int test_front_coding(void){
+    int retval = 0;
+
+    // encoding sorted names and decoding them again is lossless
+    char *text;
+    string_t *names = gen_names(2000, 11, &text);
+    ASSERT(radix_sort(names, 2000, 1, NULL, NULL) == 0);
+    string_t *recs;
+    char *buf;
+    ASSERT(fc_encode(names, 2000, &recs, &buf) == 0);
+    size_t total = 0;
+    for(size_t i = 0; i < 2000; i++) total += recs[i].len + 1;
+    char *joined = malloc(total);
+    char *plain = malloc(total * 2);
+    if(!joined || !plain){
+        perror("malloc");
+        exit(9);
+    }
+    size_t jlen = 0;
+    size_t plen = 0;
+    for(size_t i = 0; i < 2000; i++){
+        memcpy(&joined[jlen], recs[i].text, recs[i].len);
+        jlen += recs[i].len;
+        joined[jlen++] = '\n';
+        memcpy(&plain[plen], names[i].text, names[i].len);
+        plen += names[i].len;
+        plain[plen++] = '\n';
+    }
+    string_t decoded;
+    string_t coded = { .text = joined, .len = jlen };
+    ASSERT(fc_decode_text(coded, &decoded) == 0);
+    ASSERT(decoded.len == plen && !memcmp(decoded.text, plain, plen));
+    free(decoded.text);
+
+    // fc_decode() does the same to a list of records, in place
+    size_t n = 2000;
+    char *dbuf;
+    ASSERT(fc_decode(recs, &n, &dbuf) == 0);
+    ASSERT(n == 2000);
+    bool same = true;
+    for(size_t i = 0; i < n; i++) same &= string_eq(recs[i], names[i]);
+    ASSERT(same);
+    free(dbuf);
+    free(recs);
+    free(buf);
+    free(joined);
+    free(plain);
+    free(names);
+    free(text);
+
+    // a record may not share more than the previous name had
+    string_t bad = { .text = "0 ab\n3 c\n", .len = 9 };
+    int saved = quiet();
+    int ret = fc_decode_text(bad, &decoded);
+    unquiet(saved);
+    ASSERT(ret != 0);
+
+    // T is 18 bytes, shared by every name
+    const char *fc =
+        "0 " A "\n" "18 b\n" "18 c\n" "18 d/e\n" "20 f\n";
+    const char *plain_in = E "\n" C "\n" A "\n" F "\n" B "\n";
+    const char *plain_out = A "\n" B "\n" C "\n" E "\n" F "\n";
+    const char *read_fc[] = { "--front-coded", NULL };
+    const char *store_fc[] = { "--store-front-coded", NULL };
+    const char *both_fc[] = { "--front-coded", "--store-front-coded", NULL };
+    retval |= mode_case("--front-coded", fc, T "out", plain_out, C, read_fc);
+    retval |= mode_case(
+        "--store-front-coded", plain_in, T "out", fc, E, store_fc
+    );
+    retval |= mode_case(
+        "--front-coded --store-front-coded", fc, T "out", fc, F, both_fc
+    );
+
+    return retval;
+}
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed, size_t chunk){
+    xxh64_t x;
+    xxh64_init(&x, seed);
+    const unsigned char *p = data;
+    for(size_t off = 0; off < len; off += chunk){
+        xxh64_update(&x, p + off, len - off < chunk ? len - off : chunk);
+    }
+    return xxh64_final(&x);
+}
+
+int test_hash(void){
+    int retval = 0;
+
+    // reference digests, from the xxhash python package
+    const char *s = "Nobody inspects the spammish repetition";
+    unsigned char t[200];
+    for(size_t i = 0; i < sizeof(t); i++) t[i] = (unsigned char)i;
+    ASSERT(xxh64("", 0, 0, 1) == 0xef46db3751d8e999u);
+    ASSERT(xxh64("a", 1, 0, 1) == 0xd24ec4f1a98c6e5bu);
+    ASSERT(xxh64(s, strlen(s), 0, 64) == 0xfbcea83c8a378bf1u);
+    // any way of splitting the input gives the same digest
+    size_t chunks[] = { 1, 7, 32, 33, 200 };
+    for(size_t i = 0; i < sizeof(chunks) / sizeof(*chunks); i++){
+        ASSERT(xxh64(t, 200, 0, chunks[i]) == 0x50dc1079b99e879cu);
+        ASSERT(xxh64(t, 200, 1, chunks[i]) == 0x20bd094800cb1dfau);
+    }
+
+    prep_files();
+    uint64_t h;
+    ASSERT(hash_file(A, &h) == 0);
+    ASSERT(h == xxh64(A, strlen(A), 0, 1));
+
+    // --hash only touches OUTPUT when the content of a listed file changes
+    put(T "in", C "\n" A "\n" B "\n");
+    ASSERT(run("--hash", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(has(T "out", A "\n" B "\n" C "\n"));
+    ASSERT(exists(T "out.hash"));
+    age(T "out", 100);
+    filetime_t before = mtime(T "out");
+    ASSERT(run("--hash", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(same_time(mtime(T "out"), before));
+
+    age(B, 0);
+    ASSERT(run("--hash", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(same_time(mtime(T "out"), before));
+    // and having checked B once, the next run need not hash it again
+    ASSERT(run("--hash", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(same_time(mtime(T "out"), before));
+
+    put(B, "new content");
+    age(B, 0);
+    ASSERT(run("--hash", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(isnewer(mtime(T "out"), before));
+
+    return retval;
+}
+
+// the list part of a fingerprint file, or all zeros if it can't be read
+fingerprint_t fp_of(const char *path){
+    fingerprint_t fp = {0};
+    FILE *f = fopen(path, "rb");
+    if(!f) return fp;
+    if(fread(&fp, sizeof(fp), 1, f) != 1) fp = (fingerprint_t){0};
+    fclose(f);
+    return fp;
+}
+
+bool same_list(fingerprint_t a, fingerprint_t b){
+    return a.count == b.count && a.bytes == b.bytes
+        && a.digest[0] == b.digest[0] && a.digest[1] == b.digest[1];
+}
+
+fingerprint_t expect_fp(bool front_coded){
+    const char *names[] = { A, B, C, E, F };
+    fingerprinter_t f;
+    fingerprint_begin(&f, front_coded, false);
+    for(size_t i = 0; i < 5; i++){
+        fingerprint_add(&f, (string_t){
+            .text = (char*)names[i], .len = strlen(names[i])
+        });
+    }
+    fingerprint_t fp;
+    fingerprint_end(&f, &fp);
+    return fp;
+}
+
+int test_fingerprint(void){
+    int retval = 0;
+    const char *unsorted = C "\n" A "\n" F "\n" B "\n" E "\n";
+    const char *sorted = A "\n" B "\n" C "\n" E "\n" F "\n";
+    fingerprint_t exp = expect_fp(false);
+    const char *fp[] = { "--fingerprint", NULL };
+    const char *fp_u[] = { "--fingerprint", "-u", NULL };
+
+    retval |= mode_case("--fingerprint", unsorted, T "out", sorted, A, fp);
+    ASSERT(same_list(fp_of(T "out.fp"), exp));
+
+    // every way of arriving at the same list gives the same fingerprint
+    retval |= mode_case(
+        "--fingerprint -u", C "\n" A "\n" F "\n" C "\n" B "\n" E "\n" A,
+        T "out", sorted, B, fp_u
+    );
+    ASSERT(same_list(fp_of(T "out.fp"), exp));
+
+    prep_files();
+    put(T "in", sorted);
+    ASSERT(run("--fingerprint", "--sorted", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(same_list(fp_of(T "out.fp"), exp));
+
+    prep_files();
+    put(T "in", sorted);
+    ASSERT(run("--fingerprint", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(same_list(fp_of(T "out.fp"), exp));
+
+    prep_files();
+    put(T "half0", F "\n" A "\n" C "\n");
+    put(T "half1", E "\n" B "\n");
+    ASSERT(run(
+        "--fingerprint", "-i", T "half0", "-i", T "half1", T "out", NULL
+    ) == 0);
+    ASSERT(same_list(fp_of(T "out.fp"), exp));
+
+    prep_files();
+    put(T "in", unsorted);
+    char *in[] = { T "in" };
+    ASSERT(external(in, 1, false, true) == 0);
+    ASSERT(same_list(fp_of(T "out.fp"), exp));
+
+    // a front-coded list has a fingerprint of its own
+    const char *fp_fc[] = { "--fingerprint", "--store-front-coded", NULL };
+    retval |= mode_case(
+        "--fingerprint --store-front-coded", unsorted, T "out", NULL, C, fp_fc
+    );
+    ASSERT(same_list(fp_of(T "out.fp"), expect_fp(true)));
+    ASSERT(!same_list(expect_fp(true), exp));
+
+    // an OUTPUT changed behind our back is read and repaired
+    prep_files();
+    put(T "in", unsorted);
+    ASSERT(run("--fingerprint", "-i", T "in", T "out", NULL) == 0);
+    put(T "out", A "\n");
+    age(T "out", 100);
+    ASSERT(run("--fingerprint", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(has(T "out", sorted));
+
+    // a damaged fingerprint is ignored, and replaced without touching OUTPUT
+    put(T "out.fp", "junk");
+    age(T "out", 100);
+    filetime_t before = mtime(T "out");
+    ASSERT(run("--fingerprint", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(same_time(mtime(T "out"), before));
+    ASSERT(same_list(fp_of(T "out.fp"), exp));
+
+    return retval;
+}
+
+int test_delta(void){
+    int retval = 0;
+    const char *delta[] = { "--delta", NULL };
+    retval |= mode_case(
+        "--delta", C "\n" A "\n" B "\n", T "out", A "\n" B "\n" C "\n", A,
+        delta
+    );
+
+    // the first run adds everything
+    prep_files();
+    put(T "in", B "\n" A "\n");
+    ASSERT(run("--delta", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(has(T "out.added", A "\n" B "\n"));
+    ASSERT(has(T "out.removed", ""));
+    ASSERT(has(T "out.modified", ""));
+
+    // one file in, one out, and one modified
+    put(T "in", C "\n" B "\n");
+    age(T "out", 100);
+    age(B, 0);
+    ASSERT(run("--delta", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(has(T "out", B "\n" C "\n"));
+    ASSERT(has(T "out.added", C "\n"));
+    ASSERT(has(T "out.removed", A "\n"));
+    ASSERT(has(T "out.modified", B "\n"));
+
+    // a run which changes nothing leaves every file alone
+    age(B, 1000);
+    const char *files[] = {
+        T "out", T "out.added", T "out.removed", T "out.modified"
+    };
+    filetime_t before[4];
+    for(size_t i = 0; i < 4; i++){
+        age(files[i], 50);
+        before[i] = mtime(files[i]);
+    }
+    ASSERT(run("--delta", "-i", T "in", T "out", NULL) == 0);
+    for(size_t i = 0; i < 4; i++){
+        ASSERT(same_time(mtime(files[i]), before[i]));
+    }
+
+    return retval;
+}
+
+// true if path exists and has needle somewhere in it
+bool contains(const char *path, const char *needle){
+    string_t got;
+    if(read_input(path, &got)) return false;
+    char *text = realloc(got.text, got.len + 1);
+    if(!text){
+        free(got.text);
+        return false;
+    }
+    text[got.len] = '\0';
+    bool ok = strstr(text, needle) != NULL;
+    free(text);
+    return ok;
+}
+
+int test_batch(void){
+    int retval = 0;
+    prep_files();
+    put(T "in1", C "\n" A "\n");
+    put(T "in2", F "\n" E "\n" A "\n");
+    put(T "spec", T "in1\n" T "out1\n" T "in2\n" T "out2\n");
+
+    ASSERT(run("-j", "2", "--batch", T "spec", NULL) == 0);
+    ASSERT(has(T "out1", A "\n" C "\n"));
+    ASSERT(has(T "out2", A "\n" E "\n" F "\n"));
+
+    // a rerun leaves both alone
+    age(T "out1", 100);
+    age(T "out2", 100);
+    filetime_t before1 = mtime(T "out1");
+    filetime_t before2 = mtime(T "out2");
+    ASSERT(run("-j", "2", "--batch", T "spec", NULL) == 0);
+    ASSERT(same_time(mtime(T "out1"), before1));
+    ASSERT(same_time(mtime(T "out2"), before2));
+
+    // a file in one list touches only that list's OUTPUT
+    age(E, 0);
+    ASSERT(run("-j", "2", "--batch", T "spec", NULL) == 0);
+    ASSERT(same_time(mtime(T "out1"), before1));
+    ASSERT(isnewer(mtime(T "out2"), before2));
+
+    // a file in both lists touches both, though its time is cached
+    age(T "out2", 100);
+    age(A, 0);
+    ASSERT(run("-j", "2", "--batch", T "spec", NULL) == 0);
+    ASSERT(isnewer(mtime(T "out1"), before1));
+    ASSERT(isnewer(mtime(T "out2"), before2));
+
+    // one depfile names the first OUTPUT and every file of every list
+    ASSERT(run("--depfile", T "dep", "--batch", T "spec", NULL) == 0);
+    ASSERT(contains(T "dep", T "out1:"));
+    const char *names[] = { A, C, E, F };
+    for(size_t i = 0; i < 4; i++) ASSERT(contains(T "dep", names[i]));
+
+    // a SPEC needs pairs
+    put(T "spec", T "in1\n" T "out1\n" T "in2\n");
+    int saved = quiet();
+    int ret = run("--batch", T "spec", NULL);
+    unquiet(saved);
+    ASSERT(ret != 0);
+
+    return retval;
+}
+
+int test_tolerant(void){
+    int retval = 0;
+    const char *tolerant[] = { "--tolerant", NULL };
+    const char *tolerant_j[] = { "--tolerant", "-j", "4", NULL };
+    const char *in = C "\n" T "gone\n" A "\n" B "\n";
+    const char *exp = A "\n" B "\n" C "\n";
+    retval |= mode_case("--tolerant", in, T "out", exp, B, tolerant);
+    retval |= mode_case("--tolerant -j 4", in, T "out", exp, C, tolerant_j);
+
+    // a file which vanishes later is dropped from OUTPUT and the depfile
+    prep_files();
+    put(T "in", in);
+    ASSERT(run(
+        "--tolerant", "--depfile", T "dep", "-i", T "in", T "out", NULL
+    ) == 0);
+    ASSERT(contains(T "dep", B));
+    ASSERT(!contains(T "dep", T "gone"));
+    ASSERT(remove(B) == 0);
+    ASSERT(run(
+        "--tolerant", "--depfile", T "dep", "-i", T "in", T "out", NULL
+    ) == 0);
+    ASSERT(has(T "out", A "\n" C "\n"));
+    ASSERT(!contains(T "dep", B));
+
+    return retval;
+}
+
+string_t S(const char *text){
+    return (string_t){ .text = (char*)text, .len = strlen(text) };
+}
+
+int test_shards(void){
+    int retval = 0;
+    const char *names[] = { A, B, C, E, F };
+    const char *in = F "\n" C "\n" A "\n" E "\n" B "\n";
+
+    // each shard holds, in order, the names which hash to it
+    char exp[3][256] = {{0}};
+    size_t shard[5];
+    for(size_t i = 0; i < 5; i++){
+        shard[i] = shard_of(S(names[i]), false, 3);
+        strcat(exp[shard[i]], names[i]);
+        strcat(exp[shard[i]], "\n");
+    }
+    prep_files();
+    put(T "in", in);
+    ASSERT(run("--shards", "3", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(!exists(T "out"));
+    char path[64];
+    filetime_t before[3];
+    for(size_t i = 0; i < 3; i++){
+        snprintf(path, sizeof(path), T "out.%zu", i);
+        ASSERT(has(path, exp[i]));
+        age(path, 100);
+        before[i] = mtime(path);
+    }
+
+    // a rerun leaves every shard alone
+    ASSERT(run("--shards", "3", "-i", T "in", T "out", NULL) == 0);
+    for(size_t i = 0; i < 3; i++){
+        snprintf(path, sizeof(path), T "out.%zu", i);
+        ASSERT(same_time(mtime(path), before[i]));
+    }
+
+    // a touched file only touches its own shard
+    age(C, 0);
+    ASSERT(run("--shards", "3", "-i", T "in", T "out", NULL) == 0);
+    for(size_t i = 0; i < 3; i++){
+        snprintf(path, sizeof(path), T "out.%zu", i);
+        if(i == shard[2]) ASSERT(isnewer(mtime(path), before[i]));
+        else ASSERT(same_time(mtime(path), before[i]));
+    }
+
+    // fewer shards than last time removes the extras and their sidecars
+    ASSERT(run(
+        "--shards", "4", "--fingerprint", "-i", T "in", T "out", NULL
+    ) == 0);
+    ASSERT(exists(T "out.3") && exists(T "out.3.fp"));
+    ASSERT(run(
+        "--shards", "2", "--fingerprint", "-i", T "in", T "out", NULL
+    ) == 0);
+    ASSERT(exists(T "out.0") && exists(T "out.1"));
+    ASSERT(!exists(T "out.2") && !exists(T "out.2.fp"));
+    ASSERT(!exists(T "out.3") && !exists(T "out.3.fp"));
+
+    // --shard-by-dir hashes only the first path component
+    size_t x = shard_of(S("x/a"), true, 64);
+    ASSERT(shard_of(S("x/b/c"), true, 64) == x);
+    ASSERT(shard_of(S("./x/d"), true, 64) == x);
+    ASSERT(shard_of(S("/x"), true, 64) == x);
+    ASSERT(shard_of(S("x"), false, 64) == x);
+    // every name here is under T, so one shard holds them all
+    prep_files();
+    put(T "in", in);
+    ASSERT(run(
+        "--shards", "3", "--shard-by-dir", "-i", T "in", T "out", NULL
+    ) == 0);
+    size_t full = shard_of(S(A), true, 3);
+    for(size_t i = 0; i < 3; i++){
+        snprintf(path, sizeof(path), T "out.%zu", i);
+        ASSERT(has(path, i == full ? A "\n" B "\n" C "\n" E "\n" F "\n" : ""));
+    }
+
+    return retval;
+}
+
+// count the entries from mfx_seek(key) on which start with prefix
+size_t mfx_count(const mfx_t *m, const char *key, const char *prefix){
+    mfx_iter_t it;
+    mfx_entry_t e;
+    size_t n = 0;
+    if(mfx_seek(&it, m, key, strlen(key))) return (size_t)-1;
+    while(mfx_next_prefixed(&it, prefix, strlen(prefix), &e)) n++;
+    mfx_iter_free(&it);
+    return n;
+}
+
+int test_mfx(void){
+    int retval = 0;
+    prep_files();
+
+    // many blocks of generated names, read back through mfx.h
+    char *text;
+    size_t n = 3000;
+    string_t *names = gen_names(n, 5, &text);
+    ASSERT(radix_sort(names, n, 1, NULL, NULL) == 0);
+    n = dedupe(names, n);
+    ASSERT(n > 10 * MFX_BLOCK);
+    ASSERT(write_mfx(T "x.mfx", names, n, false) == 0);
+
+    mfx_t m;
+    ASSERT(mfx_open(&m, T "x.mfx") == 0);
+    ASSERT(m.h.count == n);
+    mfx_iter_t it;
+    mfx_entry_t e;
+    size_t seen = 0;
+    bool same = true;
+    ASSERT(mfx_seek(&it, &m, "", 0) == 0);
+    while(mfx_next(&it, &e)){
+        same &= seen < n && mfx_cmp(
+            e.name, e.len, names[seen].text, names[seen].len
+        ) == 0;
+        seen++;
+    }
+    mfx_iter_free(&it);
+    ASSERT(same && seen == n);
+
+    // every name can be found, wherever it falls in its block
+    size_t found = 0;
+    for(size_t i = 0; i < n; i++){
+        int ret = mfx_find(&m, names[i].text, names[i].len, &it, &e);
+        found += ret == 1 && e.len == names[i].len;
+        mfx_iter_free(&it);
+    }
+    ASSERT(found == n);
+    // 'c' is not in gen_names()'s alphabet
+    ASSERT(mfx_find(&m, "c", 1, &it, &e) == 0);
+    mfx_iter_free(&it);
+    ASSERT(mfx_find(&m, "abc", 3, &it, &e) == 0);
+    mfx_iter_free(&it);
+    // past the last name, which is at most 12 bytes
+    const char *past = "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff";
+    ASSERT(mfx_find(&m, past, strlen(past), &it, &e) == 0);
+    mfx_iter_free(&it);
+
+    // prefix scans see exactly the names with that prefix
+    const char *prefixes[] = { "a", "ab", "b/", "\xff", "\x7f." };
+    for(size_t i = 0; i < sizeof(prefixes) / sizeof(*prefixes); i++){
+        size_t len = strlen(prefixes[i]);
+        size_t exp = 0;
+        for(size_t j = 0; j < n; j++){
+            exp += names[j].len >= len
+                && !memcmp(names[j].text, prefixes[i], len);
+        }
+        ASSERT(mfx_count(&m, prefixes[i], prefixes[i]) == exp);
+    }
+    mfx_close(&m);
+    free(names);
+    free(text);
+
+    // an empty list
+    ASSERT(write_mfx(T "x.mfx", NULL, 0, false) == 0);
+    ASSERT(mfx_open(&m, T "x.mfx") == 0);
+    ASSERT(m.h.count == 0);
+    ASSERT(mfx_count(&m, "", "") == 0);
+    mfx_close(&m);
+
+    // a truncated file is rejected
+    put(T "x.mfx", MFX_MAGIC "short");
+    ASSERT(mfx_open(&m, T "x.mfx") != 0);
+
+    // manifest --mfx writes OUTPUT.mfx along with OUTPUT
+    const char *mfx[] = { "--mfx", NULL };
+    const char *in = C "\n" A "\n" F "\n" B "\n" E "\n";
+    const char *sorted = A "\n" B "\n" C "\n" E "\n" F "\n";
+    retval |= mode_case("--mfx", in, T "out", sorted, E, mfx);
+    ASSERT(mfx_open(&m, T "out.mfx") == 0);
+    ASSERT(m.h.count == 5 && !(m.h.flags & MFX_STAT));
+    ASSERT(mfx_count(&m, T "d/", T "d/") == 2);
+    mfx_close(&m);
+
+    // and rewrites it if it goes missing, even when OUTPUT is up to date
+    ASSERT(remove(T "out.mfx") == 0);
+    ASSERT(run("--mfx", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(exists(T "out.mfx"));
+
+    // --mfx-stat records the size and mtime of each file
+    const char *mfx_stat[] = { "--mfx-stat", NULL };
+    retval |= mode_case("--mfx-stat", in, T "out", sorted, B, mfx_stat);
+    ASSERT(mfx_open(&m, T "out.mfx") == 0);
+    ASSERT(m.h.flags & MFX_STAT);
+    ASSERT(mfx_find(&m, B, strlen(B), &it, &e) == 1);
+    int64_t sec;
+    uint32_t nsec;
+    filetime_unix(mtime(B), &sec, &nsec);
+    ASSERT(e.size == strlen(B));
+    ASSERT(e.mtime_sec == sec && e.mtime_nsec == nsec);
+    mfx_iter_free(&it);
+    mfx_close(&m);
+
+    return retval;
+}
+
+int test_hot(void){
+    int retval = 0;
+    const char *hot[] = { "--hot", NULL };
+    const char *in = C "\n" A "\n" F "\n" B "\n" E "\n";
+    const char *sorted = A "\n" B "\n" C "\n" E "\n" F "\n";
+    retval |= mode_case("--hot", in, T "out", sorted, F, hot);
+    // the file which touched OUTPUT is checked first next time
+    ASSERT(contains(T "out.hot", F));
+
+    // a hot file which is no longer newer is just checked like the others
+    age(T "out", 100);
+    filetime_t before = mtime(T "out");
+    age(F, 1000);
+    ASSERT(run("--hot", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(same_time(mtime(T "out"), before));
+    age(B, 0);
+    ASSERT(run("--hot", "-i", T "in", T "out", NULL) == 0);
+    ASSERT(isnewer(mtime(T "out"), before));
+    ASSERT(contains(T "out.hot", B));
+
+    int saved = quiet();
+    int ret = run("--hot", "--delta", "-i", T "in", T "out", NULL);
+    unquiet(saved);
+    ASSERT(ret != 0);
+
+    return retval;
+}
+
+int test_merge(void){
+    int retval = 0;
+    const char *exp = A "\n" B "\n" C "\n" E "\n" F "\n";
+
+    // --sorted trusts the order of a presorted list
+    const char *sorted[] = { "--sorted", NULL };
+    retval |= mode_case("--sorted", exp, T "out", exp, C, sorted);
+
+    // several inputs, each unsorted, are merged
+    prep_files();
+    put(T "in1", F "\n" B "\n" A "\n");
+    put(T "in2", E "\n" C "\n");
+    ASSERT(run("-i", T "in1", "-i", T "in2", T "out", NULL) == 0);
+    ASSERT(has(T "out", exp));
+
+    // presorted inputs are merged as they are
+    put(T "in1", A "\n" C "\n" F "\n");
+    put(T "in2", B "\n" E "\n");
+    ASSERT(
+        run("--sorted", "-i", T "in1", "-i", T "in2", T "out", NULL) == 0
+    );
+    ASSERT(has(T "out", exp));
+
+    // -u drops names which appear in more than one input
+    put(T "in1", C "\n" A "\n" E "\n" B "\n");
+    put(T "in2", F "\n" B "\n" C "\n");
+    ASSERT(run("-u", "-i", T "in1", "-i", T "in2", T "out", NULL) == 0);
+    ASSERT(has(T "out", exp));
+
+    // the merged list is compared to OUTPUT like any other
+    age(T "out", 100);
+    filetime_t before = mtime(T "out");
+    ASSERT(run("-u", "-i", T "in1", "-i", T "in2", T "out", NULL) == 0);
+    ASSERT(same_time(mtime(T "out"), before));
+    age(E, 0);
+    ASSERT(run("-u", "-i", T "in1", "-i", T "in2", T "out", NULL) == 0);
+    ASSERT(isnewer(mtime(T "out"), before));
+
+    return retval;
+}
+
+int test_depfile(void){
+    int retval = 0;
+    prep_files();
+    put(T "s p", "");
+    put(T "$x", "");
+    age(T "s p", 1000);
+    age(T "$x", 1000);
+    put(T "in", B "\n" T "s p\n" A "\n" T "$x\n");
+    // extra deps are not listed in OUTPUT, and need not exist
+    put(T "extra", T "gen\n/abs/#h\n");
+
+    ASSERT(
+        run(
+            "--depfile", T "out.d", "--extra-deps", T "extra",
+            "-i", T "in", T "out", NULL
+        ) == 0
+    );
+    ASSERT(has(T "out", T "$x\n" A "\n" B "\n" T "s p\n"));
+
+    // relative names are made absolute, and special characters escaped
+    char *cwd = compat_getcwd();
+    ASSERT(cwd);
+    char exp[4096];
+    snprintf(exp, sizeof(exp),
+        T "out: \\\n"
+        "  %s/" T "$$x \\\n"
+        "  %s/" A " \\\n"
+        "  %s/" B " \\\n"
+        "  %s/" T "s\\ p \\\n"
+        "  %s/" T "gen \\\n"
+        "  /abs/\\#h\n",
+        cwd, cwd, cwd, cwd, cwd
+    );
+    free(cwd);
+    ASSERT(has(T "out.d", exp));
+
+    // the depfile is written even when OUTPUT is untouched
+    ASSERT(remove(T "out.d") == 0);
+    age(T "out", 100);
+    filetime_t before = mtime(T "out");
+    ASSERT(
+        run(
+            "--depfile", T "out.d", "--extra-deps", T "extra",
+            "-i", T "in", T "out", NULL
+        ) == 0
+    );
+    ASSERT(same_time(mtime(T "out"), before));
+    ASSERT(has(T "out.d", exp));
+
+    return retval;
+}
+
+int test_dircache(void){
+    int retval = 0;
+    prep_files();
+    make_dir(T "dc");
+    // more directories than the cache holds, so slots are evicted
+    const int ndirs = DIRCACHE_SIZE + 4;
+    char path[64];
+    for(int i = 0; i < ndirs; i++){
+        snprintf(path, sizeof(path), T "dc/%d", i);
+        make_dir(path);
+        snprintf(path, sizeof(path), T "dc/%d/f", i);
+        put(path, "");
+        age(path, 10 * i);
+    }
+
+    dircache_t dc = {0};
+    // visit each directory twice, once out of order
+    for(int pass = 0; pass < 2; pass++){
+        for(int j = 0; j < ndirs; j++){
+            int i = pass ? (j * 5) % ndirs : j;
+            snprintf(path, sizeof(path), T "dc/%d/f", i);
+            filetime_t got, exp;
+            ASSERT(get_filetime_at(&dc, path, &got) == 0);
+            ASSERT(get_filetime(path, &exp) == 0);
+            ASSERT(same_time(got, exp));
+            snprintf(path, sizeof(path), T "dc/%d/missing", i);
+            ASSERT(get_filetime_at(&dc, path, &got) == FILE_NOT_FOUND);
+        }
+    }
+    // a missing parent, a trailing slash, and no parent at all
+    filetime_t t;
+    ASSERT(get_filetime_at(&dc, T "nodir/f", &t) == FILE_NOT_FOUND);
+    ASSERT(get_filetime_at(&dc, T "dc/", &t) == 0);
+    ASSERT(get_filetime_at(&dc, "manifest.c", &t) == 0);
+    dircache_free(&dc);
+
+    return retval;
+}
+
+int test_exact_mtime(void){
+    int retval = 0;
+    const char *exact[] = { "--exact-mtime", NULL };
+    const char *in = C "\n" A "\n" F "\n" B "\n" E "\n";
+    const char *exp = A "\n" B "\n" C "\n" E "\n" F "\n";
+    retval |= mode_case("--exact-mtime", in, T "out", exp, E, exact);
+    ASSERT(same_time(mtime(T "out"), mtime(E)));
+
+    // OUTPUT takes the time of the newest file, not the first newer one
+    const char *modes[][4] = {
+        { "--exact-mtime", NULL },
+        { "--exact-mtime", "-j", "4", NULL },
+        { "--exact-mtime", "--tolerant", NULL },
+        { "--exact-mtime", "--max-mem", "16M", NULL },
+    };
+    for(size_t i = 0; i < sizeof(modes) / sizeof(*modes); i++){
+        prep_files();
+        put(T "in", in);
+        const char *argv[16] = { "manifest" };
+        int argc = 1;
+        for(const char **arg = modes[i]; *arg; arg++) argv[argc++] = *arg;
+        argv[argc++] = "-i";
+        argv[argc++] = T "in";
+        argv[argc++] = T "out";
+        ASSERT(manifest_main(argc, (char**)argv) == 0);
+        age(T "out", 100);
+        age(A, 50);
+        age(F, 20);
+        age(C, 40);
+        ASSERT(manifest_main(argc, (char**)argv) == 0);
+        ASSERT(same_time(mtime(T "out"), mtime(F)));
+        // which is then not newer than OUTPUT
+        ASSERT(manifest_main(argc, (char**)argv) == 0);
+        ASSERT(same_time(mtime(T "out"), mtime(F)));
+        if(retval) fprintf(stderr, "--exact-mtime mode %d failed\n", (int)i);
+    }
+
+    int saved = quiet();
+    int ret = run("--exact-mtime", "--hash", "-i", T "in", T "out", NULL);
+    unquiet(saved);
+    ASSERT(ret != 0);
+
+    return retval;
+}
+
+int main(void){
+    int retval = 0;
+
+    retval |= test_plain();
+    retval |= test_split();
+    retval |= test_radix_sort();
+    retval |= test_jobs();
+    retval |= test_dircache();
+    retval |= test_max_mem();
+    retval |= test_merge();
+    retval |= test_front_coding();
+    retval |= test_hash();
+    retval |= test_hot();
+    retval |= test_exact_mtime();
+    retval |= test_fingerprint();
+    retval |= test_depfile();
+    retval |= test_delta();
+    retval |= test_batch();
+    retval |= test_tolerant();
+    retval |= test_shards();
+    retval |= test_mfx();
+
+    rm_tree(T);
+    if(retval){
+        printf("FAIL\n");
+    }else{
+        printf("PASS\n");
+    }
+    return retval;
+}
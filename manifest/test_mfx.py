@@ -0,0 +1,118 @@
+"""
+Check mkninja/mfx.py against the .mfx files which manifest writes.
+
+Build ./manifest first (make, or make.bat on windows), then run:
+
+    python test_mfx.py
+"""
+
+import os
+import pathlib
+import subprocess
+import sys
+import tempfile
+import unittest
+
+HERE = pathlib.Path(__file__).absolute().parent
+sys.path.insert(0, str(HERE.parent))
+
+from mkninja import mfx  # noqa: E402
+
+MANIFEST = HERE / ("manifest.exe" if sys.platform == "win32" else "manifest")
+
+
+def gen_names(n, seed):
+    """A deterministic list of names, many sharing long prefixes."""
+    alphabet = b"ab/.\x7f\x80\xff"
+    out = set()
+    for _ in range(n):
+        seed = (seed * 6364136223846793005 + 1442695040888963407) % 2**64
+        length = 1 + (seed >> 60) % 12
+        name = bytearray()
+        for _ in range(length):
+            seed = (seed * 6364136223846793005 + 1442695040888963407) % 2**64
+            name.append(alphabet[(seed >> 40) % len(alphabet)])
+        out.add(bytes(name))
+    return sorted(out)
+
+
+class MfxTest(unittest.TestCase):
+    def setUp(self):
+        self.tmp = tempfile.TemporaryDirectory()
+        self.dir = pathlib.Path(self.tmp.name)
+
+    def tearDown(self):
+        self.tmp.cleanup()
+
+    def manifest(self, names, *flags):
+        """Write names with manifest, returning the path to OUT.mfx."""
+        listing = self.dir / "in"
+        listing.write_bytes(b"\0".join(names))
+        out = self.dir / "out"
+        subprocess.run(
+            [str(MANIFEST), "-0", *flags, "-i", str(listing), str(out)],
+            check=True,
+        )
+        return self.dir / "out.mfx"
+
+    def test_many_blocks(self):
+        # the first write of a list does not stat the names, so they need
+        # not exist
+        names = gen_names(3000, 5)
+        with mfx.Mfx(self.manifest(names, "--mfx")) as m:
+            self.assertEqual(len(m), len(names))
+            raw = [os.fsencode(e.name) for e in m]
+            self.assertEqual(raw, names)
+            for name in names[::7]:
+                entry = m.get(name)
+                self.assertIsNotNone(entry)
+                self.assertEqual(os.fsencode(entry.name), name)
+                self.assertIsNone(entry.size)
+                self.assertIn(name, m)
+            # b"c" is not in gen_names()'s alphabet
+            self.assertNotIn(b"c", m)
+            self.assertNotIn(b"abc", m)
+            self.assertNotIn(b"\xff" * 13, m)
+            for prefix in (b"a", b"ab", b"b/", b"\xff", b"\x7f."):
+                got = [os.fsencode(e.name) for e in m.prefix(prefix)]
+                exp = [n for n in names if n.startswith(prefix)]
+                self.assertEqual(got, exp)
+
+    def test_str_names(self):
+        names = [b"d/e", b"d/f", b"a", b"b"]
+        with mfx.Mfx(self.manifest(names, "--mfx")) as m:
+            self.assertEqual([e.name for e in m], ["a", "b", "d/e", "d/f"])
+            self.assertIn("d/e", m)
+            self.assertNotIn("d", m)
+            self.assertEqual([e.name for e in m.prefix("d/")], ["d/e", "d/f"])
+
+    def test_stat(self):
+        (self.dir / "d").mkdir()
+        names = []
+        for name in ("a", "bb", "d/ccc"):
+            path = self.dir / name
+            path.write_text(name)
+            names.append(os.fsencode(path))
+        with mfx.Mfx(self.manifest(names, "--mfx-stat")) as m:
+            for name in names:
+                entry = m.get(name)
+                st = os.stat(name)
+                self.assertEqual(entry.size, st.st_size)
+                self.assertEqual(entry.mtime_ns, st.st_mtime_ns)
+
+    def test_empty(self):
+        with mfx.Mfx(self.manifest([], "--mfx")) as m:
+            self.assertEqual(len(m), 0)
+            self.assertEqual(list(m), [])
+            self.assertIsNone(m.get("a"))
+            self.assertEqual(list(m.prefix("")), [])
+
+    def test_not_mfx(self):
+        path = self.dir / "junk"
+        path.write_bytes(b"mfx00001short")
+        with self.assertRaises(ValueError):
+            mfx.Mfx(path)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -22,6 +22,12 @@ if sys.platform == "win32":
     _findglob_bin += ".exe"
     _stamp_bin += ".exe"
 
+# findglob.c is installed next to the binaries, or in a source checkout it is
+# still in the findglob directory; generated walkers are built against it
+_findglob_src = os.path.dirname(__file__)
+if not os.path.exists(os.path.join(_findglob_src, "findglob.c")):
+    _findglob_src = os.path.join(os.path.dirname(_findglob_src), "findglob")
+
 
 ## add_subproject needs more support from ninja itself before it is a good
 ## idea; currently the subninja command does not provide sufficient insulation
@@ -355,6 +361,123 @@ class Alias(Target):
         return str(self.name)
 
 
+class BatchedManifest:
+    """One manifest updated by a ManifestBatch; usable like a Target."""
+
+    def __init__(self, *, command, out, workdir, after):
+        self.command = command
+        self.workdir = workdir
+        self.inputs = []
+        self.outputs = [out]
+        self.after = after
+
+    def as_after(self):
+        return self.outputs
+
+    def as_input(self):
+        return self.outputs
+
+    def as_dyndep(self):
+        raise ValueError(
+            "passing a BatchedManifest as a dyndep is not allowed"
+        )
+
+    def __str__(self):
+        return str(self.outputs[0])
+
+
+class ManifestBatch(Target):
+    """
+    A single build edge which runs the commands of several manifests, then
+    updates all of them with one `manifest --batch` process.  The members
+    share a workdir and are either all phony or all tracked by one depfile.
+    """
+
+    def __init__(self, *, name, workdir, phony):
+        assert isinstance(name, str), type(name)
+        self.name = name
+        self.members = []
+        self.default = False
+        self.workdir = workdir
+        self.phony = phony
+
+        # be API-compatible with documented attributes of Target
+        self.inputs = []
+        self.outputs = []
+        self.after = []
+
+    def add(self, *, command, out, workdir, phony, after):
+        # manifest --batch runs in one directory, where the names must resolve
+        if str(workdir) != str(self.workdir):
+            raise ValueError(
+                f"manifests in batch {self.name} must share a workdir"
+            )
+        if phony != self.phony:
+            raise ValueError(
+                f"manifests in batch {self.name} must agree on phony"
+            )
+        temp = []
+        for a in after:
+            if hasattr(a, "as_after"):
+                temp += a.as_after()
+            else:
+                temp.append(a)
+        member = BatchedManifest(
+            command=command, out=out, workdir=workdir, after=temp
+        )
+        self.members.append(member)
+        self.outputs.append(out)
+        self.after += temp
+        return member
+
+    def gen(self, bld):
+        def relbld(s):
+            s = str(s)
+            if str(bld) in s:
+                s = os.path.relpath(s, str(bld))
+            return s
+
+        # each command writes OUT.list
+        steps = []
+        spec = []
+        for m in self.members:
+            out = os.path.join(str(self.workdir), str(m.outputs[0]))
+            steps.append(f"( {m.command} ) > {_quote(out + '.list')}")
+            spec += [out + ".list", out]
+        flags = ""
+        if not self.phony:
+            # ninja tracks every listed file itself, through one depfile
+            depfile = os.path.join(
+                str(self.workdir), str(self.members[0].outputs[0]) + ".d"
+            )
+            flags = f"--depfile {_quote(depfile)} "
+        steps.append(
+            "printf '%s\\n' " + " ".join(_quote(s) for s in spec)
+            + f" | {_quote(_manifest_bin)} {flags}--batch -"
+        )
+
+        out = "build"
+        out += ' ' + ' '.join(ninjify(relbld(o)) for o in self.outputs)
+        out += ": TARGET"
+        if self.phony:
+            out += " | PHONY"
+        out += " ||"
+        if self.after:
+            out += ' ' + ' '.join(ninjify(relbld(a)) for a in self.after)
+        out += "\n CMD = " + ninjify(" && ".join(steps), allow_space=True)
+        out += "\n WORKDIR = " + ninjify(self.workdir, allow_space=True)
+        out += "\n DISPLAY = " + ninjify(
+            f"updating manifest batch: {self.name}", True
+        )
+        if not self.phony:
+            out += "\n depfile = " + ninjify(relbld(depfile), True)
+            out += "\n deps = gcc"
+        return out
+
+    def __str__(self):
+        return str(self.name)
+
+
 class _Module:
     def __init__(self, proj, relpath):
         self.proj = proj
@@ -362,6 +485,8 @@ class _Module:
         self.src = proj.src/relpath
         self.bld = proj.bld/relpath
         self.targets = []
+        # ManifestBatch objects by name
+        self.batches = {}
 
         proj.modules[relpath] = self
 
@@ -457,45 +582,189 @@ class _Module:
 
     def make_add_manifest(self):
         def add_manifest(
-            *, command, out, after=(), workdir=self.src, **tags,
+            *,
+            command,
+            out,
+            after=(),
+            workdir=self.src,
+            phony=True,
+            batch=None,
+            mfx=False,
+            tolerant=False,
+            **tags,
         ):
             if isinstance(command, list):
                 command = " ".join(_quote(c) for c in command)
+            if batch is not None:
+                if mfx or tolerant:
+                    raise ValueError(
+                        "batched manifests do not support mfx or tolerant"
+                    )
+                if tags:
+                    raise ValueError("batched manifests do not support tags")
+                group = self.batches.get(batch)
+                if group is None:
+                    group = ManifestBatch(
+                        name=batch, workdir=workdir, phony=phony
+                    )
+                    self.batches[batch] = group
+                    self.add_target_object(group)
+                return group.add(
+                    command=command,
+                    out=out,
+                    workdir=workdir,
+                    phony=phony,
+                    after=after,
+                )
+            if phony:
+                depfile = None
+                flags = ""
+            else:
+                # ninja tracks the listed files itself, through a depfile
+                depfile = f"{out}.d"
+                flags = f"--depfile {_quote(depfile)} "
+            if mfx:
+                flags += "--mfx "
+            if tolerant:
+                flags += "--tolerant "
             return self._add_target(
                 inputs=[],
                 command=(
-                    f"( {command} ) | {_quote(_manifest_bin)} {_quote(out)}"
+                    f"( {command} ) | {_quote(_manifest_bin)} "
+                    f"{flags}{_quote(out)}"
                 ),
                 outputs=[out],
                 workdir=workdir,
                 display=f"updating manifest: {command}",
-                phony=True,
+                phony=phony,
                 default=False,
+                depfile=depfile,
+                deps=None if phony else "gcc",
                 **tags,
             )
 
         return add_manifest
 
+    def _add_walker(self, out, workdir, patterns):
+        """
+        Generate and build a findglob specialized to some quoted patterns,
+        returning the absolute path to the walker binary.  The walker is built
+        in self.bld but run from workdir, where out is found.
+        """
+        stem = os.path.join(workdir, out)
+        src = f"{stem}.walker.c"
+        exe = f"{stem}.walker"
+        self._add_target(
+            inputs=[_findglob_bin],
+            command=(
+                f"{_quote(_findglob_bin)} --emit-c {_quote(src)} "
+                f"-- {' '.join(patterns)}"
+            ),
+            outputs=[src],
+            workdir=self.bld,
+            display=f"findglob --emit-c {' '.join(patterns)}",
+            default=False,
+        )
+        if sys.platform == "win32":
+            exe += ".exe"
+            command = (
+                f"cl /nologo /O2 /W4 /wd4221 /wd4204 /WX "
+                f"/I{_quote(_findglob_src)} "
+                f"/Fe{_quote(exe)} {_quote(src)}"
+            )
+        else:
+            cc = os.environ.get("CC", "cc")
+            command = (
+                f"{cc} -Wall -Wextra -Werror -O2 -pthread "
+                f"-I{_quote(_findglob_src)} "
+                f"-o {_quote(exe)} {_quote(src)}"
+            )
+        self._add_target(
+            inputs=[src, os.path.join(_findglob_src, "findglob.c")],
+            command=command,
+            outputs=[exe],
+            workdir=self.bld,
+            display=f"building walker: {exe}",
+            default=False,
+        )
+        return exe
+
     def make_add_glob(self):
         def add_glob(
-            *patterns, out, workdir=None, after=(), **tags
+            *patterns,
+            out,
+            workdir=None,
+            after=(),
+            phony=True,
+            mfx=False,
+            shards=None,
+            shard_by="hash",
+            front_coded=False,
+            tolerant=False,
+            specialize=False,
+            **tags,
         ):
             if not patterns:
                 raise ValueError("at least one pattern must be provided")
+            if shard_by not in ("hash", "dir"):
+                raise ValueError("shard_by must be 'hash' or 'dir'")
             patterns = [_quote(str(p)) for p in patterns]
+            walker = _findglob_bin
+            args = f"-- {' '.join(patterns)} "
+            inputs = []
+            if specialize:
+                # a walker with matching code generated for these patterns
+                walker = self._add_walker(
+                    out, workdir or self.src, patterns
+                )
+                args = ""
+                inputs = [walker]
+            flags = "--mfx " if mfx else ""
+            if tolerant:
+                flags += "--tolerant "
+            fc = ""
+            if front_coded:
+                fc = "--front-coded "
+                flags += "--front-coded --store-front-coded "
+            outputs = [out]
+            if shards is not None:
+                if shards < 1:
+                    raise ValueError("shards must be at least 1")
+                # one walk, split into out.0 through out.N-1 by manifest
+                flags += f"--shards {shards} "
+                if shard_by == "dir":
+                    flags += "--shard-by-dir "
+                outputs = [f"{out}.{i}" for i in range(shards)]
+            if phony:
+                depfile = None
+                walk_flags = ""
+            else:
+                # ninja watches the matches and every directory that was
+                # searched (new files change their directory's mtime), so the
+                # search only reruns when something it depends on has changed
+                depfile = f"{out}.d"
+                dirs = f"{out}.dirs"
+                walk_flags = f"--dirs {_quote(dirs)} "
+                flags += (
+                    f"--depfile {_quote(depfile)} "
+                    f"--extra-deps {_quote(dirs)} "
+                )
             return self._add_target(
-                inputs=[],
+                inputs=inputs,
+                # findglob's sorted output lets manifest skip its own sort
                 command=(
-                    f"{_quote(_findglob_bin)} "
-                    f"{' '.join(patterns)} "
-                    f"| {_quote(_manifest_bin)} {_quote(out)}"
+                    f"{_quote(walker)} --sorted {fc}{walk_flags}{args}"
+                    f"| {_quote(_manifest_bin)} --sorted "
+                    f"{flags}{_quote(out)}"
                 ),
-                outputs=[out],
+                outputs=outputs,
                 workdir=workdir or self.src,
                 after=after,
                 display=f"findglob {' '.join(patterns)}",
-                phony=True,
+                phony=phony,
                 default=False,
+                depfile=depfile,
+                deps=None if phony else "gcc",
                 **tags,
             )
 
@@ -0,0 +1,154 @@
+"""
+Read the indexed binary manifests which `manifest --mfx` writes.
+
+The format is described in manifest/mfx.h.  The file is mapped, and lookups
+and prefix scans only decode the blocks they need:
+
+    from mkninja import mfx
+
+    with mfx.Mfx(BLD/"srcs.txt.mfx") as m:
+        if "src/main.c" in m:
+            ...
+        for entry in m.prefix("src/lib/"):
+            print(entry.name, entry.size, entry.mtime_ns)
+"""
+
+import collections
+import mmap
+import struct
+
+MAGIC = b"mfx00001"
+HEADER_SIZE = 64
+STAT = 1
+
+Entry = collections.namedtuple("Entry", ["name", "size", "mtime_ns"])
+Entry.__doc__ = """
+A manifest entry.  name is a str (decoded with the filesystem's surrogate
+escapes, like os.fsdecode); size and mtime_ns are None unless the file was
+written with `manifest --mfx-stat`.
+"""
+
+
+def _varint(buf, off):
+    out = 0
+    shift = 0
+    while True:
+        c = buf[off]
+        off += 1
+        out |= (c & 0x7F) << shift
+        if not c & 0x80:
+            return out, off
+        shift += 7
+
+
+class Mfx:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self._map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        try:
+            header = self._map[:HEADER_SIZE]
+            if len(header) < HEADER_SIZE or header[:8] != MAGIC:
+                raise ValueError(f"{path} is not an mfx file")
+            (
+                self._count,
+                self._nblocks,
+                self._block,
+                self._flags,
+                self._max_len,
+                self._index_off,
+            ) = struct.unpack("<6Q", header[8:56])
+        except Exception:
+            self._map.close()
+            raise
+
+    def close(self):
+        self._map.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *_):
+        self.close()
+
+    def __len__(self):
+        return self._count
+
+    def _block_start(self, block):
+        off = self._index_off + 8 * block
+        return struct.unpack("<Q", self._map[off:off + 8])[0]
+
+    def _block_first(self, block):
+        # the first name of a block is stored whole
+        off = self._block_start(block)
+        _, off = _varint(self._map, off)
+        n, off = _varint(self._map, off)
+        return self._map[off:off + n]
+
+    def _entries(self, block):
+        """Decode entries from the start of a block through the end."""
+        while block < self._nblocks:
+            off = self._block_start(block)
+            count = min(self._block, self._count - block * self._block)
+            name = b""
+            for _ in range(count):
+                shared, off = _varint(self._map, off)
+                n, off = _varint(self._map, off)
+                name = name[:shared] + self._map[off:off + n]
+                off += n
+                size = mtime_ns = None
+                if self._flags & STAT:
+                    size, off = _varint(self._map, off)
+                    sec, off = _varint(self._map, off)
+                    nsec, off = _varint(self._map, off)
+                    if sec >= 1 << 63:
+                        sec -= 1 << 64
+                    mtime_ns = sec * 1000000000 + nsec
+                yield name, size, mtime_ns
+            block += 1
+
+    def _seek(self, key):
+        """Yield raw entries starting at the first one not less than key."""
+        # find the last block whose first name is not greater than key
+        lo, hi = 0, self._nblocks
+        while lo < hi:
+            mid = (lo + hi) // 2
+            if self._block_first(mid) <= key:
+                lo = mid + 1
+            else:
+                hi = mid
+        for raw in self._entries(max(lo - 1, 0)):
+            if raw[0] >= key:
+                yield raw
+
+    @staticmethod
+    def _entry(raw):
+        name, size, mtime_ns = raw
+        return Entry(name.decode("utf8", "surrogateescape"), size, mtime_ns)
+
+    @staticmethod
+    def _key(name):
+        if isinstance(name, str):
+            return name.encode("utf8", "surrogateescape")
+        return bytes(name)
+
+    def get(self, name):
+        """Return the Entry for name, or None if it is not listed."""
+        key = self._key(name)
+        for raw in self._seek(key):
+            return self._entry(raw) if raw[0] == key else None
+        return None
+
+    def __contains__(self, name):
+        return self.get(name) is not None
+
+    def prefix(self, prefix):
+        """Yield every Entry whose name starts with prefix, in order."""
+        key = self._key(prefix)
+        for raw in self._seek(key):
+            if not raw[0].startswith(key):
+                return
+            yield self._entry(raw)
+
+    def __iter__(self):
+        for raw in self._entries(0):
+            yield self._entry(raw)
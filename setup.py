@@ -29,7 +29,7 @@ import distutils.command.build_ext
 
 ext_modules = [
     distutils.extension.Extension("mkninja.findglob", ["findglob/main.c"]),
-    distutils.extension.Extension("mkninja.manifest", ["manifest/manifest.c"]),
+    distutils.extension.Extension("mkninja.manifest", ["manifest/main.c"]),
     distutils.extension.Extension("mkninja.stamp", ["stamp/stamp.c"]),
 ]
 
@@ -56,7 +56,10 @@ class build_exe(distutils.command.build_ext.build_ext):
                 self.get_executable_output(ext),
                 debug=self.debug,
                 target_lang="c",
+                extra_postargs=self.link_postargs(),
             )
+        # add_glob(specialize=True) builds generated walkers against this
+        self.copy_file("findglob/findglob.c", self.get_findglob_src())
 
     def compile_postargs(self):
         if sys.platform == "win32":
@@ -72,13 +75,24 @@ class build_exe(distutils.command.build_ext.build_ext):
                 "/wd4204",
             ]
 
-        return ["-Wall", "-Wextra", "-Werror", "-O3"]
+        return ["-Wall", "-Wextra", "-Werror", "-O3", "-pthread"]
+
+    def link_postargs(self):
+        if sys.platform == "win32":
+            return []
+
+        # manifest uses threads; older glibc needs libpthread linked in
+        return ["-pthread"]
 
     def get_executable_output(self, ext):
         return os.path.join(self.build_lib, *ext.name.split("."))
 
+    def get_findglob_src(self):
+        return os.path.join(self.build_lib, "mkninja", "findglob.c")
+
     def get_outputs(self):
-        return [self.get_executable_output(ext) for ext in self.extensions]
+        outputs = [self.get_executable_output(ext) for ext in self.extensions]
+        return outputs + [self.get_findglob_src()]
 
 
 if __name__ == "__main__":
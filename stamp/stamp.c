@@ -27,13 +27,75 @@ int update_timestamp(const char *path){
     return _utime(path, NULL);
 }
 
+typedef FILETIME filetime_t;
+
+static HANDLE open_handle(const char *path, DWORD access){
+    return CreateFileA(
+        path,
+        access,
+        FILE_SHARE_DELETE|FILE_SHARE_READ|FILE_SHARE_WRITE,
+        NULL,
+        OPEN_EXISTING,
+        0,
+        NULL
+    );
+}
+
+int get_mtime(const char *path, filetime_t *out){
+    HANDLE hfile = open_handle(path, GENERIC_READ);
+    if(hfile == INVALID_HANDLE_VALUE) return 1;
+    BOOL ok = GetFileTime(hfile, NULL, NULL, out);
+    CloseHandle(hfile);
+    return !ok;
+}
+
+int set_mtime(const char *path, filetime_t t){
+    HANDLE hfile = open_handle(path, FILE_WRITE_ATTRIBUTES);
+    if(hfile == INVALID_HANDLE_VALUE) return 1;
+    BOOL ok = SetFileTime(hfile, NULL, NULL, &t);
+    CloseHandle(hfile);
+    return !ok;
+}
+
+// result is true when a is newer than b
+bool isnewer(filetime_t a, filetime_t b){
+    return CompareFileTime(&a, &b) > 0;
+}
+
 #else // UNIX
 #include <utime.h>
+#include <fcntl.h>
 
 int update_timestamp(const char *path){
     return utime(path, NULL);
 }
 
+typedef struct timespec filetime_t;
+
+int get_mtime(const char *path, filetime_t *out){
+    struct stat s;
+    if(stat(path, &s)) return 1;
+#ifdef __APPLE__
+    *out = s.st_mtimespec;
+#else
+    *out = s.st_mtim;
+#endif
+    return 0;
+}
+
+// set the modification time to exactly t, in nanoseconds
+int set_mtime(const char *path, filetime_t t){
+    struct timespec times[2] = { { .tv_nsec = UTIME_NOW }, t };
+    return utimensat(AT_FDCWD, path, times, 0);
+}
+
+// result is true when a is newer than b
+bool isnewer(filetime_t a, filetime_t b){
+    return (
+        a.tv_sec > b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec > b.tv_nsec)
+    );
+}
+
 #endif
 
 // string_t
@@ -344,7 +406,14 @@ int mkdirs(string_t tgt){
     return mkdir_string(tgt);
 }
 
-int touch_file(const char *path){
+// set the timestamp to *mtime, or to now if mtime is NULL
+int set_timestamp(const char *path, const filetime_t *mtime){
+    int ret = mtime ? set_mtime(path, *mtime) : update_timestamp(path);
+    if(ret) perror(path);
+    return ret;
+}
+
+int touch_file(const char *path, const filetime_t *mtime){
     int ret;
     bool ok;
 
@@ -353,9 +422,7 @@ int touch_file(const char *path){
     if(ret) return ret;
     if(ok){
         // just update the timestamp
-        ret = update_timestamp(path);
-        if(ret) perror(path);
-        return ret;
+        return set_timestamp(path, mtime);
     }
 
     // possibly create parent directory
@@ -377,11 +444,29 @@ int touch_file(const char *path){
         return 1;
     }
 
+    if(mtime) return set_timestamp(path, mtime);
+    return 0;
+}
+
+// find the newest modification time among the inputs
+int newest_mtime(char **inputs, int ninputs, filetime_t *out){
+    for(int i = 0; i < ninputs; i++){
+        filetime_t t;
+        if(get_mtime(inputs[i], &t)){
+            perror(inputs[i]);
+            return 1;
+        }
+        if(i == 0 || isnewer(t, *out)) *out = t;
+    }
     return 0;
 }
 
 int print_help(FILE *f){
     fprintf(f, "usage: stamp OUTPUT\n");
+    fprintf(f, "       stamp --exact OUTPUT INPUT...\n");
+    fprintf(f, "--exact sets the modification time of OUTPUT to exactly ");
+    fprintf(f, "that of the newest INPUT,\n");
+    fprintf(f, "rather than to now\n");
     // return 0 or 1 to make main easier to write.
     return f == stdout ? 0 : 1;
 }
@@ -395,20 +480,26 @@ int print_version(void){
 
 
 int main(int argc, char **argv){
-    // parse args
-    char *output = NULL;
+    // parse args; positional args are packed to the front of argv
+    bool exact = false;
+    int npos = 0;
     bool nomoreflags = false;
     for(int i = 1; i < argc; i++){
-        if(nomoreflags && output) return print_help(stderr);
-        else if(nomoreflags) output = argv[i];
+        if(nomoreflags) argv[npos++] = argv[i];
+        else if(strcmp(argv[i], "--exact") == 0) exact = true;
         else if(strcmp(argv[i], "--help") == 0) return print_help(stdout);
         else if(strcmp(argv[i], "-h") == 0) return print_help(stdout);
         else if(strcmp(argv[i], "--version") == 0) return print_version();
         else if(strcmp(argv[i], "--") == 0) nomoreflags = true;
-        else if(output) return print_help(stderr);
-        else output = argv[i];
+        else argv[npos++] = argv[i];
     }
-    if(!output) return print_help(stderr);
-
-    return touch_file(output);
+    if(npos < 1) return print_help(stderr);
+    // only --exact takes INPUTs, and then it needs at least one
+    if(exact ? npos < 2 : npos > 1) return print_help(stderr);
+    char *output = argv[0];
+
+    if(!exact) return touch_file(output, NULL);
+    filetime_t mtime;
+    if(newest_mtime(&argv[1], npos - 1, &mtime)) return 1;
+    return touch_file(output, &mtime);
 }